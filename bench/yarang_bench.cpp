@@ -0,0 +1,577 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <yarang/latency_histogram.hpp>
+#include <yarang/ruleset.hpp>
+
+// End-to-end benchmark of scanning. Rulesets of several shapes and corpora of several kinds are generated from a seed,
+// rulesets are compiled by yarangc.sh into .bin files the same way as any other ruleset and every ruleset then scans
+// every corpus through Ruleset::scan_file. Same seed and options always generate the same rules and files, so results
+// of different builds of yarang can be compared run by run.
+
+const std::vector<std::string> AllRulesetShapes = {"literal", "regex", "hex", "loop", "mutex"};
+const std::vector<std::string> AllCorpusKinds = {"random", "pe", "text", "repetitive"};
+
+struct Options
+{
+    Options() : seed(1), rule_count(1000), file_count(200), file_size(64 * 1024), repeat(3), threads(1), bytecode(false),
+        output_dir(std::filesystem::temp_directory_path() / "yarang_bench"), yarangc("yarangc.sh"), json_file(),
+        ruleset_shapes(AllRulesetShapes), corpus_kinds(AllCorpusKinds) {}
+
+    std::uint64_t seed;
+    std::size_t rule_count;
+    std::size_t file_count;
+    // Average size of corpus files, actual sizes are spread between a half and one and a half of it
+    std::size_t file_size;
+    // Timed passes over each corpus, there is always one untimed pass before them
+    std::size_t repeat;
+    int threads;
+    bool bytecode;
+    std::filesystem::path output_dir;
+    std::string yarangc;
+    std::string json_file;
+    std::vector<std::string> ruleset_shapes;
+    std::vector<std::string> corpus_kinds;
+};
+
+std::vector<std::string> split_list(const std::string& list, const std::vector<std::string>& allowed)
+{
+    std::vector<std::string> result;
+    std::istringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        if (std::find(allowed.begin(), allowed.end(), item) == allowed.end())
+            throw std::runtime_error("Unknown item '" + item + "' in list " + list);
+        result.push_back(item);
+    }
+    return result;
+}
+
+Options parse_options(const std::vector<std::string>& args)
+{
+    Options result;
+    for (auto itr = args.begin(), end = args.end(); itr != end; ++itr)
+    {
+        const auto& opt = *itr;
+        auto value = [&]() -> const std::string& {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option " + opt + " expects a value");
+            return *++itr;
+        };
+
+        if (opt == "-o" || opt == "--output")
+            result.output_dir = value();
+        else if (opt == "--seed")
+            result.seed = std::stoull(value());
+        else if (opt == "--rules")
+            result.rule_count = std::max<std::size_t>(std::stoull(value()), 1);
+        else if (opt == "--files")
+            result.file_count = std::max<std::size_t>(std::stoull(value()), 1);
+        else if (opt == "--file-size")
+            result.file_size = std::max<std::size_t>(std::stoull(value()), 1024);
+        else if (opt == "--repeat")
+            result.repeat = std::max<std::size_t>(std::stoull(value()), 1);
+        else if (opt == "-t" || opt == "--threads")
+            result.threads = std::max(std::stoi(value()), 1);
+        else if (opt == "--rulesets")
+            result.ruleset_shapes = split_list(value(), AllRulesetShapes);
+        else if (opt == "--corpora")
+            result.corpus_kinds = split_list(value(), AllCorpusKinds);
+        else if (opt == "--yarangc")
+            result.yarangc = value();
+        else if (opt == "--bytecode")
+            result.bytecode = true;
+        else if (opt == "--json")
+            result.json_file = value();
+        else
+            throw std::runtime_error("Unknown option " + opt);
+    }
+    return result;
+}
+
+// Only the raw output of mt19937_64 is specified by the standard, distributions differ between standard libraries
+class Generator
+{
+public:
+    Generator(std::uint64_t seed) : _engine(seed) {}
+
+    std::uint64_t next(std::uint64_t bound)
+    {
+        return _engine() % bound;
+    }
+
+    std::uint8_t next_byte()
+    {
+        return static_cast<std::uint8_t>(_engine());
+    }
+
+    // Streams of different rulesets and corpora are independent of each other, so selecting only some of them
+    // doesn't change the rest
+    static std::uint64_t derive_seed(std::uint64_t seed, const std::string& name)
+    {
+        // FNV-1a, std::hash isn't the same everywhere either
+        std::uint64_t hash = 0xCBF29CE484222325ull;
+        for (auto ch : name)
+            hash = (hash ^ static_cast<std::uint8_t>(ch)) * 0x100000001B3ull;
+        return seed ^ hash;
+    }
+
+    template <typename T>
+    const T& pick(const std::vector<T>& items)
+    {
+        return items[next(items.size())];
+    }
+
+private:
+    std::mt19937_64 _engine;
+};
+
+// Words shared by the rules and the corpora so the rules actually match some of the files
+std::vector<std::string> generate_vocabulary(std::uint64_t seed)
+{
+    Generator gen(seed);
+    std::vector<std::string> result;
+    for (std::size_t i = 0; i < 512; ++i)
+    {
+        std::string word;
+        auto length = 6 + gen.next(7);
+        for (std::size_t j = 0; j < length; ++j)
+            word.push_back(static_cast<char>('a' + gen.next(26)));
+        result.push_back(word);
+    }
+    return result;
+}
+
+std::string hex_byte(std::uint8_t byte)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    return {digits[byte >> 4], digits[byte & 0xF]};
+}
+
+// yarang matches strings exactly as written and ignores modifiers like wide, so UTF-16 strings are spelled out as bytes
+std::string wide_hex_string(const std::string& str)
+{
+    std::string result = "{ ";
+    for (auto ch : str)
+        result += hex_byte(static_cast<std::uint8_t>(ch)) + " 00 ";
+    return result + "}";
+}
+
+void generate_rule(std::ostream& out, const std::string& shape, std::size_t index, Generator& gen, const std::vector<std::string>& vocabulary)
+{
+    out << "rule " << shape << "_" << index << "\n{\n";
+    if (shape == "literal")
+    {
+        out << "    strings:\n"
+            << "        $s0 = \"" << gen.pick(vocabulary) << "\"\n"
+            << "        $s1 = " << wide_hex_string(gen.pick(vocabulary)) << "\n"
+            << "        $s2 = \"" << gen.pick(vocabulary) << "\"\n"
+            << "        $s3 = \"" << gen.pick(vocabulary) << gen.pick(vocabulary) << "\"\n"
+            << "    condition:\n"
+            << "        2 of them\n";
+    }
+    else if (shape == "regex")
+    {
+        out << "    strings:\n"
+            << "        $r0 = /" << gen.pick(vocabulary) << "[0-9a-f]{2,8}" << gen.pick(vocabulary) << "/\n"
+            << "        $r1 = /" << gen.pick(vocabulary) << "\\s+(" << gen.pick(vocabulary) << "|" << gen.pick(vocabulary) << ")/\n"
+            << "        $r2 = /[a-z]{3}" << gen.pick(vocabulary) << "[0-9]+\\.(exe|dll|EXE|DLL)/\n"
+            << "    condition:\n"
+            << "        any of them\n";
+    }
+    else if (shape == "hex")
+    {
+        auto bytes = [&](std::size_t count) {
+            std::string result;
+            for (std::size_t i = 0; i < count; ++i)
+                result += hex_byte(gen.next_byte()) + " ";
+            return result;
+        };
+        auto jump = 1 + gen.next(16);
+        out << "    strings:\n"
+            << "        $h0 = { " << bytes(3) << "[" << jump << "-" << jump + 1 + gen.next(48) << "] " << bytes(2) << "?? " << bytes(2) << "}\n"
+            << "        $h1 = { " << bytes(2) << "?? " << bytes(1) << "( " << bytes(2) << "| " << bytes(2) << ") [2-8] " << bytes(2) << "}\n"
+            << "        $h2 = { 4D 5A [64-256] 50 45 00 00 " << bytes(2) << "}\n"
+            << "    condition:\n"
+            << "        ($h0 or $h1) and $h2\n";
+    }
+    else if (shape == "loop")
+    {
+        out << "    strings:\n"
+            << "        $s0 = \"" << gen.pick(vocabulary) << "\"\n"
+            << "        $s1 = \"" << gen.pick(vocabulary) << "\"\n"
+            << "        $s2 = \"" << gen.pick(vocabulary) << "\"\n"
+            << "    condition:\n"
+            << "        for any i in (1 .. #s0) : ( $s1 in (@s0[i] .. @s0[i] + 256) ) or\n"
+            << "        for any i in (0 .. 64) : ( uint8(i) == 0x" << hex_byte(gen.next_byte()) << " and for any of ($s1, $s2) : ( $ at i + 1 ) ) or\n"
+            << "        for 2 of them : ( $ in (0 .. 4096) )\n";
+    }
+    else if (shape == "mutex")
+    {
+        out << "    condition:\n"
+            << "        cuckoo.sync.mutex(/" << gen.pick(vocabulary) << "_[0-9]+/) or\n"
+            << "        cuckoo.sync.mutex(/^Global\\\\" << gen.pick(vocabulary) << "$/)\n";
+    }
+    out << "}\n\n";
+}
+
+std::filesystem::path generate_ruleset(const Options& options, const std::string& shape, const std::vector<std::string>& vocabulary)
+{
+    auto path = options.output_dir / "rules" / (shape + ".yar");
+    std::filesystem::create_directories(path.parent_path());
+
+    Generator gen(Generator::derive_seed(options.seed, shape));
+    std::ofstream out(path, std::ios::trunc);
+    if (shape == "mutex")
+        out << "import \"cuckoo\"\n\n";
+    for (std::size_t i = 0; i < options.rule_count; ++i)
+        generate_rule(out, shape, i, gen, vocabulary);
+    if (!out)
+        throw std::runtime_error("Unable to write " + path.native());
+    return path;
+}
+
+void append_wide(std::string& data, const std::string& str)
+{
+    for (auto ch : str)
+    {
+        data.push_back(ch);
+        data.push_back('\0');
+    }
+}
+
+void put_uint(std::string& data, std::size_t offset, std::uint64_t value, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+        data[offset + i] = static_cast<char>(value >> (8 * i));
+}
+
+// Headers of 32-bit PE with three sections, code-like bytes and string table with ASCII and UTF-16 strings
+std::string generate_pe(std::size_t size, Generator& gen, const std::vector<std::string>& vocabulary)
+{
+    static const std::uint8_t opcodes[] = {0x55, 0x8B, 0xEC, 0x89, 0xE8, 0xFF, 0x00, 0x83, 0xC4, 0x5D, 0xC3, 0x6A, 0x50};
+
+    std::string data(0x400, '\0');
+    data[0] = 'M', data[1] = 'Z';
+    put_uint(data, 0x3C, 0x80, 4);
+    data.replace(0x80, 4, std::string{"PE\0\0", 4});
+    put_uint(data, 0x84, 0x14C, 2);
+    put_uint(data, 0x86, 3, 2);
+    put_uint(data, 0x94, 0xE0, 2);
+    const char* sections[] = {".text", ".rdata", ".data"};
+    for (std::size_t i = 0; i < 3; ++i)
+        data.replace(0x178 + i * 40, std::strlen(sections[i]), sections[i]);
+
+    auto code_end = std::max(size / 2, data.size());
+    while (data.size() < code_end)
+        data.push_back(gen.next(4) ? static_cast<char>(opcodes[gen.next(sizeof(opcodes))]) : static_cast<char>(gen.next_byte()));
+    while (data.size() < size)
+    {
+        if (gen.next(2))
+            data += gen.pick(vocabulary);
+        else
+            append_wide(data, gen.pick(vocabulary));
+        data.push_back('\0');
+    }
+    data.resize(size);
+    return data;
+}
+
+std::string generate_text(std::size_t size, Generator& gen, const std::vector<std::string>& vocabulary)
+{
+    std::string data;
+    while (data.size() < size)
+    {
+        data += gen.pick(vocabulary);
+        if (gen.next(16) == 0)
+            data += std::to_string(gen.next(100000));
+        data.push_back(gen.next(12) ? ' ' : '\n');
+    }
+    data.resize(size);
+    return data;
+}
+
+// Short block with a single word repeated over the whole file, worst case for the number of matches
+std::string generate_repetitive(std::size_t size, Generator& gen, const std::vector<std::string>& vocabulary)
+{
+    std::string block(64, '\0');
+    for (auto& ch : block)
+        ch = static_cast<char>(gen.next_byte());
+    const auto& word = gen.pick(vocabulary);
+    block.replace(gen.next(block.size() - word.size()), word.size(), word);
+
+    std::string data;
+    while (data.size() < size)
+        data += block;
+    data.resize(size);
+    return data;
+}
+
+std::string generate_file(const std::string& kind, std::size_t size, Generator& gen, const std::vector<std::string>& vocabulary)
+{
+    if (kind == "pe")
+        return generate_pe(size, gen, vocabulary);
+    else if (kind == "text")
+        return generate_text(size, gen, vocabulary);
+    else if (kind == "repetitive")
+        return generate_repetitive(size, gen, vocabulary);
+
+    std::string data(size, '\0');
+    for (auto& ch : data)
+        ch = static_cast<char>(gen.next_byte());
+    return data;
+}
+
+struct Corpus
+{
+    std::string kind;
+    std::vector<std::string> files;
+    std::uint64_t total_size;
+};
+
+Corpus generate_corpus(const Options& options, const std::string& kind, const std::vector<std::string>& vocabulary)
+{
+    auto dir = options.output_dir / "corpus" / kind;
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    Corpus result{kind, {}, 0};
+    Generator gen(Generator::derive_seed(options.seed, kind));
+    for (std::size_t i = 0; i < options.file_count; ++i)
+    {
+        auto size = options.file_size / 2 + gen.next(options.file_size + 1);
+        auto data = generate_file(kind, size, gen, vocabulary);
+
+        auto path = (dir / std::to_string(i)).native();
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), data.size());
+        if (!out)
+            throw std::runtime_error("Unable to write " + path);
+
+        result.files.push_back(path);
+        result.total_size += data.size();
+    }
+    return result;
+}
+
+// Report in the shape of behavior.summary.mutexes of Cuckoo, used by every scan so the mutex rules have something to match
+std::string generate_cuckoo_report(const Options& options, const std::vector<std::string>& vocabulary)
+{
+    auto path = (options.output_dir / "cuckoo.json").native();
+    Generator gen(Generator::derive_seed(options.seed, "cuckoo"));
+    std::ofstream out(path, std::ios::trunc);
+    out << "{\"behavior\": {\"summary\": {\"mutexes\": [";
+    for (std::size_t i = 0; i < 64; ++i)
+    {
+        out << (i ? ", " : "") << "\"";
+        if (gen.next(2))
+            out << gen.pick(vocabulary) << "_" << gen.next(1000);
+        else
+            out << "Global\\\\" << gen.pick(vocabulary);
+        out << "\"";
+    }
+    out << "]}}}\n";
+    return path;
+}
+
+std::string quote(const std::string& arg)
+{
+    std::string result = "'";
+    for (auto ch : arg)
+    {
+        if (ch == '\'')
+            result += "'\\''";
+        else
+            result.push_back(ch);
+    }
+    return result + "'";
+}
+
+// Compiled through yarangc.sh like any deployed ruleset, returns seconds it took
+double compile_ruleset(const Options& options, const std::filesystem::path& rules_file)
+{
+    auto command = quote(options.yarangc) + (options.bytecode ? " -B bytecode " : " ") + quote(rules_file.native()) + " > " + quote(rules_file.native() + ".log") + " 2>&1";
+
+    auto start = std::chrono::steady_clock::now();
+    if (std::system(command.c_str()) != 0)
+        throw std::runtime_error("Compilation of " + rules_file.native() + " failed, see " + rules_file.native() + ".log");
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Current and peak resident set size of the process in KiB
+std::uint64_t read_memory_status(const std::string& field)
+{
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.compare(0, field.size() + 1, field + ":") == 0)
+            return std::stoull(line.substr(field.size() + 1));
+    }
+    return 0;
+}
+
+// Peak is reset so it belongs to a single ruleset, older kernels keep the peak of the whole process
+void reset_peak_memory()
+{
+    std::ofstream out("/proc/self/clear_refs");
+    out << "5";
+}
+
+struct Result
+{
+    std::string ruleset;
+    std::string corpus;
+    double compile_seconds;
+    std::uint64_t files;
+    std::uint64_t bytes;
+    std::uint64_t hits;
+    LatencyHistogram latencies;
+    std::uint64_t rss_kib;
+    std::uint64_t peak_rss_kib;
+};
+
+void count_hit(const char*, void* context)
+{
+    ++*static_cast<std::uint64_t*>(context);
+}
+
+Result run_benchmark(const Options& options, const std::string& shape, const std::filesystem::path& ruleset_path, double compile_seconds,
+    const Corpus& corpus, const std::string& cuckoo_file)
+{
+    reset_peak_memory();
+
+    Result result{shape, corpus.kind, compile_seconds, 0, 0, 0, {}, 0, 0};
+    auto ruleset = Ruleset{ruleset_path.native()};
+    auto scanner = ruleset.new_scanner(count_hit);
+    const char* cuckoo = shape == "mutex" ? cuckoo_file.c_str() : nullptr;
+
+    // Warms up the page cache, the scanner and the code of the ruleset
+    std::uint64_t hits = 0;
+    for (const auto& file : corpus.files)
+        scanner.scan_file(file, options.threads, cuckoo, &hits);
+
+    for (std::size_t pass = 0; pass < options.repeat; ++pass)
+    {
+        for (const auto& file : corpus.files)
+        {
+            auto start = std::chrono::steady_clock::now();
+            scanner.scan_file(file, options.threads, cuckoo, &result.hits);
+            result.latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+        result.files += corpus.files.size();
+        result.bytes += corpus.total_size;
+    }
+
+    result.rss_kib = read_memory_status("VmRSS");
+    result.peak_rss_kib = read_memory_status("VmHWM");
+    return result;
+}
+
+double get_seconds(const Result& result)
+{
+    return result.latencies.get_total() / 1e9;
+}
+
+void print_result(const Result& result)
+{
+    auto seconds = get_seconds(result);
+    auto us = [](std::uint64_t ns) { return ns / 1000.0; };
+    std::cout << std::left << std::setw(10) << result.ruleset << std::setw(12) << result.corpus << std::right << std::fixed << std::setprecision(3)
+        << std::setw(10) << (seconds > 0.0 ? result.bytes / seconds / 1e9 : 0.0)
+        << std::setw(12) << std::setprecision(1) << (seconds > 0.0 ? result.files / seconds : 0.0)
+        << std::setw(12) << us(result.latencies.get_percentile(0.5))
+        << std::setw(12) << us(result.latencies.get_percentile(0.99))
+        << std::setw(12) << us(result.latencies.get_percentile(0.999))
+        << std::setw(12) << result.peak_rss_kib / 1024.0
+        << std::setw(10) << result.hits << std::defaultfloat << std::endl;
+}
+
+// One JSON object per line and ruleset-corpus pair, keys don't need escaping and values are numbers or known names
+void write_json(std::ostream& out, const Options& options, const Result& result)
+{
+    auto seconds = get_seconds(result);
+    out << std::fixed << std::setprecision(6)
+        << "{\"ruleset\":\"" << result.ruleset << "\",\"corpus\":\"" << result.corpus << "\""
+        << ",\"backend\":\"" << (options.bytecode ? "bytecode" : "native") << "\""
+        << ",\"seed\":" << options.seed << ",\"rules\":" << options.rule_count << ",\"threads\":" << options.threads
+        << ",\"compile_seconds\":" << result.compile_seconds
+        << ",\"files\":" << result.files << ",\"bytes\":" << result.bytes << ",\"seconds\":" << seconds
+        << ",\"gb_per_second\":" << (seconds > 0.0 ? result.bytes / seconds / 1e9 : 0.0)
+        << ",\"files_per_second\":" << (seconds > 0.0 ? result.files / seconds : 0.0)
+        << ",\"latency_ns\":{\"p50\":" << result.latencies.get_percentile(0.5) << ",\"p99\":" << result.latencies.get_percentile(0.99)
+        << ",\"p999\":" << result.latencies.get_percentile(0.999) << ",\"max\":" << result.latencies.get_max() << "}"
+        << ",\"rss_kib\":" << result.rss_kib << ",\"peak_rss_kib\":" << result.peak_rss_kib
+        << ",\"hits\":" << result.hits << "}" << std::defaultfloat << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    Options options;
+    try
+    {
+        options = parse_options(args);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << error.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [-o OUTPUT_DIR] [--seed N] [--rules N] [--files N] [--file-size BYTES] [--repeat N] [-t THREADS] [--rulesets literal,regex,hex,loop,mutex] [--corpora random,pe,text,repetitive] [--yarangc PATH] [--bytecode] [--json FILE]" << std::endl;
+        return 2;
+    }
+
+    try
+    {
+        std::ofstream json_out;
+        if (!options.json_file.empty())
+        {
+            json_out.open(options.json_file, std::ios::trunc);
+            if (!json_out)
+                throw std::runtime_error("Unable to write " + options.json_file);
+        }
+
+        auto vocabulary = generate_vocabulary(options.seed);
+        std::vector<Corpus> corpora;
+        for (const auto& kind : options.corpus_kinds)
+            corpora.push_back(generate_corpus(options, kind, vocabulary));
+        auto cuckoo_file = generate_cuckoo_report(options, vocabulary);
+
+        std::cout << std::left << std::setw(10) << "ruleset" << std::setw(12) << "corpus" << std::right << std::setw(10) << "GB/s"
+            << std::setw(12) << "files/s" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us" << std::setw(12) << "p999 us"
+            << std::setw(12) << "peak MiB" << std::setw(10) << "hits" << std::endl;
+        for (const auto& shape : options.ruleset_shapes)
+        {
+            auto rules_file = generate_ruleset(options, shape, vocabulary);
+            auto compile_seconds = compile_ruleset(options, rules_file);
+            auto ruleset_path = rules_file.native() + ".bin";
+            for (const auto& corpus : corpora)
+            {
+                auto result = run_benchmark(options, shape, ruleset_path, compile_seconds, corpus, cuckoo_file);
+                print_result(result);
+                if (json_out.is_open())
+                    write_json(json_out, options, result);
+            }
+        }
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Large allocations of the runtime (HyperScan databases and scratches, scan contexts) are backed by 2 MB pages so
+// the big tables HyperScan walks during the scan need fewer TLB entries. Memory is faulted in right away so the first
+// scans don't stall on page faults. Every allocation is prefixed by a header so it can be released through the plain
+// free callback HyperScan uses. Controlled by YARANG_HUGE_PAGES environment variable:
+//
+//   thp (default) - transparent huge pages requested through madvise
+//   explicit      - pages reserved in hugetlbfs pool, falls back to transparent ones when the pool is exhausted
+//   off           - regular heap allocations
+
+enum class HugePages
+{
+    Off,
+    Transparent,
+    Explicit
+};
+
+constexpr std::size_t HugePageSize = 2 * 1024 * 1024;
+// Keeps the 64-byte alignment HyperScan needs for its structures
+constexpr std::size_t AllocationHeaderSize = 64;
+
+struct AllocationHeader
+{
+    // Size of the whole mapping or 0 for heap allocations
+    std::size_t mapped_size;
+    std::size_t size;
+};
+
+inline HugePages get_huge_pages_mode()
+{
+    static const auto mode = []() {
+        auto value = std::getenv("YARANG_HUGE_PAGES");
+        if (value == nullptr || std::strcmp(value, "thp") == 0)
+            return HugePages::Transparent;
+        else if (std::strcmp(value, "explicit") == 0)
+            return HugePages::Explicit;
+        return HugePages::Off;
+    }();
+    return mode;
+}
+
+inline std::size_t round_up(std::size_t size, std::size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Transparent huge pages are only used for 2 MB aligned ranges so the mapping is over-allocated and trimmed
+inline void* map_aligned(std::size_t size, int flags)
+{
+    auto mapped = ::mmap(nullptr, size + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (mapped == MAP_FAILED)
+        return nullptr;
+
+    auto begin = reinterpret_cast<std::uintptr_t>(mapped);
+    auto aligned = round_up(begin, HugePageSize);
+    if (aligned != begin)
+        ::munmap(mapped, aligned - begin);
+    ::munmap(reinterpret_cast<void*>(aligned + size), begin + HugePageSize - aligned);
+    return reinterpret_cast<void*>(aligned);
+}
+
+inline void* map_huge_pages(std::size_t size)
+{
+    if (get_huge_pages_mode() == HugePages::Explicit)
+    {
+        auto result = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (result != MAP_FAILED)
+            return result;
+    }
+
+    auto result = map_aligned(size, 0);
+    if (result == nullptr)
+        return nullptr;
+
+    ::madvise(result, size, MADV_HUGEPAGE);
+    auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    for (std::size_t offset = 0; offset < size; offset += page_size)
+        static_cast<volatile char*>(result)[offset] = 0;
+    return result;
+}
+
+inline void* huge_pages_alloc(std::size_t size)
+{
+    auto total_size = size + AllocationHeaderSize;
+
+    // Allocations smaller than a half of huge page would mostly waste it
+    AllocationHeader* header = nullptr;
+    if (get_huge_pages_mode() != HugePages::Off && total_size >= HugePageSize / 2)
+    {
+        auto mapped_size = round_up(total_size, HugePageSize);
+        header = static_cast<AllocationHeader*>(map_huge_pages(mapped_size));
+        if (header)
+            header->mapped_size = mapped_size;
+    }
+
+    if (header == nullptr)
+    {
+        header = static_cast<AllocationHeader*>(std::aligned_alloc(AllocationHeaderSize, round_up(total_size, AllocationHeaderSize)));
+        if (header == nullptr)
+            return nullptr;
+        header->mapped_size = 0;
+    }
+
+    header->size = size;
+    return reinterpret_cast<char*>(header) + AllocationHeaderSize;
+}
+
+inline void huge_pages_free(void* ptr)
+{
+    if (ptr == nullptr)
+        return;
+
+    auto header = reinterpret_cast<AllocationHeader*>(static_cast<char*>(ptr) - AllocationHeaderSize);
+    if (header->mapped_size)
+        ::munmap(header, header->mapped_size);
+    else
+        std::free(header);
+}
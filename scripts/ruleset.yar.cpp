@@ -1,83 +1,191 @@
-#include <array>
-#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
-#include <filesystem>
+#include <exception>
 #include <fstream>
+#include <initializer_list>
 #include <iostream>
-#include <iterator>
-#include <tuple>
-#include <variant>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
-#include <hs/hs_runtime.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
 #include <rapidjson/filereadstream.h>
 #include <rapidjson/document.h>
 
-#include "endian.hpp"
+#include "huge_pages.hpp"
+#include "ruleset.yar.hpp"
 
-#define UNDEFINED 0xFFFABADAFABADAFFull
-#define IS_UNDEF(x) static_cast<std::uint64_t>(x) == UNDEFINED
+// Schedules of rulesets built with yarangc --stats evaluate the rules through this
+static bool profile_rule(const ScanContext* ctx, std::size_t id, bool(*rule)(const ScanContext*));
 
-struct Scanner;
-struct ScanContext;
+// Generated by yarangc, contains rules array and the evaluation schedule
+#include "rules.def"
 
-using RuleFunction = bool(*)(const ScanContext*);
-using MatchCallback = void(*)(const char*, void*);
+static void add_match(ScanContext* ctx, std::size_t id, std::uint64_t offset, std::uint64_t length);
+static void add_mutex_match(ScanContext* ctx, std::size_t id);
 
-enum class RuleVisibility
+static hs_database_t* literal_db = nullptr;
+static hs_database_t* regex_db = nullptr;
+// Regexes without a reasonable limit on the length of their matches, never scanned in chunks
+static hs_database_t* unbounded_db = nullptr;
+static hs_database_t* mutex_db = nullptr;
+static hs_scratch_t* prototype_scratch = nullptr;
+// Data databases compiled by yarangc --vectored, these can't be used with hs_scan. Unbounded database is always
+// vectored so data larger than a single block can be scanned as a whole.
+static bool literal_vectored = false;
+static bool regex_vectored = false;
+static bool unbounded_vectored = false;
+
+// Parallel scans split the data into chunks of at least this size, a few chunks per thread so the threads which get
+// the quicker ones pick up more of them. Chunks never exceed the size which HyperScan can scan as one block.
+constexpr std::size_t MinChunkSize = 16 * 1024 * 1024;
+constexpr std::size_t MaxChunkSize = 1024 * 1024 * 1024;
+constexpr std::size_t ChunksPerThread = 4;
+// HyperScan takes lengths as unsigned int, larger data is given to vectored databases in blocks of this size and
+// to the others in chunks
+constexpr std::size_t MaxBlockSize = 0x80000000;
+// Reading the clock on every match would make matches of pathological inputs even more expensive
+constexpr std::uint32_t MatchesPerClockCheck = 1024;
+
+constexpr const char* StageNames[] = {"read", "literal", "regex", "unbounded", "cuckoo", "mutex", "evaluation"};
+
+// Profiling builds only count every Nth scan of each scanner given by YARANG_STATS_SAMPLE environment variable
+static std::uint64_t get_stats_sample_period()
 {
-    Public,
-    Private
-};
+    static const auto period = []() {
+        auto value = std::getenv("YARANG_STATS_SAMPLE");
+        auto result = value ? std::strtoull(value, nullptr, 10) : 0;
+        return result > 0 ? result : 1ull;
+    }();
+    return period;
+}
 
-enum class RuleMatch
+static bool is_stage_timed(const Scanner* scanner)
 {
-    Hit,
-    NoHit,
-    NotEvaluated
-};
+    return scanner->trace_stages || (profiling && scanner->stats->sampled);
+}
+
+// Time goes to the last scan of scanners which trace stages and to the statistics of sampled scans of profiling builds
+static void add_stage_time(Scanner* scanner, ScanStage stage, std::uint64_t elapsed_ns)
+{
+    auto index = static_cast<std::size_t>(stage);
+    if (scanner->trace_stages)
+        scanner->stage_ns[index].fetch_add(elapsed_ns, std::memory_order_relaxed);
+    if (profiling && scanner->stats->sampled)
+        scanner->stats->stage_ns[index].fetch_add(elapsed_ns, std::memory_order_relaxed);
+}
 
-struct Rule
+// Adds the time of its scope to the stage, the clock isn't read at all when nothing records it
+class StageTimer
 {
-    const char* name;
-    RuleVisibility visibility;
-    RuleFunction function;
-    RuleMatch match;
+public:
+    StageTimer(Scanner* scanner, ScanStage stage) : _scanner(is_stage_timed(scanner) ? scanner : nullptr), _stage(stage), _start()
+    {
+        if (_scanner)
+            _start = std::chrono::steady_clock::now();
+    }
+
+    ~StageTimer()
+    {
+        if (_scanner)
+            add_stage_time(_scanner, _stage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count());
+    }
+
+private:
+    Scanner* _scanner;
+    ScanStage _stage;
+    std::chrono::steady_clock::time_point _start;
 };
 
-struct Match
+static bool profile_rule(const ScanContext* ctx, std::size_t id, bool(*rule)(const ScanContext*))
+{
+    auto stats = ctx->scanner->stats.get();
+    if (!stats->sampled)
+        return rule(ctx);
+
+    auto start = __rdtsc();
+    auto result = rule(ctx);
+    auto& rule_stats = stats->rules[id];
+    rule_stats.cycles += __rdtsc() - start;
+    rule_stats.evaluations++;
+    rule_stats.hits += result;
+    return result;
+}
+
+// Match found by a thread of parallel scan with offsets in the whole data
+struct ChunkMatch
 {
-    std::uint32_t count;
-    std::vector<std::uint64_t> offsets;
-    std::vector<std::uint32_t> lengths;
+    std::uint32_t id;
+    std::uint64_t from;
+    std::uint64_t to;
 };
 
-struct Scanner
+// Chunk of parallel scan owns matches which end in (begin, end], each match of the whole data is owned by exactly one
+// chunk so the matches found in the overlaps of the scanned ranges are dropped by all the other chunks
+struct Chunk
 {
-    hs_scratch_t* literal_scratch;
-    hs_scratch_t* regex_scratch;
-    hs_scratch_t* mutex_scratch;
-    MatchCallback match_callback;
-    ScanContext* ctx;
+    std::uint64_t begin;
+    std::uint64_t end;
+    // Offset where the scanned range of the current database starts
+    std::uint64_t base;
+    std::vector<ChunkMatch> matches;
+    Scanner* scanner;
+    std::uint32_t match_ticks;
+    ScanStatus status;
 };
 
-static void add_match(ScanContext* ctx, std::size_t id, std::uint64_t offset, std::uint64_t length);
-static void add_mutex_match(ScanContext* ctx, std::size_t id);
-static const Match* get_match(const ScanContext* ctx, std::size_t id);
-static std::uint64_t get_mutex_match(const ScanContext* ctx, std::size_t id);
-static const char* get_data(const ScanContext* ctx, std::uint64_t offset = 0);
-static std::uint64_t get_data_size(const ScanContext* ctx);
-static bool evaluate_rule(const ScanContext* ctx, std::size_t id);
+// Status the scan has to stop with after another match of a pattern with the given number of matches
+static ScanStatus check_limits(const Scanner* scanner, std::uint32_t pattern_matches, std::uint32_t& match_ticks)
+{
+    const auto& limits = scanner->limits;
+    if (limits.max_pattern_matches && pattern_matches > limits.max_pattern_matches)
+        return ScanStatus::TooManyMatches;
+    if (limits.timeout_us && ++match_ticks % MatchesPerClockCheck == 0 && std::chrono::steady_clock::now() >= scanner->deadline)
+        return ScanStatus::Timeout;
+    return ScanStatus::Complete;
+}
 
-static hs_database_t* literal_db = nullptr;
-static hs_database_t* regex_db = nullptr;
-static hs_database_t* mutex_db = nullptr;
+// Also checked between the databases so scans with only a few matches keep the time budget too
+static bool is_stopped(Scanner* scanner)
+{
+    if (scanner->status == ScanStatus::Complete && scanner->limits.timeout_us && std::chrono::steady_clock::now() >= scanner->deadline)
+        scanner->status = ScanStatus::Timeout;
+    return scanner->status != ScanStatus::Complete;
+}
 
+// Non-zero return value makes HyperScan terminate the scan
 static int on_match(unsigned int id, unsigned long long from, unsigned long long to, unsigned int/* flags*/, void *context)
 {
     auto ctx = static_cast<ScanContext*>(context);
     add_match(ctx, id, from, to - from);
-    return 0;
+
+    auto scanner = ctx->scanner;
+    scanner->status = check_limits(scanner, ctx->matches[id].count, scanner->match_ticks);
+    return scanner->status != ScanStatus::Complete;
+}
+
+static int on_chunk_match(unsigned int id, unsigned long long from, unsigned long long to, unsigned int/* flags*/, void *context)
+{
+    auto chunk = static_cast<Chunk*>(context);
+    if (chunk->begin < chunk->base + to && chunk->base + to <= chunk->end)
+    {
+        chunk->matches.push_back({id, chunk->base + from, chunk->base + to});
+        auto counts = chunk->scanner->chunk_match_counts.get();
+        auto pattern_matches = counts ? counts[id].fetch_add(1, std::memory_order_relaxed) + 1 : 0;
+        chunk->status = check_limits(chunk->scanner, pattern_matches, chunk->match_ticks);
+    }
+    return chunk->status != ScanStatus::Complete;
 }
 
 static int on_mutex_match(unsigned int id, unsigned long long from, unsigned long long to, unsigned int/* flags*/, void *context)
@@ -87,362 +195,1011 @@ static int on_mutex_match(unsigned int id, unsigned long long from, unsigned lon
     return 0;
 }
 
-inline bool match_string(const ScanContext* ctx, std::size_t id)
+// IDs of public rules in the order of yng_reported_rules
+static const std::vector<std::uint32_t>& get_public_rules()
 {
-    return get_match(ctx, id)->count > 0;
+    static const auto public_rules = []() {
+        std::vector<std::uint32_t> result;
+        for (std::size_t id = 0; id < rules.size(); ++id)
+        {
+            if (rules[id].visibility == RuleVisibility::Public)
+                result.push_back(static_cast<std::uint32_t>(id));
+        }
+        return result;
+    }();
+    return public_rules;
 }
 
-inline std::uint64_t match_count(const ScanContext* ctx, std::size_t id)
+// Rules are evaluated by the generated schedule so only reporting of public rules is left here
+static void report_rules(const ScanContext* ctx)
 {
-    return get_match(ctx, id)->count;
-}
+    const auto& public_rules = get_public_rules();
+    auto scanner = ctx->scanner;
+    for (std::size_t index = 0; index < public_rules.size(); ++index)
+    {
+        if (!ctx->rule_matches[public_rules[index]])
+            continue;
 
-inline std::uint64_t match_offset(const ScanContext* ctx, std::size_t id, std::size_t index = 0)
-{
-    auto& offsets = get_match(ctx, id)->offsets;
-    return index < offsets.size() ? offsets[index] : UNDEFINED;
+        if (scanner->match_callback_v2)
+            scanner->match_callback_v2(index, scanner, ctx->user_data);
+        else
+            scanner->match_callback(rules[public_rules[index]].name, ctx->user_data);
+    }
 }
 
-inline std::uint64_t match_length(const ScanContext* ctx, std::size_t id, std::size_t index = 0)
+static void report_rules(const ScanContext* ctx, yng_result* result)
 {
-    auto& lengths = get_match(ctx, id)->lengths;
-    return index < lengths.size() ? lengths[index] : UNDEFINED;
+    const auto& public_rules = get_public_rules();
+    result->count = 0;
+    for (std::uint32_t index = 0; index < public_rules.size(); ++index)
+    {
+        if (!ctx->rule_matches[public_rules[index]])
+            continue;
+
+        if (result->count < result->capacity)
+            result->rule_ids[result->count] = index;
+        result->count++;
+    }
 }
 
-inline bool match_at(const ScanContext* ctx, std::size_t id, std::uint64_t expected)
+static void add_match(ScanContext* ctx, std::size_t id, std::uint64_t offset, std::uint64_t length)
 {
-    for (auto offset : get_match(ctx, id)->offsets)
+    if constexpr (profiling)
     {
-        if (offset == expected)
-            return true;
+        if (ctx->scanner->stats->sampled)
+            ctx->scanner->stats->pattern_matches[id]++;
     }
-    return false;
+
+    if (ctx->matches[id].count == 0)
+        ctx->scanner->matched_patterns.push_back(static_cast<std::uint32_t>(id));
+    ctx->matches[id].count++;
+    ctx->matches[id].offsets.push_back(offset);
+    ctx->matches[id].lengths.push_back(length);
 }
 
-inline bool match_in(const ScanContext* ctx, std::size_t id, std::uint64_t low, std::uint64_t high)
+static void add_mutex_match(ScanContext* ctx, std::size_t id)
 {
-    for (auto offset : get_match(ctx, id)->offsets)
-    {
-        if (low <= offset && offset < high)
-            return true;
-    }
-    return false;
+    ctx->mutex_matches[id]++;
+}
+
+#define DECLARE_DATABASE(name) \
+    extern char* name##_start; \
+    extern char* name##_end; \
+    extern std::uint32_t name##_size; \
+    extern const char name##_id[];
+
+#define DATABASE_VARIANTS(name) { \
+    DatabaseVariant{(char*)&name##_avx512_start, name##_avx512_size, name##_avx512_id, cpu_supports_avx512()}, \
+    DatabaseVariant{(char*)&name##_avx2_start, name##_avx2_size, name##_avx2_id, cpu_supports_avx2()}, \
+    DatabaseVariant{(char*)&name##_baseline_start, name##_baseline_size, name##_baseline_id, true}, \
+    DatabaseVariant{(char*)&name##_start, name##_size, name##_id, true} \
+}
+
+extern "C" {
+
+DECLARE_DATABASE(literal_db)
+DECLARE_DATABASE(literal_db_baseline)
+DECLARE_DATABASE(literal_db_avx2)
+DECLARE_DATABASE(literal_db_avx512)
+
+DECLARE_DATABASE(regex_db)
+DECLARE_DATABASE(regex_db_baseline)
+DECLARE_DATABASE(regex_db_avx2)
+DECLARE_DATABASE(regex_db_avx512)
+
+DECLARE_DATABASE(unbounded_db)
+DECLARE_DATABASE(unbounded_db_baseline)
+DECLARE_DATABASE(unbounded_db_avx2)
+DECLARE_DATABASE(unbounded_db_avx512)
+
+DECLARE_DATABASE(mutex_db)
+DECLARE_DATABASE(mutex_db_baseline)
+DECLARE_DATABASE(mutex_db_avx2)
+DECLARE_DATABASE(mutex_db_avx512)
+
 }
 
-template <typename BodyFn, typename... Vars, typename... Ts>
-inline bool loop(const ScanContext* ctx, std::uint64_t n, std::tuple<Vars...>&& vars, const BodyFn& body, Ts... ids)
+struct DatabaseVariant
 {
-    const std::uint64_t tolerance = sizeof...(Ts) - n;
-    std::uint64_t index = 0, hits = 0;
-    for (auto id : std::array<std::uint64_t, sizeof...(Ts)>{ids...})
-    {
-        if (index - hits > tolerance)
-            return false;
+    const char* data;
+    std::uint32_t size;
+    // Hash of the serialized database, empty for rulesets built before it was embedded
+    const char* id;
+    bool supported;
+};
 
-        if (body(ctx, std::move(vars), id) && ++hits == n)
-            return true;
+// Databases deserialized into files shared between processes, they are unmapped instead of freed
+static std::vector<std::pair<void*, std::size_t>> shared_databases;
 
-        index++;
-    }
+// HyperScan needs AVX512BW for its AVX-512 code paths
+static bool cpu_supports_avx512()
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512bw");
+}
 
-    return false;
+static bool cpu_supports_avx2()
+{
+    return __builtin_cpu_supports("avx2");
 }
 
-template <typename BodyFn, typename... Ts>
-inline bool loop(const ScanContext* ctx, std::uint64_t n, const BodyFn& body, Ts... ids)
+// Only files of the expected size written by this user and nobody else are used, a truncated, stale or planted file
+// is ignored. HyperScan checks the header of the database, its version and the platform it was built for.
+static hs_database_t* map_shared_database(const std::string& path, std::size_t db_size)
 {
-    return loop(ctx, n, std::tuple{}, body, ids...);
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat file_stat;
+    void* memory = MAP_FAILED;
+    if (::fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_uid == ::geteuid()
+        && (file_stat.st_mode & (S_IWGRP | S_IWOTH)) == 0 && static_cast<std::size_t>(file_stat.st_size) == db_size)
+        memory = ::mmap(nullptr, db_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (memory == MAP_FAILED)
+        return nullptr;
+
+    auto db = static_cast<hs_database_t*>(memory);
+    char* info = nullptr;
+    std::size_t mapped_db_size = 0;
+    bool valid = hs_database_info(db, &info) == HS_SUCCESS && hs_database_size(db, &mapped_db_size) == HS_SUCCESS && mapped_db_size == db_size;
+    std::free(info);
+    if (!valid)
+    {
+        ::munmap(memory, db_size);
+        return nullptr;
+    }
+
+    shared_databases.emplace_back(memory, db_size);
+    return db;
 }
 
-template <typename BodyFn, typename... Vars, typename... Ints>
-inline bool loop_ints(const ScanContext* ctx, std::uint64_t n, std::tuple<Vars...>&& vars, const BodyFn& body, Ints... ints)
+// With YARANG_SHARED_DB_DIR set, the database is deserialized only by the first process which loads the ruleset.
+// It deserializes it right into a file under temporary name and atomically renames it, all other processes just map
+// the file read-only so they share its pages. HyperScan databases contain no pointers so they work at any address
+// with the same alignment, which mapping of the whole file guarantees. Returns nullptr if the shared copy can't be used.
+static hs_database_t* load_shared_database(const char* directory, const DatabaseVariant& variant)
 {
-    const std::uint64_t tolerance = sizeof...(Ints) - n;
-    std::uint64_t index = 0, hits = 0;
-    for (auto i : std::array<std::uint64_t, sizeof...(Ints)>{ints...})
+    if (variant.id[0] == '\0')
+        return nullptr;
+
+    std::size_t db_size;
+    if (hs_serialized_database_size(variant.data, variant.size, &db_size) != HS_SUCCESS)
+        return nullptr;
+
+    auto path = std::string{directory} + "/" + variant.id + ".hsdb";
+    if (auto db = map_shared_database(path, db_size))
+        return db;
+
+    // Unique name so rulesets of this or other processes deserializing the same database at once don't clash
+    auto tmp_path = path + ".tmp.XXXXXX";
+    auto fd = ::mkostemp(tmp_path.data(), O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    void* memory = MAP_FAILED;
+    if (::fchmod(fd, 0644) == 0 && ::ftruncate(fd, db_size) == 0)
+        memory = ::mmap(nullptr, db_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    bool deserialized = false;
+    if (memory != MAP_FAILED)
     {
-        if (index - hits > tolerance)
-            return false;
+        deserialized = hs_deserialize_database_at(variant.data, variant.size, static_cast<hs_database_t*>(memory)) == HS_SUCCESS;
+        ::munmap(memory, db_size);
+    }
 
-        if (body(ctx, std::tuple_cat(vars, std::tuple{std::ref(i)}), i) && ++hits == n)
-            return true;
+    if (!deserialized || ::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        ::unlink(tmp_path.c_str());
+        return nullptr;
+    }
 
-        index++;
+    return map_shared_database(path, db_size);
+}
+
+static void free_database(hs_database_t* db)
+{
+    for (auto itr = shared_databases.begin(); itr != shared_databases.end(); ++itr)
+    {
+        if (itr->first == db)
+        {
+            ::munmap(itr->first, itr->second);
+            shared_databases.erase(itr);
+            return;
+        }
     }
 
-    return false;
+    hs_free_database(db);
 }
 
-template <typename BodyFn, typename... Ints>
-inline bool loop_ints(const ScanContext* ctx, std::uint64_t n, const BodyFn& body, Ints... ints)
+// Rulesets built for several CPU targets contain a variant of each database for each of them. Variants are ordered
+// from the most demanding one and the first one which was built and which this CPU supports is used.
+static hs_database_t* load_database(std::initializer_list<DatabaseVariant> variants)
 {
-    return loop_ints(ctx, n, std::tuple{}, body, ints...);
+    for (const auto& variant : variants)
+    {
+        if (variant.size == 0 || !variant.supported)
+            continue;
+
+        if (auto shared_db_dir = std::getenv("YARANG_SHARED_DB_DIR"))
+        {
+            if (auto db = load_shared_database(shared_db_dir, variant))
+                return db;
+        }
+
+        hs_database_t* result = nullptr;
+        if (hs_deserialize_database(variant.data, variant.size, &result) != HS_SUCCESS)
+            throw std::runtime_error("Unable to deserialize HyperScan database");
+        return result;
+    }
+
+    return nullptr;
 }
 
-template <typename BodyFn, typename... Vars>
-inline bool loop_range(const ScanContext* ctx, std::uint64_t n, std::tuple<Vars...>&& vars, const BodyFn& body, std::uint64_t low, std::uint64_t high)
+// Clears results of the previous scan. Only slots of patterns which matched are touched so small buffers scanned
+// with rulesets of many patterns don't pay for all of them.
+static void reset_context(Scanner* scanner, const char* data, std::size_t size, void* user_data)
 {
-    n = std::min(n, high);
-    const std::uint64_t tolerance = high - low - n;
+    auto ctx = scanner->ctx;
+    for (auto id : scanner->matched_patterns)
+    {
+        ctx->matches[id].count = 0;
+        ctx->matches[id].offsets.clear();
+        ctx->matches[id].lengths.clear();
+    }
+    scanner->matched_patterns.clear();
 
-    std::uint64_t i = low, index = 0, hits = 0;
-    for (i = low; i < high; ++i)
+    for (auto& match : ctx->mutex_matches)
     {
-        if (index - hits > tolerance)
-            return false;
+        match = 0;
+    }
 
-        if (body(ctx, std::tuple_cat(vars, std::tuple{std::ref(i)}), i) && ++hits == n)
-            return true;
+    std::memset(ctx->rule_matches, 0, sizeof(ctx->rule_matches));
+
+    ctx->data = data;
+    ctx->data_size = size;
+    ctx->file_size = size;
+    ctx->user_data = user_data;
+
+    if constexpr (profiling)
+    {
+        auto stats = scanner->stats.get();
+        stats->sampled = stats->scans++ % get_stats_sample_period() == 0;
+        stats->sampled_scans += stats->sampled;
+    }
 
-        index++;
+    if (scanner->trace_stages)
+    {
+        for (auto& stage_ns : scanner->stage_ns)
+            stage_ns = 0;
     }
 
-    return false;
+    scanner->status = ScanStatus::Complete;
+    scanner->match_ticks = 0;
+    if (scanner->limits.timeout_us)
+        scanner->deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(scanner->limits.timeout_us);
 }
 
-template <typename BodyFn>
-inline bool loop_range(const ScanContext* ctx, std::uint64_t n, const BodyFn& body, std::uint64_t low, std::uint64_t high)
+// Vectored databases match across the blocks as if they were a single buffer
+static hs_error_t scan_blocks(hs_database_t* db, hs_scratch_t* scratch, const char* data, std::size_t size, match_event_handler on_event, void* context)
 {
-    return loop_range(ctx, n, std::tuple{}, body, low, high);
+    if (size <= MaxBlockSize)
+    {
+        auto length = static_cast<unsigned int>(size);
+        return hs_scan_vector(db, &data, &length, 1, 0, scratch, on_event, context);
+    }
+
+    std::vector<const char*> blocks;
+    std::vector<unsigned int> lengths;
+    for (std::size_t offset = 0; offset < size; offset += MaxBlockSize)
+    {
+        blocks.push_back(data + offset);
+        lengths.push_back(static_cast<unsigned int>(std::min(size - offset, MaxBlockSize)));
+    }
+    return hs_scan_vector(db, blocks.data(), lengths.data(), static_cast<unsigned int>(blocks.size()), 0, scratch, on_event, context);
 }
 
-template <typename... Ts>
-inline bool of(const ScanContext* ctx, std::uint64_t n, Ts... ids)
+static void scan_database(Scanner* scanner, ScanStage stage, hs_database_t* db, bool vectored, hs_scratch_t* scratch, const char* data, std::size_t size, match_event_handler on_event, void* context)
 {
-    return loop(ctx, n, [](auto ctx, auto&& /*vars*/, auto id) { return match_string(ctx, id); }, ids...);
+    if (db == nullptr)
+        return;
+
+    // Data is split into chunks before it gets here, a single block this large would be silently cut
+    if (!vectored && size > MaxBlockSize)
+        throw std::runtime_error(std::string{"Data of "} + std::to_string(size) + " bytes is too large for " + StageNames[static_cast<std::size_t>(stage)] + " DB");
+
+    StageTimer timer{scanner, stage};
+
+    hs_error_t rc;
+    if (vectored)
+        rc = scan_blocks(db, scratch, data, size, on_event, context);
+    else
+        rc = hs_scan(db, data, static_cast<unsigned int>(size), 0, scratch, on_event, context);
+
+    // Scans terminated by the match callback hit one of the limits
+    if (rc != HS_SUCCESS && rc != HS_SCAN_TERMINATED)
+        throw std::runtime_error(std::string{"Error while scanning with "} + StageNames[static_cast<std::size_t>(stage)] + " DB (" + std::to_string(rc) + ")");
 }
 
-inline std::uint64_t filesize(const ScanContext* ctx)
+static void scan_databases(Scanner* scanner, const char* data, std::size_t size)
 {
-    return get_data_size(ctx);
+    scan_database(scanner, ScanStage::Literal, literal_db, literal_vectored, scanner->scratch, data, size, &on_match, scanner->ctx);
+    if (is_stopped(scanner))
+        return;
+    scan_database(scanner, ScanStage::Regex, regex_db, regex_vectored, scanner->scratch, data, size, &on_match, scanner->ctx);
+    if (is_stopped(scanner))
+        return;
+    scan_database(scanner, ScanStage::Unbounded, unbounded_db, unbounded_vectored, scanner->scratch, data, size, &on_match, scanner->ctx);
 }
 
-template <Endian endian, typename T>
-std::uint64_t read_data(const ScanContext* ctx, std::uint64_t offset)
+// Matches owned by the chunk start at most max_width bytes before its beginning so scanning from there finds them
+// with the same start offsets as scanning the whole data. One more byte before and two bytes after the chunk let word
+// boundaries and end anchors see the data around the matches, matches of anchors which the cut makes up never end
+// within the chunk.
+static void scan_chunk(ScanStage stage, hs_database_t* db, bool vectored, std::uint64_t max_width, hs_scratch_t* scratch, const char* data, std::size_t size, Chunk* chunk)
 {
-    auto data_size = get_data_size(ctx);
-    if (offset >= data_size || offset + sizeof(T) > data_size)
-        return UNDEFINED;
+    if (db == nullptr)
+        return;
 
-    using UnsignedT = std::make_unsigned_t<T>;
-    return endian_convert<endian, Endian::Native, UnsignedT>(*(UnsignedT*)get_data(ctx, offset));
+    chunk->base = chunk->begin - std::min(chunk->begin, max_width + 1);
+    auto scan_end = std::min<std::uint64_t>(size, chunk->end + 2);
+    scan_database(chunk->scanner, stage, db, vectored, scratch, data + chunk->base, scan_end - chunk->base, &on_chunk_match, chunk);
 }
 
+// Literal and regex databases are scanned in chunks by several threads while the calling thread scans the unbounded
+// regexes over the whole data first. Matches are merged into the scan context in the order of the chunks so offsets
+// of each pattern stay sorted the same way as in the serial scan.
+static void scan_databases_parallel(Scanner* scanner, const char* data, std::size_t size, std::size_t threads)
+{
+    auto chunk_count = std::max((size + MaxChunkSize - 1) / MaxChunkSize, std::min(threads * ChunksPerThread, size / MinChunkSize));
+    std::vector<Chunk> chunks(chunk_count);
+    for (std::size_t i = 0; i < chunk_count; ++i)
+    {
+        chunks[i].begin = size * i / chunk_count;
+        chunks[i].end = size * (i + 1) / chunk_count;
+        chunks[i].scanner = scanner;
+        chunks[i].status = ScanStatus::Complete;
+    }
 
-#include "rules.def"
+    // Matches of a pattern are counted across all the chunks so the limit is the same as in the serial scan
+    if (scanner->limits.max_pattern_matches && !scanner->chunk_match_counts)
+        scanner->chunk_match_counts = std::make_unique<std::atomic<std::uint32_t>[]>(PATTERN_COUNT);
 
+    auto worker_count = std::min(threads, chunk_count);
+    while (scanner->worker_scratches.size() + 1 < worker_count)
+    {
+        hs_scratch_t* scratch = nullptr;
+        if (prototype_scratch && hs_clone_scratch(prototype_scratch, &scratch) != HS_SUCCESS)
+            throw std::runtime_error("Unable to allocate scratch for parallel scan");
+        scanner->worker_scratches.push_back(scratch);
+    }
 
-static bool evaluate_rule(const ScanContext* ctx, Rule& rule)
-{
-    if (rule.match == RuleMatch::NotEvaluated)
+    std::atomic<std::size_t> next_chunk{0};
+    // Set once any of the threads hits a limit so the others don't start new chunks
+    std::atomic<bool> stopped{false};
+    std::vector<std::exception_ptr> errors(worker_count);
+    auto work = [&](std::size_t worker) {
+        auto scratch = worker == 0 ? scanner->scratch : scanner->worker_scratches[worker - 1];
+        try
+        {
+            if (worker == 0)
+            {
+                scan_database(scanner, ScanStage::Unbounded, unbounded_db, unbounded_vectored, scratch, data, size, &on_match, scanner->ctx);
+                if (scanner->status != ScanStatus::Complete)
+                    stopped = true;
+            }
+
+            for (auto i = next_chunk++; i < chunk_count && !stopped; i = next_chunk++)
+            {
+                auto& chunk = chunks[i];
+                if (scanner->limits.timeout_us && std::chrono::steady_clock::now() >= scanner->deadline)
+                    chunk.status = ScanStatus::Timeout;
+                if (chunk.status == ScanStatus::Complete)
+                    scan_chunk(ScanStage::Literal, literal_db, literal_vectored, literal_max_width, scratch, data, size, &chunk);
+                if (chunk.status == ScanStatus::Complete)
+                    scan_chunk(ScanStage::Regex, regex_db, regex_vectored, regex_max_width, scratch, data, size, &chunk);
+                if (chunk.status != ScanStatus::Complete)
+                    stopped = true;
+            }
+        }
+        catch (...)
+        {
+            errors[worker] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t worker = 1; worker < worker_count; ++worker)
+        workers.emplace_back(work, worker);
+    work(0);
+    for (auto& worker : workers)
+        worker.join();
+
+    for (const auto& error : errors)
     {
-        rule.match = rule.function(ctx) ? RuleMatch::Hit : RuleMatch::NoHit;
-        if (rule.match == RuleMatch::Hit && rule.visibility == RuleVisibility::Public)
-            ctx->scanner->match_callback(rule.name, ctx->user_data);
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    for (const auto& chunk : chunks)
+    {
+        if (scanner->chunk_match_counts)
+        {
+            for (const auto& match : chunk.matches)
+                scanner->chunk_match_counts[match.id] = 0;
+        }
+
+        if (scanner->status == ScanStatus::Complete)
+            scanner->status = chunk.status;
     }
 
-    return rule.match == RuleMatch::Hit;
+    if (scanner->status != ScanStatus::Complete)
+        return;
+
+    for (const auto& chunk : chunks)
+    {
+        for (const auto& match : chunk.matches)
+            add_match(scanner->ctx, match.id, match.from, match.to - match.from);
+    }
 }
 
-static bool evaluate_rule(const ScanContext* ctx, std::size_t id)
+// Matches are reported with offsets from the start of the first region so they are the same as if the regions were
+// scanned as a single buffer
+static void scan_regions(Scanner* scanner)
 {
-    return evaluate_rule(ctx, rules[id]);
+    for (auto [db, stage] : {std::pair{literal_db, ScanStage::Literal}, std::pair{regex_db, ScanStage::Regex}, std::pair{unbounded_db, ScanStage::Unbounded}})
+    {
+        if (db == nullptr)
+            continue;
+
+        StageTimer timer{scanner, stage};
+        auto rc = hs_scan_vector(
+            db,
+            scanner->region_data.data(),
+            scanner->region_lengths.data(),
+            static_cast<unsigned int>(scanner->region_data.size()),
+            0,
+            scanner->scratch,
+            &on_match,
+            scanner->ctx
+        );
+
+        if (rc != HS_SUCCESS && rc != HS_SCAN_TERMINATED)
+            throw std::runtime_error(std::string{"Error while scanning with "} + StageNames[static_cast<std::size_t>(stage)] + " DB (" + std::to_string(rc) + ")");
+        if (is_stopped(scanner))
+            return;
+    }
 }
 
-static void evaluate_rules(const ScanContext* ctx)
+// Regions are split to the blocks HyperScan accepts, empty ones are left out. Returns the size of the whole object.
+static std::uint64_t set_regions(Scanner* scanner, const yng_buffer* regions, std::size_t count)
 {
-    for (auto& rule : rules)
-        evaluate_rule(ctx, rule);
+    scanner->region_data.clear();
+    scanner->region_lengths.clear();
+    scanner->region_offsets.clear();
+
+    std::uint64_t offset = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        for (std::size_t block = 0; block < regions[i].size; block += MaxBlockSize)
+        {
+            auto length = std::min(regions[i].size - block, MaxBlockSize);
+            scanner->region_data.push_back(regions[i].data + block);
+            scanner->region_lengths.push_back(static_cast<unsigned int>(length));
+            scanner->region_offsets.push_back(offset);
+            offset += length;
+        }
+    }
+    return offset;
 }
 
-static void add_match(ScanContext* ctx, std::size_t id, std::uint64_t offset, std::uint64_t length)
+static bool is_vectored(const hs_database_t* db)
 {
-    ctx->matches[id].count++;
-    ctx->matches[id].offsets.push_back(offset);
-    ctx->matches[id].lengths.push_back(length);
+    char* info = nullptr;
+    if (db == nullptr || hs_database_info(db, &info) != HS_SUCCESS)
+        return false;
+
+    auto result = std::strstr(info, "VECTORED") != nullptr;
+    ::free(info);
+    return result;
 }
 
-static void add_mutex_match(ScanContext* ctx, std::size_t id)
+// Mutexes from Cuckoo report are matched as lines of a single buffer
+static std::string read_cuckoo_mutexes(const char* cuckoo_file_path)
 {
-    ctx->mutex_matches[id]++;
+    std::ifstream cuckoo_file{cuckoo_file_path, std::ios::in};
+    std::string cuckoo_file_data{std::istreambuf_iterator<char>{cuckoo_file}, std::istreambuf_iterator<char>{}};
+
+    rapidjson::Document cuckoo_json;
+    cuckoo_json.Parse(cuckoo_file_data.data());
+
+    std::string result;
+    for (auto& mutex : cuckoo_json["behavior"]["summary"]["mutexes"].GetArray())
+    {
+        result.append(mutex.GetString(), mutex.GetStringLength());
+        result.push_back('\n');
+    }
+    return result;
 }
 
-static const Match* get_match(const ScanContext* ctx, std::size_t id)
+static void scan_cuckoo_mutexes(Scanner* scanner, const char* cuckoo_file_path)
 {
-    return &ctx->matches[id];
+    std::string mutexes;
+    {
+        StageTimer timer{scanner, ScanStage::Cuckoo};
+        mutexes = read_cuckoo_mutexes(cuckoo_file_path);
+    }
+
+    if (mutex_db)
+    {
+        StageTimer timer{scanner, ScanStage::Mutex};
+        // Null terminator is scanned too
+        auto rc = hs_scan(
+            mutex_db,
+            mutexes.c_str(),
+            mutexes.size() + 1,
+            0,
+            scanner->scratch,
+            &on_mutex_match,
+            scanner->ctx
+        );
+
+        if (rc != HS_SUCCESS)
+            throw std::runtime_error("Error while scanning with mutex DB (" + std::to_string(rc) + ")");
+    }
 }
 
-static std::uint64_t get_mutex_match(const ScanContext* ctx, std::size_t id)
+static bool evaluate_rules_timed(Scanner* scanner)
 {
-    return ctx->mutex_matches[id];
+    StageTimer timer{scanner, ScanStage::Evaluation};
+    return evaluate_rules(scanner->ctx);
 }
 
-static const char* get_data(const ScanContext* ctx, std::uint64_t offset)
+// Data is either the whole file or its prefix which is all the rules can observe, file size is the size of the whole file
+static void scan_data(Scanner* scanner, const char* data, std::size_t size, std::size_t file_size, std::size_t threads, const char* cuckoo_file_path, void* user_data)
 {
-    return ctx->data + offset;
+    reset_context(scanner, data, size, user_data);
+    scanner->ctx->file_size = file_size;
+
+    // Nothing can match if some of the global rules which only look at the data doesn't hold
+    if (!evaluate_prescan_global_rules(scanner->ctx))
+        return;
+
+    // Data larger than a single block is scanned in chunks even on a single thread
+    if ((threads > 1 && size >= 2 * MinChunkSize) || size > MaxBlockSize)
+        scan_databases_parallel(scanner, data, size, std::max<std::size_t>(threads, 1));
+    else
+        scan_databases(scanner, data, size);
+
+    if (scanner->status != ScanStatus::Complete)
+        return;
+
+    if (cuckoo_file_path)
+        scan_cuckoo_mutexes(scanner, cuckoo_file_path);
+
+    if (evaluate_rules_timed(scanner))
+        report_rules(scanner->ctx);
 }
 
-static std::uint64_t get_data_size(const ScanContext* ctx)
+// Read-only mapping of a file, unmapped when the scan is done or fails
+struct FileMapping
 {
-    return ctx->data_size;
-}
+    ~FileMapping()
+    {
+        if (data)
+            ::munmap(const_cast<char*>(data), size);
+    }
 
-extern "C" {
+    void map(int fd, std::size_t map_size)
+    {
+        auto memory = ::mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (memory == MAP_FAILED)
+            return;
+
+        // Each database reads the data from the start to the end
+        ::madvise(memory, map_size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(memory);
+        size = map_size;
+    }
 
-extern char* literal_db_start;
-extern char* literal_db_end;
-extern std::uint32_t literal_db_size;
+    const char* data = nullptr;
+    std::size_t size = 0;
+};
+
+// Keeps only the prefix the rules can observe but reads the file until its end to find out its size
+static bool read_file(int fd, std::vector<char>& data, std::size_t& file_size)
+{
+    char block[64 * 1024];
+    file_size = 0;
+    while (true)
+    {
+        auto count = ::read(fd, block, sizeof(block));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return false;
+        if (count == 0)
+            return true;
 
-extern char* regex_db_start;
-extern char* regex_db_end;
-extern std::uint32_t regex_db_size;
+        auto kept = std::min<std::uint64_t>(count, prefix_size - std::min<std::uint64_t>(file_size, prefix_size));
+        data.insert(data.end(), block, block + kept);
+        file_size += count;
+    }
+}
 
-extern char* mutex_db_start;
-extern char* mutex_db_end;
-extern std::uint32_t mutex_db_size;
+extern "C" {
 
 void yng_initialize()
 {
-    hs_deserialize_database((char*)&literal_db_start, (std::size_t)literal_db_size, &literal_db);
-    hs_deserialize_database((char*)&regex_db_start, (std::size_t)regex_db_size, &regex_db);
-    hs_deserialize_database((char*)&mutex_db_start, (std::size_t)mutex_db_size, &mutex_db);
+    // Allocator needs to be in place before the databases are deserialized
+    hs_set_database_allocator(huge_pages_alloc, huge_pages_free);
+    hs_set_scratch_allocator(huge_pages_alloc, huge_pages_free);
+
+    literal_db = load_database(DATABASE_VARIANTS(literal_db));
+    regex_db = load_database(DATABASE_VARIANTS(regex_db));
+    unbounded_db = load_database(DATABASE_VARIANTS(unbounded_db));
+    mutex_db = load_database(DATABASE_VARIANTS(mutex_db));
+    literal_vectored = is_vectored(literal_db);
+    regex_vectored = is_vectored(regex_db);
+    unbounded_vectored = is_vectored(unbounded_db);
+
+    // Scratch is grown to fit each database and scanners only clone it which is much cheaper than allocating
+    for (auto db : {literal_db, regex_db, unbounded_db, mutex_db})
+    {
+        if (db && hs_alloc_scratch(db, &prototype_scratch) != HS_SUCCESS)
+            throw std::runtime_error("Unable to allocate scratch");
+    }
 }
 
 Scanner* yng_new_scanner(MatchCallback match_callback)
 {
-    auto scanner = static_cast<Scanner*>(::malloc(sizeof(Scanner)));
-    std::memset(scanner, 0, sizeof(Scanner));
-    hs_alloc_scratch(literal_db, &scanner->literal_scratch);
-    hs_alloc_scratch(regex_db, &scanner->regex_scratch);
-    hs_alloc_scratch(mutex_db, &scanner->mutex_scratch);
-    scanner->match_callback = match_callback;
-    scanner->ctx = new ScanContext();
+    auto scanner = new Scanner{nullptr, match_callback, nullptr, nullptr, {}};
+    // Each pattern is recorded at most once so this never reallocates during the scan
+    scanner->matched_patterns.reserve(PATTERN_COUNT);
+    if (prototype_scratch && hs_clone_scratch(prototype_scratch, &scanner->scratch) != HS_SUCCESS)
+    {
+        delete scanner;
+        throw std::runtime_error("Unable to allocate scratch for scanner");
+    }
+
+    auto ctx_memory = huge_pages_alloc(sizeof(ScanContext));
+    if (ctx_memory == nullptr)
+    {
+        hs_free_scratch(scanner->scratch);
+        delete scanner;
+        throw std::runtime_error("Unable to allocate scan context");
+    }
+    scanner->ctx = new (ctx_memory) ScanContext();
     scanner->ctx->scanner = scanner;
+    if constexpr (profiling)
+    {
+        scanner->stats = std::make_unique<ScannerStats>();
+        scanner->stats->rules.resize(rules.size());
+        scanner->stats->pattern_matches.resize(PATTERN_COUNT);
+    }
+    return scanner;
+}
+
+Scanner* yng_new_scanner_v2(MatchCallbackV2 match_callback)
+{
+    auto scanner = yng_new_scanner(nullptr);
+    scanner->match_callback_v2 = match_callback;
     return scanner;
 }
 
 void yng_free_scanner(Scanner* scanner)
 {
-    hs_free_scratch(scanner->literal_scratch);
-    hs_free_scratch(scanner->regex_scratch);
-    hs_free_scratch(scanner->mutex_scratch);
-    delete scanner->ctx;
-    ::free(scanner);
+    hs_free_scratch(scanner->scratch);
+    for (auto scratch : scanner->worker_scratches)
+        hs_free_scratch(scratch);
+    scanner->ctx->~ScanContext();
+    huge_pages_free(scanner->ctx);
+    delete scanner;
 }
 
-void yng_scan_data(Scanner* scanner, const char* data, std::size_t size, const char* cuckoo_file_path, void* user_data)
+void yng_scanner_memory(const Scanner* scanner, ScannerMemory* memory)
 {
-    for (auto& match : scanner->ctx->matches)
+    std::memset(memory, 0, sizeof(ScannerMemory));
+    if (scanner->scratch)
+        hs_scratch_size(scanner->scratch, &memory->scratch);
+    for (auto scratch : scanner->worker_scratches)
     {
-        match.count = 0;
-        match.offsets.clear();
-        match.lengths.clear();
+        std::size_t size = 0;
+        if (scratch && hs_scratch_size(scratch, &size) == HS_SUCCESS)
+            memory->scratch += size;
     }
 
-    for (auto& match : scanner->ctx->mutex_matches)
+    memory->context = sizeof(ScanContext) + scanner->matched_patterns.capacity() * sizeof(std::uint32_t)
+        + scanner->region_data.capacity() * sizeof(const char*) + scanner->region_lengths.capacity() * sizeof(unsigned int)
+        + scanner->region_offsets.capacity() * sizeof(std::uint64_t) + scanner->worker_scratches.capacity() * sizeof(hs_scratch_t*)
+        + (scanner->chunk_match_counts ? PATTERN_COUNT * sizeof(std::atomic<std::uint32_t>) : 0)
+        + (scanner->stats ? sizeof(ScannerStats) + scanner->stats->rules.capacity() * sizeof(yng_rule_stats)
+            + scanner->stats->pattern_matches.capacity() * sizeof(std::uint64_t) : 0);
+    for (const auto& match : scanner->ctx->matches)
+        memory->matches += match.offsets.capacity() * sizeof(std::uint64_t) + match.lengths.capacity() * sizeof(std::uint32_t);
+}
+
+// Returns false for rulesets built without yarangc --stats
+bool yng_get_stats(const Scanner* scanner, yng_stats* stats)
+{
+    if constexpr (!profiling)
+        return false;
+
+    static const auto rule_names = []() {
+        std::vector<const char*> result;
+        for (const auto& rule : rules)
+            result.push_back(rule.name);
+        return result;
+    }();
+
+    // Patterns shared by several strings are named after the first of them, those of no string by their ID
+    static const auto pattern_names = []() {
+        std::vector<std::string> result(PATTERN_COUNT);
+        for (const auto& rule : rules)
+        {
+            for (std::size_t i = 0; i < rule.string_count; ++i)
+            {
+                if (result[rule.patterns[i]].empty())
+                    result[rule.patterns[i]] = std::string{rule.name} + ":" + rule.strings[i];
+            }
+        }
+
+        for (std::size_t id = 0; id < result.size(); ++id)
+        {
+            if (result[id].empty())
+                result[id] = "pattern " + std::to_string(id);
+        }
+        return result;
+    }();
+    static const auto pattern_name_ptrs = []() {
+        std::vector<const char*> result;
+        for (const auto& name : pattern_names)
+            result.push_back(name.c_str());
+        return result;
+    }();
+
+    const auto& scanner_stats = *scanner->stats;
+    stats->scans = scanner_stats.scans;
+    stats->sampled_scans = scanner_stats.sampled_scans;
+    for (std::size_t i = 0; i < scanner_stats.stage_ns.size(); ++i)
+        stats->stage_ns[i] = scanner_stats.stage_ns[i].load(std::memory_order_relaxed);
+    stats->rule_names = rule_names.data();
+    stats->rules = scanner_stats.rules.data();
+    stats->rule_count = scanner_stats.rules.size();
+    stats->pattern_names = pattern_name_ptrs.data();
+    stats->pattern_matches = scanner_stats.pattern_matches.data();
+    stats->pattern_count = scanner_stats.pattern_matches.size();
+    return true;
+}
+
+void yng_reset_stats(Scanner* scanner)
+{
+    if constexpr (profiling)
     {
-        match = 0;
+        auto& stats = *scanner->stats;
+        stats.scans = 0;
+        stats.sampled_scans = 0;
+        for (auto& stage_ns : stats.stage_ns)
+            stage_ns = 0;
+        std::fill(stats.rules.begin(), stats.rules.end(), yng_rule_stats{0, 0, 0});
+        std::fill(stats.pattern_matches.begin(), stats.pattern_matches.end(), 0);
     }
+}
 
-    for (auto& rule : rules)
-        rule.match = RuleMatch::NotEvaluated;
+// Scanner records how long each stage of its scans took, only the last scan is kept
+void yng_trace_stages(Scanner* scanner, bool enabled)
+{
+    scanner->trace_stages = enabled;
+}
 
-    hs_error_t rc;
+// Copies times of up to count stages of the last scan in nanoseconds and returns how many of them were copied
+std::size_t yng_stage_times(const Scanner* scanner, std::uint64_t* stage_ns, std::size_t count)
+{
+    count = std::min(count, StageCount);
+    for (std::size_t i = 0; i < count; ++i)
+        stage_ns[i] = scanner->stage_ns[i].load(std::memory_order_relaxed);
+    return count;
+}
+
+// Limits apply to all the following scans of the scanner
+void yng_set_limits(Scanner* scanner, const yng_limits* limits)
+{
+    scanner->limits = *limits;
+}
+
+// Scans which hit a limit stop right away and report no rules, matches of strings are incomplete then
+ScanStatus yng_scan_status(const Scanner* scanner)
+{
+    return scanner->status;
+}
+
+void yng_scan_data(Scanner* scanner, const char* data, std::size_t size, const char* cuckoo_file_path, void* user_data)
+{
+    scan_data(scanner, data, size, size, 1, cuckoo_file_path, user_data);
+}
+
+// Scans large data with several threads. Data too small to be worth splitting is scanned the same way as by
+// yng_scan_data, results are always the same as if it was.
+void yng_scan_data_parallel(Scanner* scanner, const char* data, std::size_t size, std::size_t threads, const char* cuckoo_file_path, void* user_data)
+{
+    scan_data(scanner, data, size, size, threads, cuckoo_file_path, user_data);
+}
+
+// Number of bytes from the start of a file which the rules can observe, files are scanned the same without the rest
+std::uint64_t yng_prefix_size()
+{
+    return prefix_size;
+}
+
+// Reads only the part of the file the rules can observe while filesize still gives the size of the whole file.
+// Regular files are mapped so even the huge ones don't need memory of their size.
+void yng_scan_file(Scanner* scanner, const char* path, std::size_t threads, const char* cuckoo_file_path, void* user_data)
+{
+    auto read_start = std::chrono::steady_clock::now();
+    auto fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error(std::string{"Unable to open "} + path);
 
-    if (literal_db_size != 0)
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0)
     {
-        rc = hs_scan(
-            literal_db,
-            data,
-            size,
-            0,
-            scanner->literal_scratch,
-            &on_match,
-            scanner->ctx
-        );
+        ::close(fd);
+        throw std::runtime_error(std::string{"Unable to stat "} + path);
+    }
 
-        if (rc != HS_SUCCESS)
-            throw std::runtime_error("Error while scanning with literal DB (" + std::to_string(rc) + ")");
+    FileMapping mapping;
+    std::size_t file_size = 0;
+    std::size_t size = 0;
+    auto sized = S_ISREG(file_stat.st_mode) && file_stat.st_size > 0;
+    if (sized)
+    {
+        file_size = static_cast<std::size_t>(file_stat.st_size);
+        size = static_cast<std::size_t>(std::min<std::uint64_t>(file_size, prefix_size));
+        if (size > 0)
+            mapping.map(fd, size);
     }
 
-    if (regex_db_size != 0)
+    // Pipes, devices and files of procfs report no size, these and files which can't be mapped are read until their end
+    std::vector<char> buffer;
+    if (!sized || (size > 0 && !mapping.data))
     {
-        rc = hs_scan(
-            regex_db,
-            data,
-            size,
-            0,
-            scanner->regex_scratch,
-            &on_match,
-            scanner->ctx
-        );
+        if (!read_file(fd, buffer, file_size))
+        {
+            ::close(fd);
+            throw std::runtime_error(std::string{"Unable to read "} + path);
+        }
+        size = buffer.size();
+    }
+    ::close(fd);
 
-        if (rc != HS_SUCCESS)
-            throw std::runtime_error("Error while scanning with regex DB (" + std::to_string(rc) + ")");
+    auto read_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - read_start).count();
+
+    auto data = mapping.data ? mapping.data : (buffer.empty() ? "" : buffer.data());
+    scan_data(scanner, data, size, file_size, threads, cuckoo_file_path, user_data);
+    // Stage times of the scan are reset when it starts
+    add_stage_time(scanner, ScanStage::Read, read_ns);
+}
+
+// Scans object given as several regions, rules see them as a single buffer with the regions laid out one after another
+void yng_scan_vector(Scanner* scanner, const yng_buffer* regions, std::size_t count, const char* cuckoo_file_path, void* user_data)
+{
+    // Databases compiled without --vectored can only scan the regions copied together
+    if ((literal_db && !literal_vectored) || (regex_db && !regex_vectored) || (unbounded_db && !unbounded_vectored))
+    {
+        std::string data;
+        for (std::size_t i = 0; i < count; ++i)
+            data.append(regions[i].data, regions[i].size);
+        yng_scan_data(scanner, data.data(), data.size(), cuckoo_file_path, user_data);
+        return;
     }
 
+    auto size = set_regions(scanner, regions, count);
+    reset_context(scanner, nullptr, size, user_data);
+
+    if (!evaluate_prescan_global_rules(scanner->ctx))
+        return;
+
+    scan_regions(scanner);
+    if (scanner->status != ScanStatus::Complete)
+        return;
+
     if (cuckoo_file_path)
-    {
-        std::ifstream cuckoo_file{cuckoo_file_path, std::ios::in};
-        cuckoo_file.seekg(0, std::ios::end);
-        auto file_size = cuckoo_file.tellg();
-        cuckoo_file.seekg(0, std::ios::beg);
+        scan_cuckoo_mutexes(scanner, cuckoo_file_path);
 
-        std::string cuckoo_file_data;
-        cuckoo_file_data.reserve(file_size);
-        cuckoo_file.read(cuckoo_file_data.data(), file_size);
+    if (evaluate_rules_timed(scanner))
+        report_rules(scanner->ctx);
+}
 
-        rapidjson::Document cuckoo_json;
-        cuckoo_json.Parse(cuckoo_file_data.data());
+// Scans buffers one after another with the same scanner, results are written into the array instead of going through
+// the callback. Each result corresponds to the buffer at the same index.
+void yng_scan_batch(Scanner* scanner, const yng_buffer* buffers, std::size_t count, yng_result* results)
+{
+    // Limits apply to each buffer on its own, those which hit one report no rules
+    auto status = ScanStatus::Complete;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        reset_context(scanner, buffers[i].data, buffers[i].size, nullptr);
+        results[i].count = 0;
+        if (!evaluate_prescan_global_rules(scanner->ctx))
+            continue;
 
-        auto mutexes = cuckoo_json["behavior"]["summary"]["mutexes"].GetArray();
-        std::size_t total_length = 0ul;
-        for (auto& mutex : mutexes)
+        scan_databases(scanner, buffers[i].data, buffers[i].size);
+        if (scanner->status != ScanStatus::Complete)
         {
-            total_length += mutex.GetStringLength();
+            status = scanner->status;
+            continue;
         }
 
-        // length of all mutexes + '\n' for each mutex + null terminator
-        auto mutex_data_size = total_length + mutexes.Size() + 1;
-        auto mutex_data = std::make_unique<char[]>(mutex_data_size);
-        char* mutex_data_write_ptr = mutex_data.get();
-        for (auto& mutex : mutexes)
+        if (evaluate_rules_timed(scanner))
+            report_rules(scanner->ctx, &results[i]);
+    }
+    scanner->status = status;
+}
+
+// Results of these rules replace all the previous results of the same rules for the scanned data
+const char* const* yng_reported_rules(std::size_t* count)
+{
+    static const auto reported_rules = []() {
+        std::vector<const char*> result;
+        for (const auto& rule : rules)
         {
-            ::memcpy(mutex_data_write_ptr, mutex.GetString(), mutex.GetStringLength());
-            mutex_data_write_ptr += mutex.GetStringLength();
-            *mutex_data_write_ptr = '\n';
-            mutex_data_write_ptr++;
+            if (rule.visibility == RuleVisibility::Public)
+                result.push_back(rule.name);
         }
-        *mutex_data_write_ptr = '\0';
+        return result;
+    }();
 
-        if (mutex_data_size != 0)
+    *count = reported_rules.size();
+    return reported_rules.data();
+}
+
+// Metadata of the rule at the given index of yng_reported_rules, null when out of range
+const RuleInfo* yng_rule_info(std::size_t index)
+{
+    static const auto rule_infos = []() {
+        std::vector<RuleInfo> result;
+        for (auto id : get_public_rules())
         {
-            rc = hs_scan(
-                mutex_db,
-                mutex_data.get(),
-                mutex_data_size,
-                0,
-                scanner->mutex_scratch,
-                &on_mutex_match,
-                scanner->ctx
-            );
-
-            if (rc != HS_SUCCESS)
-                throw std::runtime_error("Error while scanning with mutex DB (" + std::to_string(rc) + ")");
+            const auto& rule = rules[id];
+            result.push_back({rule.name, rule.ns ? rule.ns : "", rule.tags, rule.tag_count, rule.metas, rule.meta_count, rule.strings, rule.string_count});
         }
-    }
+        return result;
+    }();
 
-    scanner->ctx->data = data;
-    scanner->ctx->data_size = size;
-    scanner->ctx->user_data = user_data;
-    evaluate_rules(scanner->ctx);
+    return index < rule_infos.size() ? &rule_infos[index] : nullptr;
+}
+
+// Matches of a string of the reported rule in the last scan. Offsets and lengths point directly into the scan context
+// so they are only valid until the next scan with the scanner, typically used from the callback of yng_new_scanner_v2.
+std::size_t yng_string_matches(const Scanner* scanner, std::size_t rule_index, std::size_t string_index, const std::uint64_t** offsets, const std::uint32_t** lengths)
+{
+    const auto& public_rules = get_public_rules();
+    if (rule_index >= public_rules.size() || string_index >= rules[public_rules[rule_index]].string_count)
+        return 0;
+
+    const auto& match = scanner->ctx->matches[rules[public_rules[rule_index]].patterns[string_index]];
+    *offsets = match.offsets.data();
+    *lengths = match.lengths.data();
+    return match.offsets.size();
+}
+
+// Previous results of these rules are no longer valid for any data, even for the data which isn't rescanned
+const char* const* yng_retracted_rules(std::size_t* count)
+{
+    *count = retracted_rules.size();
+    return retracted_rules.data();
 }
 
 void yng_finalize()
 {
-    hs_free_database(literal_db);
-    hs_free_database(regex_db);
-    hs_free_database(mutex_db);
+    hs_free_scratch(prototype_scratch);
+    prototype_scratch = nullptr;
+    free_database(literal_db);
+    free_database(regex_db);
+    free_database(unbounded_db);
+    free_database(mutex_db);
 }
 
 }
@@ -462,17 +1219,9 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    std::ifstream in_file(args[0], std::ios::binary);
-    in_file.seekg(0, std::ios::end);
-    auto file_size = in_file.tellg();
-    in_file.seekg(0, std::ios::beg);
-
-    std::vector<char> data(file_size);
-    in_file.read(data.data(), data.size());
-
     yng_initialize();
     auto scanner = yng_new_scanner(print_hit);
-    yng_scan_data(scanner, data.data(), data.size(), args.size() >= 2 ? args[1].c_str() : nullptr, (void*)args[0].c_str());
+    yng_scan_file(scanner, args[0].c_str(), 1, args.size() >= 2 ? args[1].c_str() : nullptr, (void*)args[0].c_str());
     yng_free_scanner(scanner);
     yng_finalize();
 }
@@ -0,0 +1,392 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <variant>
+#include <vector>
+
+#include <hs/hs_runtime.h>
+
+#include "endian.hpp"
+
+#define UNDEFINED 0xFFFABADAFABADAFFull
+#define IS_UNDEF(x) static_cast<std::uint64_t>(x) == UNDEFINED
+
+struct Scanner;
+struct ScanContext;
+
+using MatchCallback = void(*)(const char*, void*);
+// Gets index of the matched rule into yng_reported_rules, string matches of the rule can be read during the callback
+using MatchCallbackV2 = void(*)(std::size_t, const Scanner*, void*);
+
+enum class RuleVisibility
+{
+    Public,
+    Private
+};
+
+struct RuleMeta
+{
+    const char* key;
+    const char* value;
+};
+
+// Metadata of a reported rule returned by yng_rule_info, strings are in the order of declaration and their indices
+// are used by yng_string_matches
+struct RuleInfo
+{
+    const char* name;
+    const char* ns;
+    const char* const* tags;
+    std::size_t tag_count;
+    const RuleMeta* metas;
+    std::size_t meta_count;
+    const char* const* strings;
+    std::size_t string_count;
+};
+
+// Metadata is only generated for public rules, private ones leave it empty
+struct Rule
+{
+    const char* name;
+    RuleVisibility visibility;
+    const char* ns;
+    const char* const* tags;
+    std::size_t tag_count;
+    const RuleMeta* metas;
+    std::size_t meta_count;
+    const char* const* strings;
+    const std::uint32_t* patterns;
+    std::size_t string_count;
+};
+
+struct Match
+{
+    std::uint32_t count;
+    std::vector<std::uint64_t> offsets;
+    std::vector<std::uint32_t> lengths;
+};
+
+// Memory a scanner keeps between scans, reported by yng_scanner_memory
+struct ScannerMemory
+{
+    // HyperScan scratch shared by all the databases
+    std::size_t scratch;
+    // Scan context with match slots of all the patterns
+    std::size_t context;
+    // Offsets and lengths of matches which are kept allocated between scans
+    std::size_t matches;
+};
+
+// Buffer scanned by yng_scan_batch or region of yng_scan_vector
+struct yng_buffer
+{
+    const char* data;
+    std::size_t size;
+};
+
+// Rules which matched a single buffer of yng_scan_batch given as indices into the list of yng_reported_rules.
+// Storage is provided by the caller, only the first capacity IDs are written while count is the number of all of them.
+struct yng_result
+{
+    std::uint32_t* rule_ids;
+    std::uint32_t capacity;
+    std::uint32_t count;
+};
+
+// Limits of every scan of a scanner set by yng_set_limits, zero means no limit
+struct yng_limits
+{
+    // Wall-clock budget of a single scan
+    std::uint64_t timeout_us;
+    // Matches of a single pattern after which the scan stops, like the per-string limit of YARA
+    std::uint32_t max_pattern_matches;
+};
+
+// Why the last scan stopped, returned by yng_scan_status. Rules aren't evaluated for scans which hit a limit.
+enum class ScanStatus : int
+{
+    Complete = 0,
+    Timeout = 1,
+    TooManyMatches = 2
+};
+
+// Parts of the scan in the order they run, reading of the file, HyperScan scans of the databases, parsing of the Cuckoo
+// report and evaluation of the rules
+enum class ScanStage : std::size_t
+{
+    Read,
+    Literal,
+    Regex,
+    Unbounded,
+    Cuckoo,
+    Mutex,
+    Evaluation,
+    Count
+};
+
+constexpr std::size_t StageCount = static_cast<std::size_t>(ScanStage::Count);
+
+struct yng_rule_stats
+{
+    std::uint64_t evaluations;
+    std::uint64_t hits;
+    // Time stamp counter cycles spent in the rule function
+    std::uint64_t cycles;
+};
+
+// Counters of a scanner of a ruleset built with yarangc --stats returned by yng_get_stats, only sampled scans are
+// counted. Arrays point into the scanner and are valid until it's freed.
+struct yng_stats
+{
+    std::uint64_t scans;
+    std::uint64_t sampled_scans;
+    std::uint64_t stage_ns[StageCount];
+    // Indexed by IDs of all the rules including private ones
+    const char* const* rule_names;
+    const yng_rule_stats* rules;
+    std::size_t rule_count;
+    // Named RULE:STRING after the first string they belong to
+    const char* const* pattern_names;
+    const std::uint64_t* pattern_matches;
+    std::size_t pattern_count;
+};
+
+// Threads of parallel scans add their time to the same stages
+struct ScannerStats
+{
+    std::uint64_t scans = 0;
+    std::uint64_t sampled_scans = 0;
+    // Whether the current scan is sampled
+    bool sampled = false;
+    std::array<std::atomic<std::uint64_t>, StageCount> stage_ns = {};
+    std::vector<yng_rule_stats> rules;
+    std::vector<std::uint64_t> pattern_matches;
+};
+
+struct Scanner
+{
+    // Single scratch large enough for all the databases
+    hs_scratch_t* scratch;
+    MatchCallback match_callback;
+    ScanContext* ctx;
+    // Used instead of match_callback by scanners created with yng_new_scanner_v2
+    MatchCallbackV2 match_callback_v2;
+    // Patterns with at least one match in the current scan so only their slots are cleared for the next one
+    std::vector<std::uint32_t> matched_patterns;
+    // Regions of the current vectored scan with their offsets in the whole object, data of the scan context is null then
+    std::vector<const char*> region_data;
+    std::vector<unsigned int> region_lengths;
+    std::vector<std::uint64_t> region_offsets;
+    // Scratches of the additional threads of yng_scan_data_parallel, cloned when first needed
+    std::vector<hs_scratch_t*> worker_scratches;
+    yng_limits limits;
+    ScanStatus status;
+    std::chrono::steady_clock::time_point deadline;
+    // Matches since the start of the scan, clock is only read once per a number of them
+    std::uint32_t match_ticks;
+    // Match counts of all the patterns shared by the threads of parallel scans with a match limit
+    std::unique_ptr<std::atomic<std::uint32_t>[]> chunk_match_counts;
+    // Only allocated in profiling builds
+    std::unique_ptr<ScannerStats> stats;
+    // Time of each stage of the last scan recorded when enabled by yng_trace_stages, threads of parallel scans add up
+    bool trace_stages;
+    std::array<std::atomic<std::uint64_t>, StageCount> stage_ns;
+};
+
+// Generated by yarangc, contains ScanContext and declarations of all rule functions
+#include "rules.hpp"
+
+inline const Match* get_match(const ScanContext* ctx, std::size_t id)
+{
+    return &ctx->matches[id];
+}
+
+inline std::uint64_t get_mutex_match(const ScanContext* ctx, std::size_t id)
+{
+    return ctx->mutex_matches[id];
+}
+
+inline const char* get_data(const ScanContext* ctx, std::uint64_t offset = 0)
+{
+    return ctx->data + offset;
+}
+
+inline std::uint64_t get_data_size(const ScanContext* ctx)
+{
+    return ctx->data_size;
+}
+
+inline bool match_string(const ScanContext* ctx, std::size_t id)
+{
+    return get_match(ctx, id)->count > 0;
+}
+
+inline std::uint64_t match_count(const ScanContext* ctx, std::size_t id)
+{
+    return get_match(ctx, id)->count;
+}
+
+inline std::uint64_t match_offset(const ScanContext* ctx, std::size_t id, std::size_t index = 0)
+{
+    auto& offsets = get_match(ctx, id)->offsets;
+    return index < offsets.size() ? offsets[index] : UNDEFINED;
+}
+
+inline std::uint64_t match_length(const ScanContext* ctx, std::size_t id, std::size_t index = 0)
+{
+    auto& lengths = get_match(ctx, id)->lengths;
+    return index < lengths.size() ? lengths[index] : UNDEFINED;
+}
+
+inline bool match_at(const ScanContext* ctx, std::size_t id, std::uint64_t expected)
+{
+    for (auto offset : get_match(ctx, id)->offsets)
+    {
+        if (offset == expected)
+            return true;
+    }
+    return false;
+}
+
+inline bool match_in(const ScanContext* ctx, std::size_t id, std::uint64_t low, std::uint64_t high)
+{
+    for (auto offset : get_match(ctx, id)->offsets)
+    {
+        if (low <= offset && offset < high)
+            return true;
+    }
+    return false;
+}
+
+template <typename BodyFn, typename... Vars, typename... Ts>
+inline bool loop(const ScanContext* ctx, std::uint64_t n, std::tuple<Vars...>&& vars, const BodyFn& body, Ts... ids)
+{
+    const std::uint64_t tolerance = sizeof...(Ts) - n;
+    std::uint64_t index = 0, hits = 0;
+    for (auto id : std::array<std::uint64_t, sizeof...(Ts)>{ids...})
+    {
+        if (index - hits > tolerance)
+            return false;
+
+        if (body(ctx, std::move(vars), id) && ++hits == n)
+            return true;
+
+        index++;
+    }
+
+    return false;
+}
+
+template <typename BodyFn, typename... Ts>
+inline bool loop(const ScanContext* ctx, std::uint64_t n, const BodyFn& body, Ts... ids)
+{
+    return loop(ctx, n, std::tuple{}, body, ids...);
+}
+
+template <typename BodyFn, typename... Vars, typename... Ints>
+inline bool loop_ints(const ScanContext* ctx, std::uint64_t n, std::tuple<Vars...>&& vars, const BodyFn& body, Ints... ints)
+{
+    const std::uint64_t tolerance = sizeof...(Ints) - n;
+    std::uint64_t index = 0, hits = 0;
+    for (auto i : std::array<std::uint64_t, sizeof...(Ints)>{ints...})
+    {
+        if (index - hits > tolerance)
+            return false;
+
+        if (body(ctx, std::tuple_cat(vars, std::tuple{std::ref(i)}), i) && ++hits == n)
+            return true;
+
+        index++;
+    }
+
+    return false;
+}
+
+template <typename BodyFn, typename... Ints>
+inline bool loop_ints(const ScanContext* ctx, std::uint64_t n, const BodyFn& body, Ints... ints)
+{
+    return loop_ints(ctx, n, std::tuple{}, body, ints...);
+}
+
+template <typename BodyFn, typename... Vars>
+inline bool loop_range(const ScanContext* ctx, std::uint64_t n, std::tuple<Vars...>&& vars, const BodyFn& body, std::uint64_t low, std::uint64_t high)
+{
+    n = std::min(n, high);
+    const std::uint64_t tolerance = high - low - n;
+
+    std::uint64_t i = low, index = 0, hits = 0;
+    for (i = low; i < high; ++i)
+    {
+        if (index - hits > tolerance)
+            return false;
+
+        if (body(ctx, std::tuple_cat(vars, std::tuple{std::ref(i)}), i) && ++hits == n)
+            return true;
+
+        index++;
+    }
+
+    return false;
+}
+
+template <typename BodyFn>
+inline bool loop_range(const ScanContext* ctx, std::uint64_t n, const BodyFn& body, std::uint64_t low, std::uint64_t high)
+{
+    return loop_range(ctx, n, std::tuple{}, body, low, high);
+}
+
+template <typename... Ts>
+inline bool of(const ScanContext* ctx, std::uint64_t n, Ts... ids)
+{
+    return loop(ctx, n, [](auto ctx, auto&& /*vars*/, auto id) { return match_string(ctx, id); }, ids...);
+}
+
+// Size of the whole file even if only its prefix was read
+inline std::uint64_t filesize(const ScanContext* ctx)
+{
+    return ctx->file_size;
+}
+
+// Reads bytes of vectored scan which may span several regions, range needs to be in bounds
+inline void read_regions(const Scanner* scanner, std::uint64_t offset, char* out, std::size_t size)
+{
+    const auto& offsets = scanner->region_offsets;
+    std::size_t index = std::upper_bound(offsets.begin(), offsets.end(), offset) - offsets.begin() - 1;
+    while (size > 0)
+    {
+        auto region_offset = offset - offsets[index];
+        auto count = std::min<std::uint64_t>(size, scanner->region_lengths[index] - region_offset);
+        std::memcpy(out, scanner->region_data[index] + region_offset, count);
+        out += count;
+        offset += count;
+        size -= count;
+        index++;
+    }
+}
+
+template <Endian endian, typename T>
+std::uint64_t read_data(const ScanContext* ctx, std::uint64_t offset)
+{
+    auto data_size = get_data_size(ctx);
+    if (offset >= data_size || offset + sizeof(T) > data_size)
+        return UNDEFINED;
+
+    using UnsignedT = std::make_unsigned_t<T>;
+    if (ctx->data)
+        return endian_convert<endian, Endian::Native, UnsignedT>(*(UnsignedT*)get_data(ctx, offset));
+
+    UnsignedT value;
+    read_regions(ctx->scanner, offset, reinterpret_cast<char*>(&value), sizeof(value));
+    return endian_convert<endian, Endian::Native, UnsignedT>(value);
+}
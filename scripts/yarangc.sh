@@ -1,9 +1,33 @@
 #!/bin/bash
 
+usage() {
+    echo "Usage: $0 [-d NAME=VALUE]... [-s NAME=VALUE1,VALUE2,...] [-c CACHE_DIR] [-j JOBS] [-p CORPUS] [-l] [-T TARGET,...] [-V] [-S] [-B native|bytecode] [-b [NAMESPACE:]BASE_RULES_FILE]... [NAMESPACE:]RULES_FILE..."
+    echo ""
+    echo "  Multiple rule files are compiled into a single ruleset RULES_FILE.bin named after the first of them. Rules of"
+    echo "  the files with NAMESPACE are reported as NAMESPACE:RULE."
+    echo ""
+    echo "  -b BASE_RULES_FILE            Build delta ruleset RULES_FILE.delta.bin which only reports rules changed since BASE_RULES_FILE (repeatable)."
+    echo "  -c CACHE_DIR                  Reuse HyperScan databases compiled by previous builds from CACHE_DIR."
+    echo "  -B BACKEND                    Compile conditions into native code (default) or into bytecode run by the interpreter library without g++."
+    echo "  -j JOBS                       Split generated code into JOBS translation units and compile them in parallel (default: number of CPUs)."
+    echo "  -p CORPUS                     Build with profile-guided optimization trained by scanning files or directories in CORPUS."
+    echo "  -l                            Link native code with link-time optimization."
+    echo "  -T TARGET,...                 Embed HyperScan databases for each of the CPU targets (host, baseline, avx2, avx512), the best one the CPU"
+    echo "                                supports is picked when the ruleset is loaded (default: host)."
+    echo "  -V                            Compile vectored HyperScan databases so yng_scan_vector scans regions without copying them together."
+    echo "  -S                            Count evaluations, hits and cycles of rules and matches of patterns for yng_get_stats (native backend only)."
+    echo "  -d NAME=VALUE                 Bind external variable NAME to VALUE during the compilation."
+    echo "  -s NAME=VALUE1,VALUE2,...     Build specialized ruleset RULES_FILE.VALUE.bin for each value of external variable NAME."
+}
+
+# Databases are aligned the way HyperScan aligns them in memory and identified by hash of their contents
+# so processes loading the same database can share its deserialized copy
 generate_asm_file() {
     INCBIN_LINE=""
+    DB_ID=""
     if [ -e "$2" ]; then
         INCBIN_LINE=".incbin \"$2\""
+        DB_ID=$(sha1sum "$2" | cut -d' ' -f1)
     fi
 
     cat >$3 <<EOF
@@ -12,64 +36,241 @@ generate_asm_file() {
 .global $1_start;
 .global $1_end;
 .global $1_size;
+.global $1_id;
 
+.balign 64
 $1_start: ${INCBIN_LINE}
 $1_end:
 $1_size: .long $1_end - $1_start
+$1_id: .asciz "${DB_ID}"
 EOF
 }
 
-SCRIPT_DIR=$(cd $(dirname $0) && pwd)
+# build_bytecode_ruleset OUTPUT_BIN [YARANGC_ARGS]...
+build_bytecode_ruleset() {
+    local RULESET_BIN=$1
+    shift
 
-if [ -z $(command -v yarang) ]; then
-    echo "You need to have yarangc available in PATH"
-    exit 1
-fi
+    local BUILD_DIR=${RULESET_BIN}.build
+    local OUTPUT_PREFIX=${BUILD_DIR}/ruleset
+    mkdir -p ${BUILD_DIR}
 
-if [ -z ${HYPERSCAN_ROOT_DIR} ]; then
-    echo "You need to have HYPERSCAN_ROOT_DIR environment variable specified"
-    exit 1
-fi
+    yarangc -o ${OUTPUT_PREFIX} --backend bytecode "$@" || exit 1
 
-if [ -e ${HYPERSCAN_ROOT_DIR}/lib64 ]; then
-    HYPERSCAN_LIB_DIR=${HYPERSCAN_ROOT_DIR}/lib64
-else
-    HYPERSCAN_LIB_DIR=${HYPERSCAN_ROOT_DIR}/lib
-fi
+    # Interpreter finds the ruleset appended to its own shared library
+    cat ${YARANG_INTERPRETER} ${OUTPUT_PREFIX}.ybc > ${RULESET_BIN} || exit 1
+
+    rm -rf ${BUILD_DIR}
+}
+
+# compile_ruleset OUTPUT_BIN BUILD_DIR EXTRA_CXXFLAGS
+compile_ruleset() {
+    local RULESET_BIN=$1
+    local BUILD_DIR=$2
+    local OUTPUT_PREFIX=${BUILD_DIR}/ruleset
 
-yarangc "$@"
+    local RULESET_CPP_FILE=${SCRIPT_DIR}/ruleset.yar.cpp
+    local RULESET_OBJ_FILE=${BUILD_DIR}/$(basename ${RULESET_CPP_FILE}).o
+    local DB_OBJECT_FILES=()
 
-RULESET_CPP_FILE=${SCRIPT_DIR}/ruleset.yar.cpp
-RULESET_OBJ_FILE=$(pwd)/$(basename ${RULESET_CPP_FILE}).o
-LITERAL_DB_FILE=$1.literal.db
-REGEX_DB_FILE=$1.regex.db
-MUTEX_DB_FILE=$1.mutex.db
-RULESET_BIN=$1.bin
+    # Every variant is always present, those which weren't built are just empty
+    for DB in literal regex unbounded mutex; do
+        for VARIANT in "" baseline avx2 avx512; do
+            local DB_FILE=${OUTPUT_PREFIX}.${DB}${VARIANT:+.${VARIANT}}.db
+            generate_asm_file "${DB}_db${VARIANT:+_${VARIANT}}" ${DB_FILE} ${DB_FILE}.s
+            g++ -nostdlib -c ${DB_FILE}.s -o ${DB_FILE}.o
+            DB_OBJECT_FILES+=(${DB_FILE}.o)
+        done
+    done
 
-LITERAL_ASM_FILE=${LITERAL_DB_FILE}.s
-REGEX_ASM_FILE=${REGEX_DB_FILE}.s
-MUTEX_ASM_FILE=${MUTEX_DB_FILE}.s
+    # Uncomment for release
+    local CXXFLAGS="-fPIC -O3 -std=c++20 -pthread -Wno-narrowing ${LTO_CXXFLAGS} $3"
+    local LDFLAGS="-Wl,--retain-symbols-file=${SCRIPT_DIR}/yng.syms"
 
-DB_OBJECT_FILES=()
+    # Uncomment for debug
+    #local CXXFLAGS="-g -fPIC -O0 -std=c++20 -pthread -Wno-narrowing $3"
+    #local LDFLAGS=""
 
-generate_asm_file "literal_db" ${LITERAL_DB_FILE} ${LITERAL_ASM_FILE}
-g++ -nostdlib -c ${LITERAL_ASM_FILE} -o ${LITERAL_DB_FILE}.o
-DB_OBJECT_FILES+=(${LITERAL_DB_FILE}.o)
+    # Shards with rule functions and the runtime are independent translation units so they are compiled in parallel
+    local RULES_OBJECT_FILES=()
+    for SHARD_FILE in ${BUILD_DIR}/rules_*.cpp; do
+        RULES_OBJECT_FILES+=(${SHARD_FILE}.o)
+    done
 
-generate_asm_file "regex_db" ${REGEX_DB_FILE} ${REGEX_ASM_FILE}
-g++ -nostdlib -c ${REGEX_ASM_FILE} -o ${REGEX_DB_FILE}.o
-DB_OBJECT_FILES+=(${REGEX_DB_FILE}.o)
+    printf '%s\n' ${RULESET_CPP_FILE} ${BUILD_DIR}/rules_*.cpp | xargs -P ${JOBS} -I {} \
+        sh -c "g++ ${CXXFLAGS} -c -I ${HYPERSCAN_ROOT_DIR}/include -I ${SCRIPT_DIR} -I ${BUILD_DIR} -o ${BUILD_DIR}/\$(basename {}).o {}" \
+        || exit 1
 
-generate_asm_file "mutex_db" ${MUTEX_DB_FILE} ${MUTEX_ASM_FILE}
-g++ -nostdlib -c ${MUTEX_ASM_FILE} -o ${MUTEX_DB_FILE}.o
-DB_OBJECT_FILES+=(${MUTEX_DB_FILE}.o)
+    g++ ${CXXFLAGS} -rdynamic -shared -o ${RULESET_BIN} ${RULESET_OBJ_FILE} "${RULES_OBJECT_FILES[@]}" "${DB_OBJECT_FILES[@]}" ${HYPERSCAN_LIB_DIR}/libhs_runtime.a ${LDFLAGS} \
+        || exit 1
+}
+
+# Rule functions are long chains of branches which benefit from block layout and hot/cold splitting driven by a profile
+# of scanning representative data. Object files keep their paths between the instrumented and the optimized build
+# so the profiles are matched to them. Functions of rules the corpus never exercised are still optimized for speed.
+# build_pgo_ruleset OUTPUT_BIN BUILD_DIR
+build_pgo_ruleset() {
+    local RULESET_BIN=$1
+    local BUILD_DIR=$2
+    local PROFILE_DIR=$(cd ${BUILD_DIR} && pwd)/profile
 
-# Uncomment for release
-g++ -fPIC -O3 -c -std=c++20 -Wno-narrowing -I ${HYPERSCAN_ROOT_DIR}/include -I $(pwd) -o ${RULESET_OBJ_FILE} ${RULESET_CPP_FILE}
-g++ -fPIC -rdynamic -shared -std=c++20 -o ${RULESET_BIN} ${RULESET_OBJ_FILE} "${DB_OBJECT_FILES[@]}" ${HYPERSCAN_LIB_DIR}/libhs_runtime.a -Wl,--retain-symbols-file=${SCRIPT_DIR}/yng.syms
+    compile_ruleset ${RULESET_BIN}.instrumented ${BUILD_DIR} "-fprofile-generate -fprofile-update=prefer-atomic -fprofile-dir=${PROFILE_DIR}"
+    echo "Training ${RULESET_BIN} on ${PROFILE_CORPUS[*]}"
+    yarang ${RULESET_BIN}.instrumented "${PROFILE_CORPUS[@]}" > /dev/null || exit 1
 
-# Uncomment for debug
-#g++ -g -fPIC -O0 -c -std=c++20 -I ${HYPERSCAN_ROOT_DIR}/include -I $(pwd) -o ${RULESET_OBJ_FILE} ${RULESET_CPP_FILE}
-#g++ -g -fPIC -rdynamic -shared -std=c++20 -o ${RULESET_BIN} ${RULESET_OBJ_FILE} "${DB_OBJECT_FILES[@]}" ${HYPERSCAN_LIB_DIR}/libhs_runtime.a
+    compile_ruleset ${RULESET_BIN} ${BUILD_DIR} "-fprofile-use -fprofile-partial-training -fprofile-dir=${PROFILE_DIR} -Wno-missing-profile -freorder-blocks-and-partition"
 
-rm -f ${LITERAL_DB_FILE} ${REGEX_DB_FILE} ${LITERAL_ASM_FILE} ${REGEX_ASM_FILE} ${MUTEX_DB_FILE} ${MUTEX_ASM_FILE} ${RULESET_OBJ_FILE} ${LITERAL_DB_FILE}.o ${REGEX_DB_FILE}.o ${MUTEX_DB_FILE}.o
+    # Build without the profile only to report what the training brought
+    compile_ruleset ${RULESET_BIN}.baseline ${BUILD_DIR} ""
+    yarang --compare ${RULESET_BIN}.baseline ${RULESET_BIN} "${PROFILE_CORPUS[@]}"
+
+    rm -f ${RULESET_BIN}.instrumented ${RULESET_BIN}.baseline
+}
+
+# build_ruleset OUTPUT_BIN [YARANGC_ARGS]...
+build_ruleset() {
+    local RULESET_BIN=$1
+    shift
+
+    if [ "${BACKEND}" = "bytecode" ]; then
+        build_bytecode_ruleset ${RULESET_BIN} "$@"
+        return
+    fi
+
+    local BUILD_DIR=${RULESET_BIN}.build
+    local OUTPUT_PREFIX=${BUILD_DIR}/ruleset
+    mkdir -p ${BUILD_DIR}
+
+    yarangc -o ${OUTPUT_PREFIX} --shards ${JOBS} "$@" || exit 1
+
+    if [ ${#PROFILE_CORPUS[@]} -eq 0 ]; then
+        compile_ruleset ${RULESET_BIN} ${BUILD_DIR} ""
+    else
+        build_pgo_ruleset ${RULESET_BIN} ${BUILD_DIR}
+    fi
+
+    rm -rf ${BUILD_DIR}
+}
+
+SCRIPT_DIR=$(cd $(dirname $0) && pwd)
+
+if [ -z $(command -v yarangc) ]; then
+    echo "You need to have yarangc available in PATH"
+    exit 1
+fi
+
+YARANGC_ARGS=()
+BACKEND="native"
+PROFILE_CORPUS=()
+LTO_CXXFLAGS=""
+SPECIALIZE=""
+JOBS=$(nproc)
+SUFFIX=""
+while [ $# -gt 0 ]; do
+    case "$1" in
+        -d|--define)
+            YARANGC_ARGS+=("-d" "$2")
+            shift 2
+            ;;
+        -s|--specialize)
+            SPECIALIZE=$2
+            shift 2
+            ;;
+        -c|--cache)
+            YARANGC_ARGS+=("--cache" "$2")
+            shift 2
+            ;;
+        -b|--base)
+            YARANGC_ARGS+=("--base" "$2")
+            SUFFIX=".delta"
+            shift 2
+            ;;
+        -B|--backend)
+            BACKEND=$2
+            shift 2
+            ;;
+        -p|--profile)
+            PROFILE_CORPUS+=("$2")
+            shift 2
+            ;;
+        -l|--lto)
+            LTO_CXXFLAGS="-flto=auto"
+            shift
+            ;;
+        -T|--targets)
+            YARANGC_ARGS+=("--targets" "$2")
+            shift 2
+            ;;
+        -V|--vectored)
+            YARANGC_ARGS+=("--vectored")
+            shift
+            ;;
+        -S|--stats)
+            YARANGC_ARGS+=("--stats")
+            shift
+            ;;
+        -j|--jobs)
+            JOBS=$2
+            shift 2
+            ;;
+        -h|--help)
+            usage
+            exit 0
+            ;;
+        -*)
+            usage
+            exit 1
+            ;;
+        *)
+            break
+            ;;
+    esac
+done
+
+if [ $# -lt 1 ]; then
+    usage
+    exit 1
+fi
+
+if [ "${BACKEND}" = "bytecode" ]; then
+    YARANG_INTERPRETER=${YARANG_INTERPRETER:-$(dirname $(command -v yarangc))/libyarang_interpreter.so}
+    if [ ! -e ${YARANG_INTERPRETER} ]; then
+        echo "You need to have libyarang_interpreter.so next to yarangc or YARANG_INTERPRETER environment variable specified"
+        exit 1
+    fi
+elif [ "${BACKEND}" = "native" ]; then
+    if [ -z ${HYPERSCAN_ROOT_DIR} ]; then
+        echo "You need to have HYPERSCAN_ROOT_DIR environment variable specified"
+        exit 1
+    fi
+
+    if [ ${#PROFILE_CORPUS[@]} -gt 0 ] && [ -z $(command -v yarang) ]; then
+        echo "You need to have yarang available in PATH to build with profile-guided optimization"
+        exit 1
+    fi
+
+    if [ -e ${HYPERSCAN_ROOT_DIR}/lib64 ]; then
+        HYPERSCAN_LIB_DIR=${HYPERSCAN_ROOT_DIR}/lib64
+    else
+        HYPERSCAN_LIB_DIR=${HYPERSCAN_ROOT_DIR}/lib
+    fi
+else
+    usage
+    exit 1
+fi
+
+# Output is named after the first rules file without its namespace
+RULES_FILE=$1
+if [[ ${RULES_FILE} =~ ^[A-Za-z_][A-Za-z0-9_]*:(.+)$ ]]; then
+    RULES_FILE=${BASH_REMATCH[1]}
+fi
+
+if [ -z "${SPECIALIZE}" ]; then
+    build_ruleset ${RULES_FILE}${SUFFIX}.bin "${YARANGC_ARGS[@]}" "$@"
+else
+    SPECIALIZE_NAME=${SPECIALIZE%%=*}
+    IFS=',' read -ra SPECIALIZE_VALUES <<< "${SPECIALIZE#*=}"
+    for VALUE in "${SPECIALIZE_VALUES[@]}"; do
+        build_ruleset ${RULES_FILE}.$(echo "${VALUE}" | tr -c 'A-Za-z0-9_.\n-' '_')${SUFFIX}.bin "${YARANGC_ARGS[@]}" -d "${SPECIALIZE_NAME}=${VALUE}" "$@"
+    done
+fi
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <climits>
 #include <fstream>
 #include <numeric>
 #include <vector>
@@ -12,8 +13,10 @@
 #include <hs/hs_runtime.h>
 #endif
 
+#include <hspp/database_cache.hpp>
 #include <hspp/error.hpp>
 #include <hspp/pattern.hpp>
+#include <hspp/platform.hpp>
 
 namespace hspp {
 
@@ -25,10 +28,15 @@ public:
         None = 0,
         ReportStart = 1,
         Multiline = 2,
-        SingleMatch = 4
+        SingleMatch = 4,
+        // Scans data given as several separate blocks without copying them together
+        Vectored = 8
     };
 
-    Database(std::uint32_t flags = Flags::None) : _db(nullptr), _flags(flags)
+    // Width reported by HyperScan for patterns which can match arbitrarily long data
+    static constexpr unsigned int UnboundedWidth = UINT_MAX;
+
+    Database(std::uint32_t flags = Flags::None, Target target = Target::Host) : _db(nullptr), _flags(flags), _target(target)
     {
     }
 
@@ -56,45 +64,65 @@ public:
 
 #ifndef ONLY_RUNTIME
     template <typename PatternT>
-    void compile_regexes(const std::vector<PatternT>& patterns, unsigned int base_id = 0)
+    void compile_regexes(const std::vector<PatternT>& patterns, unsigned int base_id = 0, const DatabaseCache* cache = nullptr)
     {
-        unsigned int flag = HS_FLAG_DOTALL | HS_FLAG_UTF8;
-        if (_flags & Flags::ReportStart)
-            flag |= HS_FLAG_SOM_LEFTMOST;
-        if (_flags & Flags::Multiline)
-            flag |= HS_FLAG_MULTILINE;
-        if (_flags & Flags::SingleMatch)
-            flag |= HS_FLAG_SINGLEMATCH;
+        std::vector<unsigned int> ids(patterns.size(), 0);
+        std::iota(ids.begin(), ids.end(), base_id);
+        compile_regexes(patterns, ids, cache);
+    }
 
+    // Patterns are reported under the given IDs so a subset of patterns keeps the IDs of the whole set
+    template <typename PatternT>
+    void compile_regexes(const std::vector<PatternT>& patterns, const std::vector<unsigned int>& ids, const DatabaseCache* cache = nullptr)
+    {
         std::vector<const char*> expressions(patterns.size(), nullptr);
-        std::vector<unsigned int> flags(patterns.size(), flag);
-        std::vector<unsigned int> ids(patterns.size(), 0);
+        std::vector<unsigned int> flags(patterns.size(), _get_regex_flags());
 
         for (std::size_t i = 0; i < patterns.size(); ++i)
-        {
             expressions[i] = patterns[i]->get_pattern().c_str();
-            flags[i] |= 0;
-            ids[i] = base_id + i;
-        }
 
+        auto key = cache ? cache_key(false, _target, _get_mode(), patterns, flags, ids) : 0;
+        if (cache && load_cached(*cache, key))
+            return;
+
+        auto platform = get_platform(_target);
         hs_compile_error_t* error;
         auto rc = hs_compile_multi(
             expressions.data(),
             flags.data(),
             ids.data(),
             patterns.size(),
-            HS_MODE_BLOCK,
-            nullptr,
+            _get_mode(),
+            &platform,
             &_db,
             &error
         );
 
         if (rc != HS_SUCCESS)
             throw HyperScanError("Failed to compile regexes");
+
+        if (cache)
+            cache->store(key, serialize());
+    }
+
+    // Longest match of the regex in bytes with the flags of this database, UnboundedWidth if there is no limit
+    unsigned int get_regex_width(const std::string& pattern) const
+    {
+        hs_expr_info_t* info = nullptr;
+        hs_compile_error_t* error = nullptr;
+        if (hs_expression_info(pattern.c_str(), _get_regex_flags(), &info, &error) != HS_SUCCESS)
+        {
+            hs_free_compile_error(error);
+            throw HyperScanError("Failed to analyze regex");
+        }
+
+        auto result = info->max_width;
+        ::free(info);
+        return result;
     }
 
     template <typename PatternT>
-    void compile_literals(const std::vector<PatternT>& patterns, unsigned int base_id = 0)
+    void compile_literals(const std::vector<PatternT>& patterns, unsigned int base_id = 0, const DatabaseCache* cache = nullptr)
     {
         unsigned int flag = 0;
         if (_flags & Flags::ReportStart)
@@ -115,6 +143,11 @@ public:
             lengths[i] = patterns[i]->get_pattern().length();
         }
 
+        auto key = cache ? cache_key(true, _target, _get_mode(), patterns, flags, ids) : 0;
+        if (cache && load_cached(*cache, key))
+            return;
+
+        auto platform = get_platform(_target);
         hs_compile_error_t* error;
         auto rc = hs_compile_lit_multi(
             expressions.data(),
@@ -122,31 +155,50 @@ public:
             ids.data(),
             lengths.data(),
             patterns.size(),
-            HS_MODE_BLOCK,
-            nullptr,
+            _get_mode(),
+            &platform,
             &_db,
             &error
         );
 
         if (rc != HS_SUCCESS)
             throw HyperScanError("Failed to compile literals");
+
+        if (cache)
+            cache->store(key, serialize());
     }
 #endif
 
-    void save(const std::string& path) const
+    std::vector<char> serialize() const
     {
+        char* db_bytes = nullptr;
         std::size_t db_size = 0;
-        hs_database_size(_db, &db_size);
-
-        auto db_bytes = (char*)::malloc(db_size);
         if (hs_serialize_database(_db, &db_bytes, &db_size) != HS_SUCCESS)
             throw HyperScanError("Failed to serialize database");
 
+        std::vector<char> result(db_bytes, db_bytes + db_size);
+        ::free(db_bytes);
+        return result;
+    }
+
+    void deserialize(const std::vector<char>& data)
+    {
+        hs_database_t* db = nullptr;
+        if (hs_deserialize_database(data.data(), data.size(), &db) != HS_SUCCESS)
+            throw HyperScanError("Failed to deserialize database");
+
+        if (_db)
+            hs_free_database(_db);
+        _db = db;
+    }
+
+    void save(const std::string& path) const
+    {
+        auto db_bytes = serialize();
+
         std::ofstream out_file(path, std::ios::binary | std::ios::trunc);
-        out_file.write(db_bytes, db_size);
+        out_file.write(db_bytes.data(), db_bytes.size());
         out_file.close();
-
-        ::free(db_bytes);
     }
 
     void load(const std::string& path)
@@ -158,9 +210,7 @@ public:
 
         std::vector<char> data(size);
         in_file.read(data.data(), data.size());
-
-        if (hs_deserialize_database(data.data(), data.size(), &_db) != HS_SUCCESS)
-            throw HyperScanError("Failed to deserialize database");
+        deserialize(data);
     }
 
     //template <typename MatchingContext>
@@ -170,8 +220,67 @@ public:
     //}
 
 private:
+#ifndef ONLY_RUNTIME
+    // Key covers everything which affects the compiled database - patterns with their flags and IDs, mode,
+    // platform the database is tuned for and version of HyperScan itself
+    template <typename PatternT>
+    static std::uint64_t cache_key(bool literals, Target target, unsigned int mode, const std::vector<PatternT>& patterns, const std::vector<unsigned int>& flags, const std::vector<unsigned int>& ids)
+    {
+        auto platform = get_platform(target);
+
+        Fnv1a hash;
+        hash.update(std::string{hs_version()})
+            .update(literals)
+            .update(mode)
+            .update(platform.tune)
+            .update(platform.cpu_features)
+            .update(patterns.size());
+
+        for (std::size_t i = 0; i < patterns.size(); ++i)
+            hash.update(patterns[i]->get_pattern()).update(flags[i]).update(ids[i]);
+
+        return hash.digest();
+    }
+
+    unsigned int _get_regex_flags() const
+    {
+        unsigned int result = HS_FLAG_DOTALL | HS_FLAG_UTF8;
+        if (_flags & Flags::ReportStart)
+            result |= HS_FLAG_SOM_LEFTMOST;
+        if (_flags & Flags::Multiline)
+            result |= HS_FLAG_MULTILINE;
+        if (_flags & Flags::SingleMatch)
+            result |= HS_FLAG_SINGLEMATCH;
+        return result;
+    }
+
+    unsigned int _get_mode() const
+    {
+        return _flags & Flags::Vectored ? HS_MODE_VECTORED : HS_MODE_BLOCK;
+    }
+
+    bool load_cached(const DatabaseCache& cache, std::uint64_t key)
+    {
+        auto data = cache.load(key);
+        if (!data)
+            return false;
+
+        // Corrupted or incompatible entries are just recompiled
+        try
+        {
+            deserialize(*data);
+            return true;
+        }
+        catch (const HyperScanError&)
+        {
+            return false;
+        }
+    }
+#endif
+
     hs_database_t* _db;
     std::uint32_t _flags;
+    Target _target;
 };
 
 } // namespace hspp
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+namespace hspp {
+
+// 64-bit FNV-1a, only used to derive cache keys so it doesn't need to be cryptographically strong
+class Fnv1a
+{
+public:
+    Fnv1a() : _hash(0xcbf29ce484222325ull) {}
+
+    Fnv1a& update(const void* data, std::size_t size)
+    {
+        auto bytes = static_cast<const std::uint8_t*>(data);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            _hash ^= bytes[i];
+            _hash *= 0x100000001b3ull;
+        }
+        return *this;
+    }
+
+    template <typename T>
+    Fnv1a& update(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return update(&value, sizeof(value));
+    }
+
+    // Length is hashed together with the contents so that concatenated strings can't collide
+    Fnv1a& update(const std::string& value)
+    {
+        update(value.length());
+        return update(value.data(), value.length());
+    }
+
+    std::uint64_t digest() const { return _hash; }
+
+private:
+    std::uint64_t _hash;
+};
+
+// Directory of serialized databases named by the hash of all the inputs of HyperScan compilation
+class DatabaseCache
+{
+public:
+    DatabaseCache(const std::filesystem::path& directory) : _directory(directory)
+    {
+        std::filesystem::create_directories(_directory);
+    }
+
+    std::optional<std::vector<char>> load(std::uint64_t key) const
+    {
+        std::ifstream in_file(get_path(key), std::ios::binary);
+        if (!in_file)
+            return std::nullopt;
+
+        std::vector<char> data{std::istreambuf_iterator<char>{in_file}, std::istreambuf_iterator<char>{}};
+        if (in_file.bad() || data.empty())
+            return std::nullopt;
+
+        return data;
+    }
+
+    void store(std::uint64_t key, const std::vector<char>& data) const
+    {
+        // Other compilations may share the cache so the entry is written under temporary name and atomically renamed
+        auto path = get_path(key);
+        auto tmp_path = path;
+        tmp_path += ".tmp." + std::to_string(::getpid()) + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+        std::ofstream out_file(tmp_path, std::ios::binary | std::ios::trunc);
+        out_file.write(data.data(), data.size());
+        out_file.close();
+
+        std::error_code error;
+        if (out_file)
+            std::filesystem::rename(tmp_path, path, error);
+        if (!out_file || error)
+            std::filesystem::remove(tmp_path, error);
+    }
+
+    std::filesystem::path get_path(std::uint64_t key) const
+    {
+        char name[24];
+        std::snprintf(name, sizeof(name), "%016llx.db", static_cast<unsigned long long>(key));
+        return _directory / name;
+    }
+
+private:
+    std::filesystem::path _directory;
+};
+
+} // namespace hspp
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <stdexcept>
+#include <string>
+
+#ifndef ONLY_RUNTIME
+#include <hs/hs.h>
+#endif
+
+#include <hspp/error.hpp>
+
+namespace hspp {
+
+// CPU the database is compiled for. Host databases are tuned for the machine which compiles them and may use
+// instructions which the machines scanning with them don't have, the rest are fixed feature sets for fleets of machines.
+enum class Target
+{
+    Host,
+    Baseline,
+    Avx2,
+    Avx512
+};
+
+constexpr std::array<Target, 4> AllTargets = {Target::Host, Target::Baseline, Target::Avx2, Target::Avx512};
+
+inline const char* get_target_name(Target target)
+{
+    switch (target)
+    {
+        case Target::Host:
+            return "host";
+        case Target::Baseline:
+            return "baseline";
+        case Target::Avx2:
+            return "avx2";
+        case Target::Avx512:
+            return "avx512";
+    }
+    return "";
+}
+
+inline Target parse_target(const std::string& name)
+{
+    for (auto target : AllTargets)
+    {
+        if (name == get_target_name(target))
+            return target;
+    }
+
+    throw std::runtime_error("Unknown target '" + name + "', expected one of host, baseline, avx2, avx512");
+}
+
+#ifndef ONLY_RUNTIME
+inline hs_platform_info_t get_platform(Target target)
+{
+    hs_platform_info_t result{};
+    switch (target)
+    {
+        case Target::Host:
+            if (hs_populate_platform(&result) != HS_SUCCESS)
+                throw HyperScanError("Failed to determine platform");
+            break;
+        case Target::Baseline:
+            result.tune = HS_TUNE_FAMILY_GENERIC;
+            result.cpu_features = 0;
+            break;
+        case Target::Avx2:
+            result.tune = HS_TUNE_FAMILY_HSW;
+            result.cpu_features = HS_CPU_FEATURES_AVX2;
+            break;
+        case Target::Avx512:
+            result.tune = HS_TUNE_FAMILY_SKX;
+            result.cpu_features = HS_CPU_FEATURES_AVX2 | HS_CPU_FEATURES_AVX512;
+            break;
+    }
+    return result;
+}
+#endif
+
+} // namespace hspp
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Ruleset compiled for the interpreter backend. Conditions are compiled into code of a stack machine operating
+// on 64-bit values. Each instruction is single 64-bit word with opcode in the lowest byte and operand in the rest.
+namespace bytecode {
+
+enum class Opcode : std::uint8_t
+{
+    Push,           // operand = value
+    PushWide,       // next word = value which doesn't fit into the operand
+    LoadRule,       // operand = rule ID
+    LoadVar,        // operand = loop frame index, pushes current value of the loop
+    MatchString,    // operand = string ID
+    MatchCount,     // operand = string ID
+    MatchOffset,    // operand = string ID, pops match index
+    MatchLength,    // operand = string ID, pops match index
+    MatchAt,        // operand = string ID, pops offset
+    MatchIn,        // operand = string ID, pops high and low
+    Mutex,          // operand = mutex pattern ID
+    Filesize,
+    ReadData,       // operand = size of integer | big endian flag << 8, pops offset
+    Add,
+    Sub,
+    Mul,
+    Mod,
+    BitAnd,
+    BitXor,
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    Not,
+    JumpIfFalse,    // operand = target, pops the value unless the jump is taken
+    JumpIfTrue,     // operand = target, pops the value unless the jump is taken
+    Of,             // operand = number of string IDs, next word = number of required matches followed by string IDs
+    LoopSet,        // operand = end of the loop, next word = number of values, pops number of required hits, values stay on stack
+    LoopRange,      // operand = end of the loop, pops number of required hits, high and low
+    LoopNext,       // operand = start of the loop body, pops result of the body
+    Return          // pops result of the rule
+};
+
+constexpr std::uint64_t MaxOperand = (1ull << 56) - 1;
+// String ID operand which refers to the string of the innermost loop ($, #, @ inside of the loop body)
+constexpr std::uint64_t LoopStringId = MaxOperand;
+constexpr std::uint64_t Undefined = 0xFFFABADAFABADAFFull;
+// Rules inlined into their only consumer have no code of their own
+constexpr std::uint64_t NoEntry = ~0ull;
+
+constexpr std::uint64_t encode(Opcode opcode, std::uint64_t operand = 0)
+{
+    return static_cast<std::uint64_t>(opcode) | (operand << 8);
+}
+
+constexpr Opcode get_opcode(std::uint64_t instruction)
+{
+    return static_cast<Opcode>(instruction & 0xFF);
+}
+
+constexpr std::uint64_t get_operand(std::uint64_t instruction)
+{
+    return instruction >> 8;
+}
+
+enum RuleFlags : std::uint64_t
+{
+    Reported = 1,
+    Global = 2
+};
+
+struct Rule
+{
+    std::string name;
+    std::uint64_t flags;
+    std::uint64_t entry;
+    // Metadata of reported rules, strings are given by their identifiers and IDs of their patterns
+    std::string ns = {};
+    std::vector<std::string> tags = {};
+    std::vector<std::pair<std::string, std::string>> metas = {};
+    std::vector<std::pair<std::string, std::uint64_t>> strings = {};
+};
+
+struct Namespace
+{
+    std::uint64_t begin_id;
+    std::uint64_t end_id;
+    std::vector<std::uint64_t> prescan_global_rules;
+    std::vector<std::uint64_t> schedule;
+};
+
+struct Ruleset
+{
+    std::uint64_t pattern_count = 0;
+    std::uint64_t mutex_pattern_count = 0;
+    std::vector<Rule> rules;
+    std::vector<std::string> retracted_rules;
+    std::vector<Namespace> namespaces;
+    std::vector<std::uint64_t> code;
+    std::vector<char> literal_db;
+    std::vector<char> regex_db;
+    std::vector<char> mutex_db;
+};
+
+// Serialized ruleset is appended to the interpreter library and found through the trailer at the very end of the file
+constexpr std::array<char, 8> Magic = {'Y', 'N', 'G', 'B', 'C', '0', '0', '2'};
+constexpr std::size_t TrailerSize = sizeof(std::uint64_t) + Magic.size();
+
+namespace detail {
+
+class Writer
+{
+public:
+    void write(std::uint64_t value)
+    {
+        auto bytes = reinterpret_cast<const char*>(&value);
+        _data.insert(_data.end(), bytes, bytes + sizeof(value));
+    }
+
+    void write(const char* data, std::size_t size)
+    {
+        write(static_cast<std::uint64_t>(size));
+        _data.insert(_data.end(), data, data + size);
+    }
+
+    void write(const std::string& value) { write(value.data(), value.size()); }
+    void write(const std::vector<char>& value) { write(value.data(), value.size()); }
+
+    void write(const std::vector<std::uint64_t>& values)
+    {
+        write(static_cast<std::uint64_t>(values.size()));
+        for (auto value : values)
+            write(value);
+    }
+
+    std::vector<char>&& finish()
+    {
+        auto payload_size = static_cast<std::uint64_t>(_data.size());
+        write(payload_size);
+        _data.insert(_data.end(), Magic.begin(), Magic.end());
+        return std::move(_data);
+    }
+
+private:
+    std::vector<char> _data;
+};
+
+class Reader
+{
+public:
+    Reader(const char* data, std::size_t size) : _data(data), _size(size), _pos(0) {}
+
+    std::uint64_t read_u64()
+    {
+        std::uint64_t result;
+        std::memcpy(&result, take(sizeof(result)), sizeof(result));
+        return result;
+    }
+
+    std::string read_string()
+    {
+        auto size = read_u64();
+        auto data = take(size);
+        return {data, data + size};
+    }
+
+    std::vector<char> read_blob()
+    {
+        auto size = read_u64();
+        auto data = take(size);
+        return {data, data + size};
+    }
+
+    std::vector<std::uint64_t> read_u64s()
+    {
+        std::vector<std::uint64_t> result(read_u64());
+        for (auto& value : result)
+            value = read_u64();
+        return result;
+    }
+
+private:
+    const char* take(std::uint64_t size)
+    {
+        if (size > _size - _pos)
+            throw std::runtime_error("Bytecode ruleset is truncated");
+
+        auto result = _data + _pos;
+        _pos += size;
+        return result;
+    }
+
+    const char* _data;
+    std::size_t _size;
+    std::size_t _pos;
+};
+
+} // namespace detail
+
+inline std::vector<char> serialize(const Ruleset& ruleset)
+{
+    detail::Writer writer;
+    writer.write(ruleset.pattern_count);
+    writer.write(ruleset.mutex_pattern_count);
+
+    writer.write(static_cast<std::uint64_t>(ruleset.rules.size()));
+    for (const auto& rule : ruleset.rules)
+    {
+        writer.write(rule.name);
+        writer.write(rule.flags);
+        writer.write(rule.entry);
+        writer.write(rule.ns);
+        writer.write(static_cast<std::uint64_t>(rule.tags.size()));
+        for (const auto& tag : rule.tags)
+            writer.write(tag);
+        writer.write(static_cast<std::uint64_t>(rule.metas.size()));
+        for (const auto& [key, value] : rule.metas)
+        {
+            writer.write(key);
+            writer.write(value);
+        }
+        writer.write(static_cast<std::uint64_t>(rule.strings.size()));
+        for (const auto& [id, pattern] : rule.strings)
+        {
+            writer.write(id);
+            writer.write(pattern);
+        }
+    }
+
+    writer.write(static_cast<std::uint64_t>(ruleset.retracted_rules.size()));
+    for (const auto& rule : ruleset.retracted_rules)
+        writer.write(rule);
+
+    writer.write(static_cast<std::uint64_t>(ruleset.namespaces.size()));
+    for (const auto& ns : ruleset.namespaces)
+    {
+        writer.write(ns.begin_id);
+        writer.write(ns.end_id);
+        writer.write(ns.prescan_global_rules);
+        writer.write(ns.schedule);
+    }
+
+    writer.write(ruleset.code);
+    writer.write(ruleset.literal_db);
+    writer.write(ruleset.regex_db);
+    writer.write(ruleset.mutex_db);
+    return writer.finish();
+}
+
+// Accepts any data which ends with serialized ruleset, like the interpreter library with the ruleset appended
+inline Ruleset deserialize(const char* data, std::size_t size)
+{
+    if (size < TrailerSize || std::memcmp(data + size - Magic.size(), Magic.data(), Magic.size()) != 0)
+        throw std::runtime_error("Bytecode ruleset not found");
+
+    std::uint64_t payload_size;
+    std::memcpy(&payload_size, data + size - TrailerSize, sizeof(payload_size));
+    if (payload_size > size - TrailerSize)
+        throw std::runtime_error("Bytecode ruleset is truncated");
+
+    detail::Reader reader(data + size - TrailerSize - payload_size, payload_size);
+
+    Ruleset result;
+    result.pattern_count = reader.read_u64();
+    result.mutex_pattern_count = reader.read_u64();
+
+    result.rules.resize(reader.read_u64());
+    for (auto& rule : result.rules)
+    {
+        rule.name = reader.read_string();
+        rule.flags = reader.read_u64();
+        rule.entry = reader.read_u64();
+        rule.ns = reader.read_string();
+        rule.tags.resize(reader.read_u64());
+        for (auto& tag : rule.tags)
+            tag = reader.read_string();
+        rule.metas.resize(reader.read_u64());
+        for (auto& [key, value] : rule.metas)
+        {
+            key = reader.read_string();
+            value = reader.read_string();
+        }
+        rule.strings.resize(reader.read_u64());
+        for (auto& [id, pattern] : rule.strings)
+        {
+            id = reader.read_string();
+            pattern = reader.read_u64();
+        }
+    }
+
+    result.retracted_rules.resize(reader.read_u64());
+    for (auto& rule : result.retracted_rules)
+        rule = reader.read_string();
+
+    result.namespaces.resize(reader.read_u64());
+    for (auto& ns : result.namespaces)
+    {
+        ns.begin_id = reader.read_u64();
+        ns.end_id = reader.read_u64();
+        ns.prescan_global_rules = reader.read_u64s();
+        ns.schedule = reader.read_u64s();
+    }
+
+    result.code = reader.read_u64s();
+    result.literal_db = reader.read_blob();
+    result.regex_db = reader.read_blob();
+    result.mutex_db = reader.read_blob();
+    return result;
+}
+
+} // namespace bytecode
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <yarang/interpreter.hpp>
+
+namespace bytecode {
+
+EvalContext::EvalContext(const Ruleset* ruleset)
+    : data(nullptr), data_size(0), matches(ruleset->pattern_count), mutex_matches(ruleset->mutex_pattern_count), rule_matches(ruleset->rules.size())
+{
+}
+
+void EvalContext::reset(const char* new_data, std::size_t new_data_size)
+{
+    for (auto& match : matches)
+    {
+        match.count = 0;
+        match.offsets.clear();
+        match.lengths.clear();
+    }
+
+    std::fill(mutex_matches.begin(), mutex_matches.end(), 0);
+    std::fill(rule_matches.begin(), rule_matches.end(), 0);
+    data = new_data;
+    data_size = new_data_size;
+}
+
+Interpreter::Interpreter(const Ruleset* ruleset) : _ruleset(ruleset)
+{
+}
+
+bool Interpreter::evaluate_prescan_global_rules(EvalContext& ctx)
+{
+    if (_ruleset->namespaces.empty())
+        return true;
+
+    bool holds = false;
+    for (const auto& ns : _ruleset->namespaces)
+    {
+        bool namespace_holds = true;
+        for (auto id : ns.prescan_global_rules)
+        {
+            if (!(ctx.rule_matches[id] = evaluate_rule(ctx, id)))
+            {
+                namespace_holds = false;
+                break;
+            }
+        }
+        holds = holds || namespace_holds;
+    }
+    return holds;
+}
+
+void Interpreter::evaluate_rules(EvalContext& ctx)
+{
+    for (const auto& ns : _ruleset->namespaces)
+    {
+        auto gated = std::any_of(ns.prescan_global_rules.begin(), ns.prescan_global_rules.end(), [&](auto id) {
+            return !ctx.rule_matches[id];
+        });
+
+        for (auto itr = ns.schedule.begin(); !gated && itr != ns.schedule.end(); ++itr)
+        {
+            ctx.rule_matches[*itr] = evaluate_rule(ctx, *itr);
+            gated = !ctx.rule_matches[*itr] && (_ruleset->rules[*itr].flags & RuleFlags::Global);
+        }
+
+        if (gated)
+            std::fill(ctx.rule_matches.begin() + ns.begin_id, ctx.rule_matches.begin() + ns.end_id, 0);
+    }
+}
+
+bool Interpreter::evaluate_rule(const EvalContext& ctx, std::uint64_t id)
+{
+    _stack.clear();
+    _frames.clear();
+    return run(ctx, _ruleset->rules[id].entry);
+}
+
+bool Interpreter::run(const EvalContext& ctx, std::uint64_t pc)
+{
+    const auto* code = _ruleset->code.data();
+    auto get_match = [&](std::uint64_t id) -> const Match& {
+        return ctx.matches[id == LoopStringId ? get_loop_value(_frames.back()) : id];
+    };
+
+    while (true)
+    {
+        auto instruction = code[pc++];
+        auto operand = get_operand(instruction);
+        switch (get_opcode(instruction))
+        {
+            case Opcode::Push:
+                push(operand);
+                break;
+            case Opcode::PushWide:
+                push(code[pc++]);
+                break;
+            case Opcode::LoadRule:
+                push(ctx.rule_matches[operand]);
+                break;
+            case Opcode::LoadVar:
+                push(get_loop_value(_frames[operand]));
+                break;
+            case Opcode::MatchString:
+                push(get_match(operand).count > 0);
+                break;
+            case Opcode::MatchCount:
+                push(get_match(operand).count);
+                break;
+            case Opcode::MatchOffset:
+            {
+                const auto& offsets = get_match(operand).offsets;
+                auto index = pop();
+                push(index < offsets.size() ? offsets[index] : Undefined);
+                break;
+            }
+            case Opcode::MatchLength:
+            {
+                const auto& lengths = get_match(operand).lengths;
+                auto index = pop();
+                push(index < lengths.size() ? lengths[index] : Undefined);
+                break;
+            }
+            case Opcode::MatchAt:
+            {
+                const auto& offsets = get_match(operand).offsets;
+                auto expected = pop();
+                push(std::find(offsets.begin(), offsets.end(), expected) != offsets.end());
+                break;
+            }
+            case Opcode::MatchIn:
+            {
+                const auto& offsets = get_match(operand).offsets;
+                auto high = pop(), low = pop();
+                push(std::any_of(offsets.begin(), offsets.end(), [&](auto offset) { return low <= offset && offset < high; }));
+                break;
+            }
+            case Opcode::Mutex:
+                push(ctx.mutex_matches[operand] > 0);
+                break;
+            case Opcode::Filesize:
+                push(ctx.data_size);
+                break;
+            case Opcode::ReadData:
+            {
+                auto size = operand & 0xFF;
+                auto big_endian = (operand >> 8) != 0;
+                auto offset = pop();
+                if (offset >= ctx.data_size || offset + size > ctx.data_size)
+                {
+                    push(Undefined);
+                    break;
+                }
+
+                auto bytes = reinterpret_cast<const std::uint8_t*>(ctx.data + offset);
+                std::uint64_t value = 0;
+                for (std::uint64_t i = 0; i < size; ++i)
+                    value |= static_cast<std::uint64_t>(bytes[i]) << (8 * (big_endian ? size - i - 1 : i));
+                push(value);
+                break;
+            }
+            case Opcode::Add:
+            {
+                auto rhs = pop();
+                _stack.back() += rhs;
+                break;
+            }
+            case Opcode::Sub:
+            {
+                auto rhs = pop();
+                _stack.back() -= rhs;
+                break;
+            }
+            case Opcode::Mul:
+            {
+                auto rhs = pop();
+                _stack.back() *= rhs;
+                break;
+            }
+            case Opcode::Mod:
+            {
+                auto rhs = pop();
+                _stack.back() = rhs != 0 ? _stack.back() % rhs : Undefined;
+                break;
+            }
+            case Opcode::BitAnd:
+            {
+                auto rhs = pop();
+                _stack.back() &= rhs;
+                break;
+            }
+            case Opcode::BitXor:
+            {
+                auto rhs = pop();
+                _stack.back() ^= rhs;
+                break;
+            }
+            case Opcode::Eq:
+            {
+                auto rhs = pop();
+                _stack.back() = _stack.back() == rhs;
+                break;
+            }
+            case Opcode::Ne:
+            {
+                auto rhs = pop();
+                _stack.back() = _stack.back() != rhs;
+                break;
+            }
+            case Opcode::Lt:
+            {
+                auto rhs = pop();
+                _stack.back() = _stack.back() < rhs;
+                break;
+            }
+            case Opcode::Le:
+            {
+                auto rhs = pop();
+                _stack.back() = _stack.back() <= rhs;
+                break;
+            }
+            case Opcode::Gt:
+            {
+                auto rhs = pop();
+                _stack.back() = _stack.back() > rhs;
+                break;
+            }
+            case Opcode::Ge:
+            {
+                auto rhs = pop();
+                _stack.back() = _stack.back() >= rhs;
+                break;
+            }
+            case Opcode::Not:
+                _stack.back() = !_stack.back();
+                break;
+            case Opcode::JumpIfFalse:
+                if (!_stack.back())
+                    pc = operand;
+                else
+                    _stack.pop_back();
+                break;
+            case Opcode::JumpIfTrue:
+                if (_stack.back())
+                    pc = operand;
+                else
+                    _stack.pop_back();
+                break;
+            case Opcode::Of:
+            {
+                auto count = operand, required = code[pc++];
+                std::uint64_t index = 0, hits = 0;
+                for (; index < count && hits < required && index - hits <= count - required; ++index)
+                    hits += ctx.matches[code[pc + index]].count > 0;
+                pc += count;
+                push(count > 0 && hits == required);
+                break;
+            }
+            case Opcode::LoopSet:
+            {
+                auto count = code[pc++], required = pop();
+                auto base = _stack.size() - count;
+                if (count == 0)
+                {
+                    push(false);
+                    pc = operand;
+                    break;
+                }
+
+                _frames.push_back({base, count, 0, 0, required, count - required, 0, false});
+                break;
+            }
+            case Opcode::LoopRange:
+            {
+                auto required = pop(), high = pop(), low = pop();
+                if (low >= high)
+                {
+                    push(false);
+                    pc = operand;
+                    break;
+                }
+
+                required = std::min(required, high);
+                _frames.push_back({_stack.size(), high - low, 0, 0, required, high - low - required, low, true});
+                break;
+            }
+            case Opcode::LoopNext:
+            {
+                auto& frame = _frames.back();
+                if (pop() && ++frame.hits == frame.required)
+                    finish_loop(true);
+                else if (++frame.index == frame.count || frame.index - frame.hits > frame.tolerance)
+                    finish_loop(false);
+                else
+                    pc = operand;
+                break;
+            }
+            case Opcode::Return:
+                return pop() != 0;
+            default:
+                throw std::runtime_error("Invalid bytecode instruction");
+        }
+    }
+}
+
+std::uint64_t Interpreter::get_loop_value(const Frame& frame) const
+{
+    return frame.range ? frame.low + frame.index : _stack[frame.base + frame.index];
+}
+
+void Interpreter::finish_loop(bool result)
+{
+    _stack.resize(_frames.back().base);
+    _frames.pop_back();
+    push(result);
+}
+
+} // namespace bytecode
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <yarang/bytecode.hpp>
+
+namespace bytecode {
+
+struct Match
+{
+    std::uint32_t count;
+    std::vector<std::uint64_t> offsets;
+    std::vector<std::uint32_t> lengths;
+};
+
+// State of the scan of a single piece of data, counterpart of the generated ScanContext of native rulesets
+struct EvalContext
+{
+    EvalContext(const Ruleset* ruleset);
+
+    // Clears all results of the previous scan
+    void reset(const char* new_data, std::size_t new_data_size);
+
+    const char* data;
+    std::size_t data_size;
+    std::vector<Match> matches;
+    std::vector<std::uint64_t> mutex_matches;
+    std::vector<std::uint8_t> rule_matches;
+};
+
+// Executes the bytecode of rule conditions. Keeps its stacks between the evaluations so nothing is allocated
+// once they grow big enough. Each thread needs its own instance.
+class Interpreter
+{
+public:
+    Interpreter(const Ruleset* ruleset);
+
+    // Same as the generated functions of native rulesets. Global rules only gate the rules of their own namespace
+    // and the scan can be skipped only when global rules of all namespaces rule it out.
+    bool evaluate_prescan_global_rules(EvalContext& ctx);
+    void evaluate_rules(EvalContext& ctx);
+
+    bool evaluate_rule(const EvalContext& ctx, std::uint64_t id);
+
+private:
+    struct Frame
+    {
+        std::uint64_t base;
+        std::uint64_t count;
+        std::uint64_t index;
+        std::uint64_t hits;
+        std::uint64_t required;
+        std::uint64_t tolerance;
+        std::uint64_t low;
+        bool range;
+    };
+
+    bool run(const EvalContext& ctx, std::uint64_t pc);
+    std::uint64_t get_loop_value(const Frame& frame) const;
+    void finish_loop(bool result);
+
+    std::uint64_t pop()
+    {
+        auto result = _stack.back();
+        _stack.pop_back();
+        return result;
+    }
+
+    void push(std::uint64_t value)
+    {
+        _stack.push_back(value);
+    }
+
+    const Ruleset* _ruleset;
+    std::vector<std::uint64_t> _stack;
+    std::vector<Frame> _frames;
+};
+
+} // namespace bytecode
@@ -0,0 +1,470 @@
+// Runtime of rulesets compiled with the bytecode backend. It is built once into libyarang_interpreter.so and each
+// bytecode ruleset is just a copy of it with the serialized ruleset appended, so it exports the same yng_* functions
+// as native rulesets and can be used in their place.
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include <hs/hs_runtime.h>
+#include <rapidjson/document.h>
+
+#include <yarang/bytecode.hpp>
+#include <yarang/interpreter.hpp>
+
+using MatchCallback = void(*)(const char*, void*);
+
+// Same layout as ScannerMemory of native rulesets
+struct ScannerMemory
+{
+    std::size_t scratch;
+    std::size_t context;
+    std::size_t matches;
+};
+
+// Same layout as yng_buffer and yng_result of native rulesets
+struct yng_buffer
+{
+    const char* data;
+    std::size_t size;
+};
+
+struct yng_result
+{
+    std::uint32_t* rule_ids;
+    std::uint32_t capacity;
+    std::uint32_t count;
+};
+
+// Same layout as RuleMeta and RuleInfo of native rulesets
+struct RuleMeta
+{
+    const char* key;
+    const char* value;
+};
+
+struct RuleInfo
+{
+    const char* name;
+    const char* ns;
+    const char* const* tags;
+    std::size_t tag_count;
+    const RuleMeta* metas;
+    std::size_t meta_count;
+    const char* const* strings;
+    std::size_t string_count;
+};
+
+// Same layout as yng_limits and ScanStatus of native rulesets
+struct yng_limits
+{
+    std::uint64_t timeout_us;
+    std::uint32_t max_pattern_matches;
+};
+
+enum class ScanStatus : int
+{
+    Complete = 0,
+    Timeout = 1,
+    TooManyMatches = 2
+};
+
+struct Scanner;
+using MatchCallbackV2 = void(*)(std::size_t, const Scanner*, void*);
+
+struct Scanner
+{
+    Scanner(const bytecode::Ruleset* ruleset, MatchCallback callback, MatchCallbackV2 callback_v2)
+        : scratch(nullptr), match_callback(callback), match_callback_v2(callback_v2), ctx(ruleset), interpreter(ruleset), vector_data(),
+        limits{0, 0}, status(ScanStatus::Complete), deadline(), match_ticks(0) {}
+
+    hs_scratch_t* scratch;
+    MatchCallback match_callback;
+    MatchCallbackV2 match_callback_v2;
+    bytecode::EvalContext ctx;
+    bytecode::Interpreter interpreter;
+    // Regions of vectored scan copied together, kept to reuse the allocation
+    std::vector<char> vector_data;
+    yng_limits limits;
+    ScanStatus status;
+    std::chrono::steady_clock::time_point deadline;
+    std::uint32_t match_ticks;
+};
+
+static std::unique_ptr<bytecode::Ruleset> ruleset;
+static std::vector<const char*> reported_rules;
+static std::vector<std::uint32_t> reported_rule_ids;
+
+// Arrays RuleInfo of each reported rule points to
+struct RuleInfoStorage
+{
+    std::vector<const char*> tags;
+    std::vector<RuleMeta> metas;
+    std::vector<const char*> strings;
+};
+
+static std::vector<RuleInfoStorage> rule_info_storage;
+static std::vector<RuleInfo> rule_infos;
+static std::vector<const char*> retracted_rules;
+static hs_database_t* literal_db = nullptr;
+static hs_database_t* regex_db = nullptr;
+static hs_database_t* mutex_db = nullptr;
+static hs_scratch_t* prototype_scratch = nullptr;
+static bool literal_vectored = false;
+static bool regex_vectored = false;
+
+constexpr std::uint32_t MatchesPerClockCheck = 1024;
+
+static std::vector<char> read_own_file()
+{
+    // The ruleset is appended to the shared library itself so it first needs to find out where it was loaded from
+    Dl_info info;
+    if (::dladdr(reinterpret_cast<void*>(&read_own_file), &info) == 0 || info.dli_fname == nullptr)
+        throw std::runtime_error("Unable to locate bytecode ruleset");
+
+    std::ifstream in_file(info.dli_fname, std::ios::binary);
+    return {std::istreambuf_iterator<char>{in_file}, std::istreambuf_iterator<char>{}};
+}
+
+static hs_database_t* load_database(const std::vector<char>& data)
+{
+    hs_database_t* result = nullptr;
+    if (!data.empty() && hs_deserialize_database(data.data(), data.size(), &result) != HS_SUCCESS)
+        throw std::runtime_error("Unable to deserialize HyperScan database of bytecode ruleset");
+    return result;
+}
+
+static bool is_vectored(const hs_database_t* db)
+{
+    char* info = nullptr;
+    if (db == nullptr || hs_database_info(db, &info) != HS_SUCCESS)
+        return false;
+
+    auto result = std::strstr(info, "VECTORED") != nullptr;
+    ::free(info);
+    return result;
+}
+
+static void scan(hs_database_t* db, hs_scratch_t* scratch, const char* data, std::size_t size, match_event_handler on_match, void* context, const char* name, bool vectored = false)
+{
+    if (db == nullptr)
+        return;
+
+    // HyperScan takes lengths as unsigned int, larger data can only be given to vectored databases in several blocks
+    constexpr std::size_t MaxBlockSize = 0x80000000;
+    hs_error_t rc;
+    if (size <= MaxBlockSize)
+    {
+        // Databases compiled by yarangc --vectored can't be used with hs_scan, buffer is scanned as their single region
+        auto length = static_cast<unsigned int>(size);
+        rc = vectored ? hs_scan_vector(db, &data, &length, 1, 0, scratch, on_match, context) : hs_scan(db, data, length, 0, scratch, on_match, context);
+    }
+    else if (vectored)
+    {
+        std::vector<const char*> blocks;
+        std::vector<unsigned int> lengths;
+        for (std::size_t offset = 0; offset < size; offset += MaxBlockSize)
+        {
+            blocks.push_back(data + offset);
+            lengths.push_back(static_cast<unsigned int>(std::min(size - offset, MaxBlockSize)));
+        }
+        rc = hs_scan_vector(db, blocks.data(), lengths.data(), static_cast<unsigned int>(blocks.size()), 0, scratch, on_match, context);
+    }
+    else
+        throw std::runtime_error("Data of " + std::to_string(size) + " bytes is too large for " + name + " DB, ruleset needs to be compiled with --vectored");
+    if (rc != HS_SUCCESS && rc != HS_SCAN_TERMINATED)
+        throw std::runtime_error(std::string{"Error while scanning with "} + name + " DB (" + std::to_string(rc) + ")");
+}
+
+static void reset_scan(Scanner* scanner, const char* data, std::size_t size)
+{
+    scanner->ctx.reset(data, size);
+    scanner->status = ScanStatus::Complete;
+    scanner->match_ticks = 0;
+    if (scanner->limits.timeout_us)
+        scanner->deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(scanner->limits.timeout_us);
+}
+
+// Time budget is also checked between the databases so scans with only a few matches keep it too
+static bool is_stopped(Scanner* scanner)
+{
+    if (scanner->status == ScanStatus::Complete && scanner->limits.timeout_us && std::chrono::steady_clock::now() >= scanner->deadline)
+        scanner->status = ScanStatus::Timeout;
+    return scanner->status != ScanStatus::Complete;
+}
+
+// Non-zero return value makes HyperScan terminate the scan once it hits one of the limits
+static int on_match(unsigned int id, unsigned long long from, unsigned long long to, unsigned int/* flags*/, void *context)
+{
+    auto scanner = static_cast<Scanner*>(context);
+    auto& match = scanner->ctx.matches[id];
+    match.count++;
+    match.offsets.push_back(from);
+    match.lengths.push_back(to - from);
+
+    const auto& limits = scanner->limits;
+    if (limits.max_pattern_matches && match.count > limits.max_pattern_matches)
+        scanner->status = ScanStatus::TooManyMatches;
+    else if (limits.timeout_us && ++scanner->match_ticks % MatchesPerClockCheck == 0 && std::chrono::steady_clock::now() >= scanner->deadline)
+        scanner->status = ScanStatus::Timeout;
+    return scanner->status != ScanStatus::Complete;
+}
+
+// Scans the data databases unless the scan stops on a limit, returns whether the rules can be evaluated
+static bool scan_databases(Scanner* scanner, const char* data, std::size_t size)
+{
+    scan(literal_db, scanner->scratch, data, size, &on_match, scanner, "literal", literal_vectored);
+    if (is_stopped(scanner))
+        return false;
+    scan(regex_db, scanner->scratch, data, size, &on_match, scanner, "regex", regex_vectored);
+    return scanner->status == ScanStatus::Complete;
+}
+
+static int on_mutex_match(unsigned int id, unsigned long long/* from*/, unsigned long long/* to*/, unsigned int/* flags*/, void *context)
+{
+    static_cast<bytecode::EvalContext*>(context)->mutex_matches[id]++;
+    return 0;
+}
+
+// Mutexes from Cuckoo report are matched as lines of a single buffer
+static std::string read_cuckoo_mutexes(const char* cuckoo_file_path)
+{
+    std::ifstream cuckoo_file{cuckoo_file_path, std::ios::in};
+    std::string cuckoo_file_data{std::istreambuf_iterator<char>{cuckoo_file}, std::istreambuf_iterator<char>{}};
+
+    rapidjson::Document cuckoo_json;
+    cuckoo_json.Parse(cuckoo_file_data.data());
+
+    std::string result;
+    for (auto& mutex : cuckoo_json["behavior"]["summary"]["mutexes"].GetArray())
+    {
+        result.append(mutex.GetString(), mutex.GetStringLength());
+        result.push_back('\n');
+    }
+    return result;
+}
+
+extern "C" {
+
+void yng_initialize()
+{
+    auto file = read_own_file();
+    ruleset = std::make_unique<bytecode::Ruleset>(bytecode::deserialize(file.data(), file.size()));
+
+    literal_db = load_database(ruleset->literal_db);
+    regex_db = load_database(ruleset->regex_db);
+    mutex_db = load_database(ruleset->mutex_db);
+    literal_vectored = is_vectored(literal_db);
+    regex_vectored = is_vectored(regex_db);
+    for (auto db : {literal_db, regex_db, mutex_db})
+    {
+        if (db && hs_alloc_scratch(db, &prototype_scratch) != HS_SUCCESS)
+            throw std::runtime_error("Unable to allocate scratch");
+    }
+
+    for (std::size_t id = 0; id < ruleset->rules.size(); ++id)
+    {
+        if (ruleset->rules[id].flags & bytecode::RuleFlags::Reported)
+        {
+            reported_rules.push_back(ruleset->rules[id].name.c_str());
+            reported_rule_ids.push_back(static_cast<std::uint32_t>(id));
+        }
+    }
+
+    // Storage is complete before any RuleInfo points into it
+    rule_info_storage.resize(reported_rule_ids.size());
+    for (std::size_t index = 0; index < reported_rule_ids.size(); ++index)
+    {
+        const auto& rule = ruleset->rules[reported_rule_ids[index]];
+        auto& storage = rule_info_storage[index];
+        for (const auto& tag : rule.tags)
+            storage.tags.push_back(tag.c_str());
+        for (const auto& [key, value] : rule.metas)
+            storage.metas.push_back({key.c_str(), value.c_str()});
+        for (const auto& [string_id, pattern] : rule.strings)
+            storage.strings.push_back(string_id.c_str());
+
+        rule_infos.push_back({rule.name.c_str(), rule.ns.c_str(), storage.tags.data(), storage.tags.size(), storage.metas.data(), storage.metas.size(),
+            storage.strings.data(), storage.strings.size()});
+    }
+
+    for (const auto& rule : ruleset->retracted_rules)
+        retracted_rules.push_back(rule.c_str());
+}
+
+Scanner* yng_new_scanner(MatchCallback match_callback)
+{
+    auto scanner = new Scanner(ruleset.get(), match_callback, nullptr);
+    if (prototype_scratch && hs_clone_scratch(prototype_scratch, &scanner->scratch) != HS_SUCCESS)
+    {
+        delete scanner;
+        throw std::runtime_error("Unable to allocate scratch for scanner");
+    }
+    return scanner;
+}
+
+Scanner* yng_new_scanner_v2(MatchCallbackV2 match_callback)
+{
+    auto scanner = yng_new_scanner(nullptr);
+    scanner->match_callback_v2 = match_callback;
+    return scanner;
+}
+
+void yng_free_scanner(Scanner* scanner)
+{
+    hs_free_scratch(scanner->scratch);
+    delete scanner;
+}
+
+void yng_scan_data(Scanner* scanner, const char* data, std::size_t size, const char* cuckoo_file_path, void* user_data)
+{
+    auto& ctx = scanner->ctx;
+    reset_scan(scanner, data, size);
+
+    // Nothing can match if some of the global rules which only look at the data doesn't hold
+    if (!scanner->interpreter.evaluate_prescan_global_rules(ctx))
+        return;
+
+    if (!scan_databases(scanner, data, size))
+        return;
+
+    if (cuckoo_file_path)
+    {
+        auto mutexes = read_cuckoo_mutexes(cuckoo_file_path);
+        scan(mutex_db, scanner->scratch, mutexes.c_str(), mutexes.size() + 1, &on_mutex_match, &ctx, "mutex");
+    }
+
+    scanner->interpreter.evaluate_rules(ctx);
+    for (std::size_t index = 0; index < reported_rule_ids.size(); ++index)
+    {
+        auto id = reported_rule_ids[index];
+        if (!ctx.rule_matches[id])
+            continue;
+
+        if (scanner->match_callback_v2)
+            scanner->match_callback_v2(index, scanner, user_data);
+        else
+            scanner->match_callback(ruleset->rules[id].name.c_str(), user_data);
+    }
+}
+
+// Interpreter reads the data directly so the regions are always copied together
+void yng_scan_vector(Scanner* scanner, const yng_buffer* regions, std::size_t count, const char* cuckoo_file_path, void* user_data)
+{
+    auto& data = scanner->vector_data;
+    data.clear();
+    for (std::size_t i = 0; i < count; ++i)
+        data.insert(data.end(), regions[i].data, regions[i].data + regions[i].size);
+    yng_scan_data(scanner, data.data(), data.size(), cuckoo_file_path, user_data);
+}
+
+void yng_scan_batch(Scanner* scanner, const yng_buffer* buffers, std::size_t count, yng_result* results)
+{
+    auto& ctx = scanner->ctx;
+    auto status = ScanStatus::Complete;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        reset_scan(scanner, buffers[i].data, buffers[i].size);
+        results[i].count = 0;
+        if (!scanner->interpreter.evaluate_prescan_global_rules(ctx))
+            continue;
+
+        if (!scan_databases(scanner, buffers[i].data, buffers[i].size))
+        {
+            status = scanner->status;
+            continue;
+        }
+
+        scanner->interpreter.evaluate_rules(ctx);
+        for (std::uint32_t index = 0; index < reported_rule_ids.size(); ++index)
+        {
+            if (!ctx.rule_matches[reported_rule_ids[index]])
+                continue;
+
+            if (results[i].count < results[i].capacity)
+                results[i].rule_ids[results[i].count] = index;
+            results[i].count++;
+        }
+    }
+    scanner->status = status;
+}
+
+void yng_set_limits(Scanner* scanner, const yng_limits* limits)
+{
+    scanner->limits = *limits;
+}
+
+ScanStatus yng_scan_status(const Scanner* scanner)
+{
+    return scanner->status;
+}
+
+void yng_scanner_memory(const Scanner* scanner, ScannerMemory* memory)
+{
+    std::memset(memory, 0, sizeof(ScannerMemory));
+    if (scanner->scratch)
+        hs_scratch_size(scanner->scratch, &memory->scratch);
+
+    const auto& ctx = scanner->ctx;
+    memory->context = sizeof(Scanner) + ctx.matches.capacity() * sizeof(bytecode::Match) + ctx.mutex_matches.capacity() * sizeof(std::uint64_t)
+        + ctx.rule_matches.capacity() + scanner->vector_data.capacity();
+    for (const auto& match : ctx.matches)
+        memory->matches += match.offsets.capacity() * sizeof(std::uint64_t) + match.lengths.capacity() * sizeof(std::uint32_t);
+}
+
+const char* const* yng_reported_rules(std::size_t* count)
+{
+    *count = reported_rules.size();
+    return reported_rules.data();
+}
+
+const RuleInfo* yng_rule_info(std::size_t index)
+{
+    return index < rule_infos.size() ? &rule_infos[index] : nullptr;
+}
+
+std::size_t yng_string_matches(const Scanner* scanner, std::size_t rule_index, std::size_t string_index, const std::uint64_t** offsets, const std::uint32_t** lengths)
+{
+    if (rule_index >= reported_rule_ids.size())
+        return 0;
+
+    const auto& strings = ruleset->rules[reported_rule_ids[rule_index]].strings;
+    if (string_index >= strings.size())
+        return 0;
+
+    const auto& match = scanner->ctx.matches[strings[string_index].second];
+    *offsets = match.offsets.data();
+    *lengths = match.lengths.data();
+    return match.offsets.size();
+}
+
+const char* const* yng_retracted_rules(std::size_t* count)
+{
+    *count = retracted_rules.size();
+    return retracted_rules.data();
+}
+
+void yng_finalize()
+{
+    hs_free_scratch(prototype_scratch);
+    prototype_scratch = nullptr;
+    hs_free_database(literal_db);
+    hs_free_database(regex_db);
+    hs_free_database(mutex_db);
+    literal_db = regex_db = mutex_db = nullptr;
+    reported_rules.clear();
+    reported_rule_ids.clear();
+    rule_infos.clear();
+    rule_info_storage.clear();
+    retracted_rules.clear();
+    ruleset.reset();
+}
+
+}
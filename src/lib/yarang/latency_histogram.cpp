@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include <yarang/latency_histogram.hpp>
+
+// Values below SubBuckets have a bucket each, bucket of larger values is given by their shift and top bits
+LatencyHistogram::LatencyHistogram() : _counts((64 - SubBucketBits + 1) * SubBuckets), _count(0), _total(0), _max(0)
+{
+}
+
+void LatencyHistogram::record(std::uint64_t value)
+{
+    _counts[_get_index(value)]++;
+    _count++;
+    _total += value;
+    _max = std::max(_max, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (std::size_t i = 0; i < _counts.size(); ++i)
+        _counts[i] += other._counts[i];
+    _count += other._count;
+    _total += other._total;
+    _max = std::max(_max, other._max);
+}
+
+std::uint64_t LatencyHistogram::get_percentile(double fraction) const
+{
+    if (_count == 0)
+        return 0;
+
+    auto rank = static_cast<std::uint64_t>(std::ceil(std::clamp(fraction, 0.0, 1.0) * _count));
+    rank = std::max<std::uint64_t>(rank, 1);
+
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < _counts.size(); ++i)
+    {
+        seen += _counts[i];
+        if (seen >= rank)
+            return std::min(_get_highest_value(i), _max);
+    }
+    return _max;
+}
+
+std::size_t LatencyHistogram::_get_index(std::uint64_t value)
+{
+    if (value < SubBuckets)
+        return value;
+
+    // Top SubBucketBits + 1 bits of the value, the highest one is always set
+    auto shift = static_cast<std::size_t>(std::bit_width(value)) - SubBucketBits - 1;
+    auto top = value >> shift;
+    return (shift + 1) * SubBuckets + (top - SubBuckets);
+}
+
+std::uint64_t LatencyHistogram::_get_highest_value(std::size_t index)
+{
+    if (index < SubBuckets)
+        return index;
+
+    auto shift = index / SubBuckets - 1;
+    auto top = SubBuckets + index % SubBuckets;
+    return ((top + 1) << shift) - 1;
+}
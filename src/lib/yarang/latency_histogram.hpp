@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Histogram of latencies in the style of HdrHistogram. Each power of two range is split into the same number of
+// linear buckets so any recorded value is reported with relative error below 1/SubBuckets while the whole range of
+// 64-bit values takes a few thousand counters, no matter how many values are recorded.
+class LatencyHistogram
+{
+public:
+    static constexpr std::size_t SubBucketBits = 5;
+    static constexpr std::size_t SubBuckets = std::size_t{1} << SubBucketBits;
+
+    LatencyHistogram();
+
+    void record(std::uint64_t value);
+    void merge(const LatencyHistogram& other);
+
+    std::uint64_t get_count() const { return _count; }
+    std::uint64_t get_total() const { return _total; }
+    std::uint64_t get_max() const { return _max; }
+    // Smallest value which the given fraction (like 0.99) of recorded values doesn't exceed, up to the bucket
+    // precision. Zero when nothing was recorded.
+    std::uint64_t get_percentile(double fraction) const;
+
+private:
+    static std::size_t _get_index(std::uint64_t value);
+    static std::uint64_t _get_highest_value(std::size_t index);
+
+    std::vector<std::uint64_t> _counts;
+    std::uint64_t _count;
+    std::uint64_t _total;
+    std::uint64_t _max;
+};
@@ -0,0 +1,59 @@
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_set>
+
+#include <yarang/result_store.hpp>
+
+void ResultStore::load(const std::string& path)
+{
+    std::ifstream in_file(path);
+    if (!in_file)
+        return;
+
+    std::string line;
+    while (std::getline(in_file, line))
+    {
+        if (line.empty())
+            continue;
+
+        // Rule names can't contain tabs so the last one separates the file from the rule
+        auto separator = line.rfind('\t');
+        if (separator == std::string::npos)
+            throw std::runtime_error("Malformed line in result store " + path + ": " + line);
+
+        add(line.substr(0, separator), line.substr(separator + 1));
+    }
+}
+
+void ResultStore::save(const std::string& path) const
+{
+    auto tmp_path = path + ".tmp";
+    std::ofstream out_file(tmp_path, std::ios::trunc);
+    for (const auto& [file, rule] : _results)
+        out_file << file << '\t' << rule << '\n';
+    out_file.close();
+
+    if (!out_file || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("Unable to write result store " + path);
+}
+
+void ResultStore::add(const std::string& file, const std::string& rule)
+{
+    _results.emplace(file, rule);
+}
+
+void ResultStore::merge(const std::vector<std::string>& reported_rules, const std::vector<std::string>& retracted_rules,
+    const std::vector<std::string>& scanned_files, const ResultStore& results)
+{
+    std::unordered_set<std::string> reported(reported_rules.begin(), reported_rules.end());
+    std::unordered_set<std::string> retracted(retracted_rules.begin(), retracted_rules.end());
+    std::unordered_set<std::string> scanned(scanned_files.begin(), scanned_files.end());
+
+    std::erase_if(_results, [&](const auto& result) {
+        const auto& [file, rule] = result;
+        return retracted.contains(rule) || (reported.contains(rule) && scanned.contains(file));
+    });
+
+    _results.insert(results._results.begin(), results._results.end());
+}
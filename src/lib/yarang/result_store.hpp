@@ -0,0 +1,29 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Results of scans kept as pairs of file and rule which matched it. It is persisted as text file with one
+// FILE<TAB>RULE line per result so results of delta rulesets can be merged into results of the full ruleset.
+class ResultStore
+{
+public:
+    using Result = std::pair<std::string, std::string>;
+
+    void load(const std::string& path);
+    void save(const std::string& path) const;
+
+    void add(const std::string& file, const std::string& rule);
+
+    // Results of reported rules for all the scanned files are replaced by the new ones while the results of
+    // retracted rules are dropped for all the files, even those which weren't scanned
+    void merge(const std::vector<std::string>& reported_rules, const std::vector<std::string>& retracted_rules,
+        const std::vector<std::string>& scanned_files, const ResultStore& results);
+
+    const std::set<Result>& get_results() const { return _results; }
+
+private:
+    std::set<Result> _results;
+};
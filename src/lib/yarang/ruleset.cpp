@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <limits>
 #include <stdexcept>
 
 #include <dlfcn.h>
@@ -20,11 +24,42 @@ Ruleset::Ruleset(const std::string& path)
     _scan_data = _load<ScanDataFn>("yng_scan_data");
     _free_scanner = _load<FreeScannerFn>("yng_free_scanner");
     _finalize = _load<FinalizeFn>("yng_finalize");
+    _reported_rules = _load_optional<RuleListFn>("yng_reported_rules");
+    _retracted_rules = _load_optional<RuleListFn>("yng_retracted_rules");
+    _scanner_memory = _load_optional<ScannerMemoryFn>("yng_scanner_memory");
+    _scan_batch = _load_optional<ScanBatchFn>("yng_scan_batch");
+    _scan_vector = _load_optional<ScanVectorFn>("yng_scan_vector");
+    _new_scanner_v2 = _load_optional<NewScannerV2Fn>("yng_new_scanner_v2");
+    _rule_info = _load_optional<RuleInfoFn>("yng_rule_info");
+    _string_matches = _load_optional<StringMatchesFn>("yng_string_matches");
+    _scan_data_parallel = _load_optional<ScanDataParallelFn>("yng_scan_data_parallel");
+    _scan_file = _load_optional<ScanFileFn>("yng_scan_file");
+    _prefix_size = _load_optional<PrefixSizeFn>("yng_prefix_size");
+    _set_limits = _load_optional<SetLimitsFn>("yng_set_limits");
+    _scan_status = _load_optional<ScanStatusFn>("yng_scan_status");
+    _get_stats = _load_optional<GetStatsFn>("yng_get_stats");
+    _reset_stats = _load_optional<ResetStatsFn>("yng_reset_stats");
+    _trace_stages = _load_optional<TraceStagesFn>("yng_trace_stages");
+    _stage_times = _load_optional<StageTimesFn>("yng_stage_times");
 
     _initialize();
     ::free(full_path);
 }
 
+Ruleset::Ruleset(Ruleset&& other) noexcept
+    : _handle(other._handle), _initialize(other._initialize), _new_scanner(other._new_scanner), _scan_data(other._scan_data),
+    _free_scanner(other._free_scanner), _finalize(other._finalize), _reported_rules(other._reported_rules),
+    _retracted_rules(other._retracted_rules), _scanner_memory(other._scanner_memory), _scan_batch(other._scan_batch),
+    _scan_vector(other._scan_vector), _new_scanner_v2(other._new_scanner_v2), _rule_info(other._rule_info), _string_matches(other._string_matches),
+    _scan_data_parallel(other._scan_data_parallel), _scan_file(other._scan_file), _prefix_size(other._prefix_size),
+    _set_limits(other._set_limits), _scan_status(other._scan_status), _get_stats(other._get_stats), _reset_stats(other._reset_stats),
+    _trace_stages(other._trace_stages), _stage_times(other._stage_times)
+{
+    // Moved-from ruleset must neither finalize nor unload the library
+    other._handle = nullptr;
+    other._finalize = nullptr;
+}
+
 Ruleset::~Ruleset()
 {
     if (_finalize)
@@ -44,26 +79,179 @@ Ruleset::ScannerWrapper Ruleset::new_scanner(MatchCallbackFn match_callback) con
     return {this, _new_scanner(match_callback)};
 }
 
+ScannerInternal* Ruleset::create_scanner(MatchCallbackFn match_callback) const
+{
+    return _new_scanner(match_callback);
+}
+
+Ruleset::ScannerWrapper Ruleset::new_scanner(MatchCallbackV2Fn match_callback) const
+{
+    return {this, create_scanner(match_callback)};
+}
+
+ScannerInternal* Ruleset::create_scanner(MatchCallbackV2Fn match_callback) const
+{
+    if (_new_scanner_v2 == nullptr)
+        throw std::runtime_error("Binary ruleset doesn't support rule indices in match callback");
+    return _new_scanner_v2(match_callback);
+}
+
 void Ruleset::scan_data(ScannerInternal* scanner, char* data, std::size_t size, const char* cuckoo_file_path, void* context) const
 {
     return _scan_data(scanner, data, size, cuckoo_file_path, context);
 }
 
+void Ruleset::scan_batch(ScannerInternal* scanner, const Buffer* buffers, std::size_t count, BatchResult* results) const
+{
+    if (_scan_batch == nullptr)
+        throw std::runtime_error("Binary ruleset doesn't support batch scans");
+    return _scan_batch(scanner, buffers, count, results);
+}
+
+bool Ruleset::supports_scan_batch() const
+{
+    return _scan_batch != nullptr;
+}
+
+void Ruleset::scan_vector(ScannerInternal* scanner, const Buffer* regions, std::size_t count, const char* cuckoo_file_path, void* context) const
+{
+    if (_scan_vector)
+        return _scan_vector(scanner, regions, count, cuckoo_file_path, context);
+
+    std::vector<char> data;
+    for (std::size_t i = 0; i < count; ++i)
+        data.insert(data.end(), regions[i].data, regions[i].data + regions[i].size);
+    return _scan_data(scanner, data.data(), data.size(), cuckoo_file_path, context);
+}
+
+void Ruleset::scan_data_parallel(ScannerInternal* scanner, char* data, std::size_t size, std::size_t threads, const char* cuckoo_file_path, void* context) const
+{
+    if (_scan_data_parallel)
+        return _scan_data_parallel(scanner, data, size, threads, cuckoo_file_path, context);
+    return _scan_data(scanner, data, size, cuckoo_file_path, context);
+}
+
+void Ruleset::scan_file(ScannerInternal* scanner, const std::string& path, std::size_t threads, const char* cuckoo_file_path, void* context) const
+{
+    if (_scan_file)
+        return _scan_file(scanner, path.c_str(), threads, cuckoo_file_path, context);
+
+    std::ifstream in_file(path, std::ios::binary);
+    if (!in_file)
+        throw std::runtime_error("Unable to open " + path);
+
+    std::vector<char> data{std::istreambuf_iterator<char>{in_file}, std::istreambuf_iterator<char>{}};
+    scan_data_parallel(scanner, data.data(), data.size(), threads, cuckoo_file_path, context);
+}
+
+std::uint64_t Ruleset::get_prefix_size() const
+{
+    return _prefix_size ? _prefix_size() : std::numeric_limits<std::uint64_t>::max();
+}
+
+void Ruleset::set_limits(ScannerInternal* scanner, const Limits& limits) const
+{
+    if (_set_limits == nullptr)
+        throw std::runtime_error("Binary ruleset doesn't support scan limits");
+    return _set_limits(scanner, &limits);
+}
+
+Ruleset::ScanStatus Ruleset::get_scan_status(const ScannerInternal* scanner) const
+{
+    return _scan_status ? _scan_status(scanner) : ScanStatus::Complete;
+}
+
+bool Ruleset::get_stats(const ScannerInternal* scanner, Stats* stats) const
+{
+    return _get_stats && _get_stats(scanner, stats);
+}
+
+void Ruleset::reset_stats(ScannerInternal* scanner) const
+{
+    if (_reset_stats)
+        _reset_stats(scanner);
+}
+
+const char* Ruleset::get_stage_name(std::size_t stage)
+{
+    static const char* stage_names[StageCount] = {"read", "literal", "regex", "unbounded", "cuckoo", "mutex", "evaluation"};
+    return stage < StageCount ? stage_names[stage] : "";
+}
+
+void Ruleset::trace_stages(ScannerInternal* scanner, bool enabled) const
+{
+    if (_trace_stages)
+        _trace_stages(scanner, enabled);
+}
+
+void Ruleset::get_stage_times(const ScannerInternal* scanner, std::uint64_t (&stage_ns)[StageCount]) const
+{
+    auto count = _stage_times ? _stage_times(scanner, stage_ns, StageCount) : 0;
+    std::fill(std::begin(stage_ns) + count, std::end(stage_ns), 0);
+}
+
 void Ruleset::free_scanner(ScannerInternal* scanner) const
 {
     return _free_scanner(scanner);
 }
 
+Ruleset::ScannerMemory Ruleset::get_scanner_memory(const ScannerInternal* scanner) const
+{
+    ScannerMemory result{0, 0, 0};
+    if (_scanner_memory)
+        _scanner_memory(scanner, &result);
+    return result;
+}
+
 void Ruleset::finalize() const
 {
     return _finalize();
 }
 
+std::vector<std::string> Ruleset::get_reported_rules() const
+{
+    return _list_rules(_reported_rules);
+}
+
+std::vector<std::string> Ruleset::get_retracted_rules() const
+{
+    return _list_rules(_retracted_rules);
+}
+
+const Ruleset::RuleInfo* Ruleset::get_rule_info(std::size_t index) const
+{
+    return _rule_info ? _rule_info(index) : nullptr;
+}
+
+Ruleset::StringMatches Ruleset::get_string_matches(const ScannerInternal* scanner, std::size_t rule_index, std::size_t string_index) const
+{
+    StringMatches result{nullptr, nullptr, 0};
+    if (_string_matches)
+        result.count = _string_matches(scanner, rule_index, string_index, &result.offsets, &result.lengths);
+    return result;
+}
+
 template <typename T>
 T Ruleset::_load(const char* name)
 {
-    auto result = reinterpret_cast<T>(::dlsym(_handle, name));
+    auto result = _load_optional<T>(name);
     if (result == nullptr)
         throw std::runtime_error("Unable to load symbol from the binary ruleset");
     return result;
 }
+
+template <typename T>
+T Ruleset::_load_optional(const char* name)
+{
+    return reinterpret_cast<T>(::dlsym(_handle, name));
+}
+
+std::vector<std::string> Ruleset::_list_rules(RuleListFn list_fn)
+{
+    if (list_fn == nullptr)
+        return {};
+
+    std::size_t count = 0;
+    auto names = list_fn(&count);
+    return {names, names + count};
+}
@@ -1,18 +1,129 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 struct ScannerInternal;
 
 class Ruleset
 {
 public:
+    // Memory a scanner keeps between scans, all zeros for rulesets which don't report it
+    struct ScannerMemory
+    {
+        std::size_t scratch;
+        std::size_t context;
+        std::size_t matches;
+    };
+
+    // Same layout as yng_buffer and yng_result of the runtime, buffers are also regions of vectored scans
+    struct Buffer
+    {
+        const char* data;
+        std::size_t size;
+    };
+
+    // Matched rules given as indices into get_reported_rules(), only the first capacity of them are written
+    struct BatchResult
+    {
+        std::uint32_t* rule_ids;
+        std::uint32_t capacity;
+        std::uint32_t count;
+    };
+
+    // Same layout as RuleMeta and RuleInfo of the runtime
+    struct RuleMeta
+    {
+        const char* key;
+        const char* value;
+    };
+
+    struct RuleInfo
+    {
+        const char* name;
+        const char* ns;
+        const char* const* tags;
+        std::size_t tag_count;
+        const RuleMeta* metas;
+        std::size_t meta_count;
+        const char* const* strings;
+        std::size_t string_count;
+    };
+
+    // Same layout as yng_limits of the runtime, zero means no limit
+    struct Limits
+    {
+        std::uint64_t timeout_us;
+        std::uint32_t max_pattern_matches;
+    };
+
+    // Why the last scan stopped, rules aren't reported for scans which hit a limit
+    enum class ScanStatus : int
+    {
+        Complete = 0,
+        Timeout = 1,
+        TooManyMatches = 2
+    };
+
+    // Same layout as yng_rule_stats and yng_stats of the runtime. Stages in the order they run are reading of the
+    // file, HyperScan scans of literal, regex and unbounded databases, parsing of Cuckoo report, HyperScan scan of
+    // its mutexes and the evaluation of rules.
+    struct RuleStats
+    {
+        std::uint64_t evaluations;
+        std::uint64_t hits;
+        std::uint64_t cycles;
+    };
+
+    static constexpr std::size_t StageCount = 7;
+    static const char* get_stage_name(std::size_t stage);
+
+    struct Stats
+    {
+        std::uint64_t scans;
+        std::uint64_t sampled_scans;
+        std::uint64_t stage_ns[StageCount];
+        const char* const* rule_names;
+        const RuleStats* rules;
+        std::size_t rule_count;
+        const char* const* pattern_names;
+        const std::uint64_t* pattern_matches;
+        std::size_t pattern_count;
+    };
+
+    // Matches of a single string pointing into the scanner, valid until its next scan
+    struct StringMatches
+    {
+        const std::uint64_t* offsets;
+        const std::uint32_t* lengths;
+        std::size_t count;
+    };
+
     using InitializeFn = void(*)();
     using MatchCallbackFn = void(*)(const char*, void*);
+    // Gets index of the rule into get_reported_rules() instead of its name
+    using MatchCallbackV2Fn = void(*)(std::size_t, const ScannerInternal*, void*);
     using NewScannerFn = ScannerInternal*(*)(MatchCallbackFn);
+    using NewScannerV2Fn = ScannerInternal*(*)(MatchCallbackV2Fn);
+    using RuleInfoFn = const RuleInfo*(*)(std::size_t);
+    using StringMatchesFn = std::size_t(*)(const ScannerInternal*, std::size_t, std::size_t, const std::uint64_t**, const std::uint32_t**);
     using ScanDataFn = void(*)(ScannerInternal*, char*, std::size_t, const char*, void*);
     using FreeScannerFn = void(*)(ScannerInternal*);
     using FinalizeFn = void(*)();
+    using RuleListFn = const char* const*(*)(std::size_t*);
+    using ScannerMemoryFn = void(*)(const ScannerInternal*, ScannerMemory*);
+    using ScanBatchFn = void(*)(ScannerInternal*, const Buffer*, std::size_t, BatchResult*);
+    using ScanVectorFn = void(*)(ScannerInternal*, const Buffer*, std::size_t, const char*, void*);
+    using ScanDataParallelFn = void(*)(ScannerInternal*, char*, std::size_t, std::size_t, const char*, void*);
+    using ScanFileFn = void(*)(ScannerInternal*, const char*, std::size_t, const char*, void*);
+    using PrefixSizeFn = std::uint64_t(*)();
+    using SetLimitsFn = void(*)(ScannerInternal*, const Limits*);
+    using ScanStatusFn = ScanStatus(*)(const ScannerInternal*);
+    using GetStatsFn = bool(*)(const ScannerInternal*, Stats*);
+    using ResetStatsFn = void(*)(ScannerInternal*);
+    using TraceStagesFn = void(*)(ScannerInternal*, bool);
+    using StageTimesFn = std::size_t(*)(const ScannerInternal*, std::uint64_t*, std::size_t);
 
     class ScannerWrapper
     {
@@ -33,6 +144,56 @@ public:
             _parent->scan_data(_scanner, data, size, cuckoo_file_path, context);
         }
 
+        void scan_batch(const Buffer* buffers, std::size_t count, BatchResult* results) const
+        {
+            _parent->scan_batch(_scanner, buffers, count, results);
+        }
+
+        void scan_vector(const Buffer* regions, std::size_t count, const char* cuckoo_file_path, void* context) const
+        {
+            _parent->scan_vector(_scanner, regions, count, cuckoo_file_path, context);
+        }
+
+        void scan_data_parallel(char* data, std::size_t size, std::size_t threads, const char* cuckoo_file_path, void* context) const
+        {
+            _parent->scan_data_parallel(_scanner, data, size, threads, cuckoo_file_path, context);
+        }
+
+        void scan_file(const std::string& path, std::size_t threads, const char* cuckoo_file_path, void* context) const
+        {
+            _parent->scan_file(_scanner, path, threads, cuckoo_file_path, context);
+        }
+
+        void set_limits(const Limits& limits) const
+        {
+            _parent->set_limits(_scanner, limits);
+        }
+
+        ScanStatus get_scan_status() const
+        {
+            return _parent->get_scan_status(_scanner);
+        }
+
+        ScannerMemory get_memory() const
+        {
+            return _parent->get_scanner_memory(_scanner);
+        }
+
+        bool get_stats(Stats* stats) const
+        {
+            return _parent->get_stats(_scanner, stats);
+        }
+
+        void trace_stages(bool enabled) const
+        {
+            _parent->trace_stages(_scanner, enabled);
+        }
+
+        void get_stage_times(std::uint64_t (&stage_ns)[StageCount]) const
+        {
+            _parent->get_stage_times(_scanner, stage_ns);
+        }
+
     private:
         const Ruleset* _parent;
         ScannerInternal* _scanner;
@@ -40,18 +201,63 @@ public:
 
     Ruleset(const std::string& path);
     Ruleset(const Ruleset&) = delete;
-    Ruleset(Ruleset&&) noexcept = default;
+    Ruleset(Ruleset&& other) noexcept;
     ~Ruleset();
 
     void initialize() const;
     ScannerWrapper new_scanner(MatchCallbackFn match_callback) const;
+    ScannerWrapper new_scanner(MatchCallbackV2Fn match_callback) const;
+    // Scanner which the caller releases through free_scanner on its own
+    ScannerInternal* create_scanner(MatchCallbackFn match_callback) const;
+    // Throws for rulesets built before rule indices were exported
+    ScannerInternal* create_scanner(MatchCallbackV2Fn match_callback) const;
     void scan_data(ScannerInternal* scanner, char* data, std::size_t size, const char* cuckoo_file_path, void* context) const;
+    // Scans many small buffers in one call, results are written into the array instead of going through the callback.
+    // Throws for rulesets built before it was added.
+    void scan_batch(ScannerInternal* scanner, const Buffer* buffers, std::size_t count, BatchResult* results) const;
+    bool supports_scan_batch() const;
+    // Scans object given as several regions as if they were a single buffer. Rulesets built before it was added
+    // get the regions copied together.
+    void scan_vector(ScannerInternal* scanner, const Buffer* regions, std::size_t count, const char* cuckoo_file_path, void* context) const;
+    // Scans large data with up to the given number of threads with the same results as scan_data. Rulesets built
+    // before it was added scan on the calling thread only.
+    void scan_data_parallel(ScannerInternal* scanner, char* data, std::size_t size, std::size_t threads, const char* cuckoo_file_path, void* context) const;
+    // Reads only the prefix of the file which the rules can observe and scans it like scan_data_parallel. Rulesets
+    // built before it was added get the whole file read. Throws if the file can't be read.
+    void scan_file(ScannerInternal* scanner, const std::string& path, std::size_t threads, const char* cuckoo_file_path, void* context) const;
+    // Bytes from the start of files which the rules can observe, maximum of std::uint64_t when they can see everything
+    std::uint64_t get_prefix_size() const;
+    // Limits apply to all the following scans of the scanner. Throws for rulesets built before they were added.
+    void set_limits(ScannerInternal* scanner, const Limits& limits) const;
+    // Always complete for rulesets which don't support limits
+    ScanStatus get_scan_status(const ScannerInternal* scanner) const;
+    // Counters of rulesets built with yarangc --stats, returns false for the others
+    bool get_stats(const ScannerInternal* scanner, Stats* stats) const;
+    void reset_stats(ScannerInternal* scanner) const;
+    // Scanner records how long each stage of its scans took in nanoseconds, only the last scan is kept. Rulesets
+    // built before it was added report zeros.
+    void trace_stages(ScannerInternal* scanner, bool enabled) const;
+    void get_stage_times(const ScannerInternal* scanner, std::uint64_t (&stage_ns)[StageCount]) const;
     void free_scanner(ScannerInternal* scanner) const;
+    ScannerMemory get_scanner_memory(const ScannerInternal* scanner) const;
     void finalize() const;
 
+    // Rules whose results this ruleset replaces and rules whose previous results are no longer valid at all.
+    // Rulesets built before these were exported report empty lists.
+    std::vector<std::string> get_reported_rules() const;
+    std::vector<std::string> get_retracted_rules() const;
+
+    // Metadata of the reported rule at the given index, null when out of range or not exported by the ruleset
+    const RuleInfo* get_rule_info(std::size_t index) const;
+    // Matches of the string at the given index of RuleInfo::strings, meant to be called from the match callback
+    StringMatches get_string_matches(const ScannerInternal* scanner, std::size_t rule_index, std::size_t string_index) const;
+
 private:
     template <typename T>
     T _load(const char* name);
+    template <typename T>
+    T _load_optional(const char* name);
+    static std::vector<std::string> _list_rules(RuleListFn list_fn);
 
     void* _handle;
     InitializeFn _initialize;
@@ -59,4 +265,21 @@ private:
     ScanDataFn _scan_data;
     FreeScannerFn _free_scanner;
     FinalizeFn _finalize;
+    RuleListFn _reported_rules;
+    RuleListFn _retracted_rules;
+    ScannerMemoryFn _scanner_memory;
+    ScanBatchFn _scan_batch;
+    ScanVectorFn _scan_vector;
+    NewScannerV2Fn _new_scanner_v2;
+    RuleInfoFn _rule_info;
+    StringMatchesFn _string_matches;
+    ScanDataParallelFn _scan_data_parallel;
+    ScanFileFn _scan_file;
+    PrefixSizeFn _prefix_size;
+    SetLimitsFn _set_limits;
+    ScanStatusFn _scan_status;
+    GetStatsFn _get_stats;
+    ResetStatsFn _reset_stats;
+    TraceStagesFn _trace_stages;
+    StageTimesFn _stage_times;
 };
@@ -0,0 +1,123 @@
+#include <filesystem>
+#include <stdexcept>
+
+#include <dlfcn.h>
+#include <stdlib.h>
+
+#include <yarang/ruleset_manager.hpp>
+
+namespace fs = std::filesystem;
+
+RulesetManager::RulesetManager(const std::string& path, Ruleset::MatchCallbackFn match_callback, std::size_t prealloc)
+    : RulesetManager(path, match_callback, nullptr, prealloc)
+{
+}
+
+RulesetManager::RulesetManager(const std::string& path, Ruleset::MatchCallbackV2Fn match_callback, std::size_t prealloc)
+    : RulesetManager(path, nullptr, match_callback, prealloc)
+{
+}
+
+RulesetManager::RulesetManager(const std::string& path, Ruleset::MatchCallbackFn match_callback, Ruleset::MatchCallbackV2Fn match_callback_v2, std::size_t prealloc)
+    : _match_callback(match_callback), _match_callback_v2(match_callback_v2), _prealloc(prealloc), _current(), _reload_mutex(), _last_version(0), _retired(), _loader_mutex(), _loader()
+{
+    _current.store(_load(path, _last_version));
+}
+
+RulesetManager::~RulesetManager()
+{
+    std::lock_guard<std::mutex> lock(_loader_mutex);
+    if (_loader.joinable())
+        _loader.join();
+}
+
+RulesetManager::Scanner RulesetManager::acquire() const
+{
+    return {get_current()};
+}
+
+std::shared_ptr<RulesetManager::Generation> RulesetManager::get_current() const
+{
+    return _current.load();
+}
+
+std::uint64_t RulesetManager::get_version() const
+{
+    return get_current()->version;
+}
+
+std::uint64_t RulesetManager::reload(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(_reload_mutex);
+    auto generation = _load(path, _last_version + 1);
+    _last_version = generation->version;
+
+    // Scans which already acquired the previous ruleset finish with it, all the following ones get the new one
+    _retired.push_back(_current.exchange(std::move(generation)));
+    std::erase_if(_retired, [](const auto& retired) { return retired.expired(); });
+    return _last_version;
+}
+
+std::future<std::uint64_t> RulesetManager::reload_async(const std::string& path)
+{
+    // Loader thread itself only takes the reload mutex so it can be joined while this one is held
+    std::lock_guard<std::mutex> lock(_loader_mutex);
+    if (_loader.joinable())
+        _loader.join();
+
+    std::promise<std::uint64_t> promise;
+    auto result = promise.get_future();
+    _loader = std::thread([this, path, promise = std::move(promise)]() mutable {
+        try
+        {
+            promise.set_value(reload(path));
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    });
+    return result;
+}
+
+std::size_t RulesetManager::collect()
+{
+    std::lock_guard<std::mutex> lock(_reload_mutex);
+    // Retired generations can't be acquired anymore so they are gone once their last scanner is released
+    std::erase_if(_retired, [](const auto& retired) { return retired.expired(); });
+    return _retired.size();
+}
+
+std::shared_ptr<RulesetManager::Generation> RulesetManager::_load(const std::string& path, std::uint64_t version)
+{
+    // dlopen returns the already loaded library if it is the same file, even under different name, and both
+    // generations would then share the global state of one ruleset. Such ruleset is loaded from a private copy.
+    std::error_code error;
+    auto full_path = fs::canonical(path, error);
+    auto handle = !error ? ::dlopen(full_path.c_str(), RTLD_NOW | RTLD_NOLOAD) : nullptr;
+    if (handle == nullptr)
+        return std::make_shared<Generation>(path, _match_callback, _match_callback_v2, _prealloc, version);
+
+    ::dlclose(handle);
+
+    // Copy is loaded from a new directory only its owner can access, so no other manager or user can replace or
+    // remove it before it is loaded
+    auto copy_dir = (fs::temp_directory_path() / "yarang-XXXXXX").string();
+    if (::mkdtemp(copy_dir.data()) == nullptr)
+        throw std::runtime_error("Unable to create directory for a private copy of " + path);
+
+    try
+    {
+        auto copy_path = fs::path{copy_dir} / "ruleset.bin";
+        fs::copy_file(full_path, copy_path);
+        // Library stays mapped after the copy is removed, ruleset only needs the file during initialization
+        auto result = std::make_shared<Generation>(copy_path.string(), _match_callback, _match_callback_v2, _prealloc, version);
+        fs::remove_all(copy_dir, error);
+        return result;
+    }
+    catch (...)
+    {
+        fs::remove_all(copy_dir, error);
+        throw;
+    }
+}
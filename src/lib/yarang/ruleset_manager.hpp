@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <yarang/ruleset.hpp>
+#include <yarang/scanner_pool.hpp>
+
+// Ruleset which can be replaced while it is being used for scanning. Workers acquire a scanner for each file they
+// scan and the scanner keeps its ruleset alive until the scan is done, while reload loads the new ruleset and
+// prepares its scanners aside and only then publishes it, so workers pick it up for their next file without waiting.
+// Replaced ruleset is finalized and unloaded as soon as its last scan finishes, by the thread which releases its last
+// scanner, so a worker may pay for it at the end of its scan.
+class RulesetManager
+{
+public:
+    // Loaded ruleset together with the scanners created for it
+    struct Generation
+    {
+        Generation(const std::string& path, Ruleset::MatchCallbackFn match_callback, Ruleset::MatchCallbackV2Fn match_callback_v2, std::size_t prealloc,
+            std::uint64_t version)
+            : ruleset(path), scanners(&ruleset, match_callback, match_callback_v2, prealloc), version(version) {}
+
+        // Scanners have to be released before the ruleset is finalized so the order of members matters
+        Ruleset ruleset;
+        ScannerPool scanners;
+        std::uint64_t version;
+    };
+
+    class Scanner
+    {
+    public:
+        Scanner(std::shared_ptr<Generation> generation) : _generation(std::move(generation)), _lease(_generation->scanners.acquire()) {}
+
+        void scan_data(char* data, std::size_t size, const char* cuckoo_file_path, void* context) const
+        {
+            _lease.scan_data(data, size, cuckoo_file_path, context);
+        }
+
+        void scan_batch(const Ruleset::Buffer* buffers, std::size_t count, Ruleset::BatchResult* results) const
+        {
+            _lease.scan_batch(buffers, count, results);
+        }
+
+        void scan_vector(const Ruleset::Buffer* regions, std::size_t count, const char* cuckoo_file_path, void* context) const
+        {
+            _lease.scan_vector(regions, count, cuckoo_file_path, context);
+        }
+
+        void scan_data_parallel(char* data, std::size_t size, std::size_t threads, const char* cuckoo_file_path, void* context) const
+        {
+            _lease.scan_data_parallel(data, size, threads, cuckoo_file_path, context);
+        }
+
+        void scan_file(const std::string& path, std::size_t threads, const char* cuckoo_file_path, void* context) const
+        {
+            _lease.scan_file(path, threads, cuckoo_file_path, context);
+        }
+
+        void set_limits(const Ruleset::Limits& limits) const
+        {
+            _lease.set_limits(limits);
+        }
+
+        Ruleset::ScanStatus get_scan_status() const
+        {
+            return _lease.get_scan_status();
+        }
+
+        const Ruleset& get_ruleset() const
+        {
+            return _generation->ruleset;
+        }
+
+        std::uint64_t get_version() const
+        {
+            return _generation->version;
+        }
+
+    private:
+        // Lease is returned to the pool before the generation is released
+        std::shared_ptr<Generation> _generation;
+        ScannerPool::Lease _lease;
+    };
+
+    RulesetManager(const std::string& path, Ruleset::MatchCallbackFn match_callback, std::size_t prealloc = 0);
+    // Rule indices passed to the callback refer to the ruleset of the scanner, see Scanner::get_ruleset()
+    RulesetManager(const std::string& path, Ruleset::MatchCallbackV2Fn match_callback, std::size_t prealloc = 0);
+    RulesetManager(const RulesetManager&) = delete;
+    ~RulesetManager();
+
+    // Scanner of the current ruleset, it should be held only for a single file so reloads are picked up quickly
+    Scanner acquire() const;
+    std::shared_ptr<Generation> get_current() const;
+    std::uint64_t get_version() const;
+
+    // Loads the ruleset and publishes it once it is ready, returns version of the new ruleset. Throws if the ruleset
+    // can't be loaded in which case the current one is kept.
+    std::uint64_t reload(const std::string& path);
+    // Same as reload but in a background thread, errors are reported through the future. Waits for the previous
+    // background reload if it is still running.
+    std::future<std::uint64_t> reload_async(const std::string& path);
+
+    // Number of replaced rulesets still waiting for their scans to finish
+    std::size_t collect();
+
+private:
+    RulesetManager(const std::string& path, Ruleset::MatchCallbackFn match_callback, Ruleset::MatchCallbackV2Fn match_callback_v2, std::size_t prealloc);
+
+    std::shared_ptr<Generation> _load(const std::string& path, std::uint64_t version);
+
+    Ruleset::MatchCallbackFn _match_callback;
+    Ruleset::MatchCallbackV2Fn _match_callback_v2;
+    std::size_t _prealloc;
+    std::atomic<std::shared_ptr<Generation>> _current;
+    std::mutex _reload_mutex;
+    std::uint64_t _last_version;
+    // Replaced generations are owned only by their scanners
+    std::vector<std::weak_ptr<Generation>> _retired;
+    std::mutex _loader_mutex;
+    std::thread _loader;
+};
@@ -0,0 +1,76 @@
+#include <yarang/scanner_pool.hpp>
+
+ScannerPool::ScannerPool(const Ruleset* ruleset, Ruleset::MatchCallbackFn match_callback, std::size_t prealloc)
+    : ScannerPool(ruleset, match_callback, nullptr, prealloc)
+{
+}
+
+ScannerPool::ScannerPool(const Ruleset* ruleset, Ruleset::MatchCallbackV2Fn match_callback, std::size_t prealloc)
+    : ScannerPool(ruleset, nullptr, match_callback, prealloc)
+{
+}
+
+ScannerPool::ScannerPool(const Ruleset* ruleset, Ruleset::MatchCallbackFn match_callback, Ruleset::MatchCallbackV2Fn match_callback_v2, std::size_t prealloc)
+    : _ruleset(ruleset), _match_callback(match_callback), _match_callback_v2(match_callback_v2), _mutex(), _scanners(), _idle()
+{
+    _scanners.reserve(prealloc);
+    for (std::size_t i = 0; i < prealloc; ++i)
+        _scanners.push_back(_create_scanner());
+    _idle = _scanners;
+}
+
+ScannerPool::~ScannerPool()
+{
+    for (auto scanner : _scanners)
+        _ruleset->free_scanner(scanner);
+}
+
+ScannerPool::Lease ScannerPool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_idle.empty())
+        {
+            auto scanner = _idle.back();
+            _idle.pop_back();
+            return {this, scanner};
+        }
+    }
+
+    // Cloning doesn't need the lock so threads which found the pool empty don't wait for each other
+    auto scanner = _create_scanner();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _scanners.push_back(scanner);
+    return {this, scanner};
+}
+
+std::size_t ScannerPool::get_scanner_count() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _scanners.size();
+}
+
+Ruleset::ScannerMemory ScannerPool::get_memory() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    Ruleset::ScannerMemory result{0, 0, 0};
+    for (auto scanner : _scanners)
+    {
+        auto memory = _ruleset->get_scanner_memory(scanner);
+        result.scratch += memory.scratch;
+        result.context += memory.context;
+        result.matches += memory.matches;
+    }
+    return result;
+}
+
+ScannerInternal* ScannerPool::_create_scanner() const
+{
+    return _match_callback_v2 ? _ruleset->create_scanner(_match_callback_v2) : _ruleset->create_scanner(_match_callback);
+}
+
+void ScannerPool::_release(ScannerInternal* scanner)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _idle.push_back(scanner);
+}
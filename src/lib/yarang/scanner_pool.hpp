@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include <yarang/ruleset.hpp>
+
+// Scanners of a single ruleset shared by many threads. Scanners are created on demand when all of them are leased
+// and returned to the pool when the lease ends, so the number of scanners never exceeds the number of concurrent scans.
+// Creating a scanner only clones the scratch prepared by the ruleset so it's cheap even on the scanning path.
+class ScannerPool
+{
+public:
+    class Lease
+    {
+    public:
+        Lease(ScannerPool* pool, ScannerInternal* scanner) : _pool(pool), _scanner(scanner) {}
+        Lease(const Lease&) = delete;
+        Lease(Lease&& other) noexcept : _pool(other._pool), _scanner(other._scanner)
+        {
+            other._scanner = nullptr;
+        }
+        ~Lease()
+        {
+            if (_scanner)
+                _pool->_release(_scanner);
+        }
+
+        Lease& operator=(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+
+        ScannerInternal* get_scanner()
+        {
+            return _scanner;
+        }
+
+        void scan_data(char* data, std::size_t size, const char* cuckoo_file_path, void* context) const
+        {
+            _pool->_ruleset->scan_data(_scanner, data, size, cuckoo_file_path, context);
+        }
+
+        void scan_batch(const Ruleset::Buffer* buffers, std::size_t count, Ruleset::BatchResult* results) const
+        {
+            _pool->_ruleset->scan_batch(_scanner, buffers, count, results);
+        }
+
+        void scan_vector(const Ruleset::Buffer* regions, std::size_t count, const char* cuckoo_file_path, void* context) const
+        {
+            _pool->_ruleset->scan_vector(_scanner, regions, count, cuckoo_file_path, context);
+        }
+
+        void scan_data_parallel(char* data, std::size_t size, std::size_t threads, const char* cuckoo_file_path, void* context) const
+        {
+            _pool->_ruleset->scan_data_parallel(_scanner, data, size, threads, cuckoo_file_path, context);
+        }
+
+        void scan_file(const std::string& path, std::size_t threads, const char* cuckoo_file_path, void* context) const
+        {
+            _pool->_ruleset->scan_file(_scanner, path, threads, cuckoo_file_path, context);
+        }
+
+        // Limits stay with the pooled scanner, leases which need them should set them every time
+        void set_limits(const Ruleset::Limits& limits) const
+        {
+            _pool->_ruleset->set_limits(_scanner, limits);
+        }
+
+        Ruleset::ScanStatus get_scan_status() const
+        {
+            return _pool->_ruleset->get_scan_status(_scanner);
+        }
+
+    private:
+        ScannerPool* _pool;
+        ScannerInternal* _scanner;
+    };
+
+    ScannerPool(const Ruleset* ruleset, Ruleset::MatchCallbackFn match_callback, std::size_t prealloc = 0);
+    ScannerPool(const Ruleset* ruleset, Ruleset::MatchCallbackV2Fn match_callback, std::size_t prealloc = 0);
+    // Scanners are created with the callback which isn't null
+    ScannerPool(const Ruleset* ruleset, Ruleset::MatchCallbackFn match_callback, Ruleset::MatchCallbackV2Fn match_callback_v2, std::size_t prealloc);
+    ScannerPool(const ScannerPool&) = delete;
+    ~ScannerPool();
+
+    // Idle scanner or a new one if there is none
+    Lease acquire();
+
+    std::size_t get_scanner_count() const;
+    // Memory of all the scanners in the pool including the leased ones
+    Ruleset::ScannerMemory get_memory() const;
+
+private:
+    ScannerInternal* _create_scanner() const;
+    void _release(ScannerInternal* scanner);
+
+    const Ruleset* _ruleset;
+    Ruleset::MatchCallbackFn _match_callback;
+    Ruleset::MatchCallbackV2Fn _match_callback_v2;
+    mutable std::mutex _mutex;
+    std::vector<ScannerInternal*> _scanners;
+    std::vector<ScannerInternal*> _idle;
+};
@@ -0,0 +1,484 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <yaramod/utils/observing_visitor.h>
+#include <yaramod/yaramod.h>
+
+#include <yarang/bytecode.hpp>
+#include <yarangc/optimizer.hpp>
+#include <yarangc/pattern_extractor.hpp>
+#include <yarangc/quantifier.hpp>
+#include <yarangc/rule_metadata.hpp>
+#include <yarangc/scheduler.hpp>
+
+// Compiles conditions into bytecode of the interpreter backend. Rules are scheduled, inlined and gated exactly
+// the same way as by the native code generator so both backends report the same results.
+class BytecodeGenerator : public yaramod::ObservingVisitor
+{
+public:
+    BytecodeGenerator(const PatternExtractor* pattern_extractor, const Optimizer* optimizer = nullptr)
+        : _pattern_extractor(pattern_extractor), _optimizer(optimizer), _scheduler(pattern_extractor, optimizer), _rule(nullptr), _rule_info(nullptr), _frames(0)
+    {
+    }
+
+    void generate(const yaramod::YaraFile* yara_file)
+    {
+        generate(yara_file->getRules());
+    }
+
+    void generate(const RuleList& all_rules)
+    {
+        const auto& rule_info_table = _pattern_extractor->get_rule_info_table();
+        _scheduler.schedule(all_rules);
+
+        _ruleset.pattern_count = _pattern_extractor->get_literal_patterns().size() + _pattern_extractor->get_regex_patterns().size();
+        _ruleset.mutex_pattern_count = _pattern_extractor->get_mutex_patterns().size();
+        _ruleset.rules.resize(rule_info_table.size());
+        for (auto&& rule : all_rules)
+        {
+            auto itr = rule_info_table.find(rule->getName());
+            if (itr == rule_info_table.end())
+                continue;
+
+            auto reported = _optimizer ? _optimizer->is_rule_reported(rule.get()) : !rule->isPrivate();
+            auto& compiled = _ruleset.rules[itr->second.id];
+            compiled.name = rule->getName();
+            compiled.flags = (reported ? bytecode::RuleFlags::Reported : 0) | (rule->isGlobal() ? bytecode::RuleFlags::Global : 0);
+            compiled.entry = _scheduler.is_inlined(rule->getName()) ? bytecode::NoEntry : generate_rule(rule.get());
+            if (reported)
+            {
+                auto metadata = get_rule_metadata(rule.get(), itr->second);
+                compiled.ns = std::move(metadata.ns);
+                compiled.tags = std::move(metadata.tags);
+                compiled.metas = std::move(metadata.metas);
+                compiled.strings = std::move(metadata.strings);
+            }
+        }
+
+        for (const auto& ns : _scheduler.get_namespaces())
+        {
+            auto& compiled = _ruleset.namespaces.emplace_back(bytecode::Namespace{ns.begin_id, ns.end_id, {}, {}});
+            for (const auto& scheduled : ns.prescan_global_rules)
+                compiled.prescan_global_rules.push_back(scheduled.id);
+            for (const auto& scheduled : ns.schedule)
+                compiled.schedule.push_back(scheduled.id);
+        }
+    }
+
+    void set_retracted_rules(std::vector<std::string> rules)
+    {
+        _ruleset.retracted_rules = std::move(rules);
+    }
+
+    // HyperScan databases are compiled separately and need to be filled in before serialization
+    bytecode::Ruleset& get_ruleset() { return _ruleset; }
+
+    virtual yaramod::VisitResult visit(yaramod::AndExpression* expr) override
+    {
+        // Operands which always hold don't need to be evaluated
+        if (get_folded_bool(expr->getLeftOperand()).value_or(false))
+            emit(expr->getRightOperand());
+        else if (get_folded_bool(expr->getRightOperand()).value_or(false))
+            emit(expr->getLeftOperand());
+        else
+        {
+            emit(expr->getLeftOperand());
+            auto jump = emit_jump(bytecode::Opcode::JumpIfFalse);
+            emit(expr->getRightOperand());
+            patch_jump(jump);
+        }
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::OrExpression* expr) override
+    {
+        // Operands which never hold don't need to be evaluated
+        if (!get_folded_bool(expr->getLeftOperand()).value_or(true))
+            emit(expr->getRightOperand());
+        else if (!get_folded_bool(expr->getRightOperand()).value_or(true))
+            emit(expr->getLeftOperand());
+        else
+        {
+            emit(expr->getLeftOperand());
+            auto jump = emit_jump(bytecode::Opcode::JumpIfTrue);
+            emit(expr->getRightOperand());
+            patch_jump(jump);
+        }
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::NotExpression* expr) override
+    {
+        emit(expr->getOperand());
+        emit_instruction(bytecode::Opcode::Not);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::OfExpression* expr) override
+    {
+        auto ids = get_string_ids(expr->getIterable().get());
+        emit_instruction(bytecode::Opcode::Of, ids.size());
+        _ruleset.code.push_back(get_required_count(expr->getVariable().get(), ids.size()));
+        _ruleset.code.insert(_ruleset.code.end(), ids.begin(), ids.end());
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ForStringExpression* expr) override
+    {
+        auto ids = get_string_ids(expr->getIterable().get());
+        for (auto id : ids)
+            emit_value(id);
+        emit_value(get_required_count(expr->getVariable().get(), ids.size()));
+
+        auto loop = emit_jump(bytecode::Opcode::LoopSet);
+        _ruleset.code.push_back(ids.size());
+        emit_loop_body(loop, expr->getBody());
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ForArrayExpression* expr) override
+    {
+        std::size_t loop;
+        if (auto set_expr = dynamic_cast<yaramod::SetExpression*>(expr->getIterable().get()))
+        {
+            const auto& elems = set_expr->getElements();
+            for (const auto& elem : elems)
+                emit(elem);
+            emit_value(get_required_count(expr->getVariable().get(), elems.size()));
+
+            loop = emit_jump(bytecode::Opcode::LoopSet);
+            _ruleset.code.push_back(elems.size());
+        }
+        else if (auto range_expr = dynamic_cast<yaramod::RangeExpression*>(expr->getIterable().get()))
+        {
+            range_expr->accept(this);
+            emit_value(get_required_count(expr->getVariable().get(), static_cast<std::uint64_t>(-1ULL)));
+            loop = emit_jump(bytecode::Opcode::LoopRange);
+        }
+        else
+            throw std::runtime_error("Bytecode backend doesn't support iterating over " + expr->getIterable()->getText());
+
+        _loop_vars.emplace_back(expr->getId(), _frames);
+        emit_loop_body(loop, expr->getBody());
+        _loop_vars.pop_back();
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringExpression* expr) override
+    {
+        emit_instruction(bytecode::Opcode::MatchString, get_string_id(expr->getId()));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::PlusExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Add);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::MinusExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Sub);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::MultiplyExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Mul);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ModuloExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Mod);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::BitwiseAndExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::BitAnd);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::BitwiseXorExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::BitXor);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::EqExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Eq);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::NeqExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Ne);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::LtExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Lt);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::LeExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Le);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::GtExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Gt);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::GeExpression* expr) override
+    {
+        return emit_binary(expr, bytecode::Opcode::Ge);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringAtExpression* expr) override
+    {
+        emit(expr->getAtExpression());
+        emit_instruction(bytecode::Opcode::MatchAt, get_string_id(expr->getId()));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringInRangeExpression* expr) override
+    {
+        emit(expr->getRangeExpression());
+        emit_instruction(bytecode::Opcode::MatchIn, get_string_id(expr->getId()));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringCountExpression* expr) override
+    {
+        emit_instruction(bytecode::Opcode::MatchCount, get_string_id("$" + expr->getId().substr(1)));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringLengthExpression* expr) override
+    {
+        emit_match_index(expr->getIndexExpression());
+        emit_instruction(bytecode::Opcode::MatchLength, get_string_id("$" + expr->getId().substr(1)));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringOffsetExpression* expr) override
+    {
+        emit_match_index(expr->getIndexExpression());
+        emit_instruction(bytecode::Opcode::MatchOffset, get_string_id("$" + expr->getId().substr(1)));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::IdExpression* expr) override
+    {
+        const auto& name = expr->getSymbol()->getName();
+        auto var_itr = std::find_if(_loop_vars.begin(), _loop_vars.end(), [&](const auto& var) { return var.first == name; });
+        if (var_itr != _loop_vars.end())
+            emit_instruction(bytecode::Opcode::LoadVar, var_itr->second);
+        else if (auto rule_itr = _pattern_extractor->get_rule_info_table().find(name); rule_itr != _pattern_extractor->get_rule_info_table().end())
+        {
+            if (_scheduler.is_inlined(name))
+                inline_rule(rule_itr->second.rule);
+            else
+                emit_instruction(bytecode::Opcode::LoadRule, rule_itr->second.id);
+        }
+        else
+            throw std::runtime_error("Bytecode backend doesn't support identifier " + name);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::IntLiteralExpression* expr) override
+    {
+        emit_value(static_cast<std::uint64_t>(expr->getValue()));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::BoolLiteralExpression* expr) override
+    {
+        emit_value(expr->getValue() ? 1 : 0);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ParenthesesExpression* expr) override
+    {
+        emit(expr->getEnclosedExpression());
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::RangeExpression* expr) override
+    {
+        emit(expr->getLow());
+        emit(expr->getHigh());
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::IntFunctionExpression* expr) override
+    {
+        // (u)int8, (u)int16, (u)int32 with optional be suffix
+        const auto& function_name = expr->getFunction();
+        auto bits = std::stoull(function_name.substr(function_name.find_first_of("0123456789")));
+        auto big_endian = function_name.find("be") != std::string::npos;
+
+        emit(expr->getArgument());
+        emit_instruction(bytecode::Opcode::ReadData, (bits / 8) | (big_endian ? 1 << 8 : 0));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::FunctionCallExpression* expr) override
+    {
+        if (expr->getFunction()->getText() != "cuckoo.sync.mutex")
+            throw std::runtime_error("Bytecode backend doesn't support function " + expr->getFunction()->getText());
+
+        auto pattern = expr->getArguments()[0]->as<yaramod::RegexpExpression>()->getRegexpString()->getPureText();
+        emit_instruction(bytecode::Opcode::Mutex, _rule_info->get_mutex_id(pattern));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::FilesizeExpression*) override
+    {
+        emit_instruction(bytecode::Opcode::Filesize);
+        return {};
+    }
+
+private:
+    std::uint64_t generate_rule(const yaramod::Rule* rule)
+    {
+        _rule = rule;
+        _rule_info = &_pattern_extractor->get_rule_info_table().at(rule->getName());
+
+        auto entry = _ruleset.code.size();
+        emit(rule->getCondition());
+        emit_instruction(bytecode::Opcode::Return);
+        return entry;
+    }
+
+    void inline_rule(const yaramod::Rule* rule)
+    {
+        auto outer_rule = _rule;
+        auto outer_rule_info = _rule_info;
+        auto outer_loop_vars = std::exchange(_loop_vars, {});
+
+        _rule = rule;
+        _rule_info = &_pattern_extractor->get_rule_info_table().at(rule->getName());
+        emit(rule->getCondition());
+
+        _rule = outer_rule;
+        _rule_info = outer_rule_info;
+        _loop_vars = std::move(outer_loop_vars);
+    }
+
+    void emit(const yaramod::Expression::Ptr& expr)
+    {
+        if (auto value = get_folded_bool(expr))
+            emit_value(*value ? 1 : 0);
+        else
+            expr->accept(this);
+    }
+
+    void emit_instruction(bytecode::Opcode opcode, std::uint64_t operand = 0)
+    {
+        if (operand > bytecode::MaxOperand)
+            throw std::runtime_error("Bytecode operand out of range");
+        _ruleset.code.push_back(bytecode::encode(opcode, operand));
+    }
+
+    void emit_value(std::uint64_t value)
+    {
+        if (value > bytecode::MaxOperand)
+        {
+            emit_instruction(bytecode::Opcode::PushWide);
+            _ruleset.code.push_back(value);
+        }
+        else
+            emit_instruction(bytecode::Opcode::Push, value);
+    }
+
+    yaramod::VisitResult emit_binary(yaramod::BinaryOpExpression* expr, bytecode::Opcode opcode)
+    {
+        emit(expr->getLeftOperand());
+        emit(expr->getRightOperand());
+        emit_instruction(opcode);
+        return {};
+    }
+
+    // Match indices are 1-based in the conditions
+    void emit_match_index(const yaramod::Expression::Ptr& index_expr)
+    {
+        if (index_expr)
+        {
+            emit(index_expr);
+            emit_value(1);
+            emit_instruction(bytecode::Opcode::Sub);
+        }
+        else
+            emit_value(0);
+    }
+
+    std::size_t emit_jump(bytecode::Opcode opcode)
+    {
+        emit_instruction(opcode);
+        return _ruleset.code.size() - 1;
+    }
+
+    void patch_jump(std::size_t jump)
+    {
+        _ruleset.code[jump] = bytecode::encode(bytecode::get_opcode(_ruleset.code[jump]), _ruleset.code.size());
+    }
+
+    void emit_loop_body(std::size_t loop, const yaramod::Expression::Ptr& body)
+    {
+        auto body_start = _ruleset.code.size();
+        _frames++;
+        emit(body);
+        _frames--;
+        emit_instruction(bytecode::Opcode::LoopNext, body_start);
+        patch_jump(loop);
+    }
+
+    std::optional<bool> get_folded_bool(const yaramod::Expression::Ptr& expr) const
+    {
+        return _optimizer ? _optimizer->get_folded_bool(expr.get()) : std::nullopt;
+    }
+
+    // Anonymous string references ($, #, @) inside of loops refer to the string the loop is currently at
+    std::uint64_t get_string_id(const std::string& id) const
+    {
+        return id == "$" ? bytecode::LoopStringId : _rule_info->get_string_id(id);
+    }
+
+    std::vector<std::uint64_t> get_string_ids(const yaramod::Expression* iterable) const
+    {
+        std::vector<std::uint64_t> result;
+        if (dynamic_cast<const yaramod::ThemExpression*>(iterable))
+        {
+            for (const auto& string : _rule->getStrings())
+                result.push_back(_rule_info->get_string_id(string->getIdentifier()));
+        }
+        else if (auto set_expr = dynamic_cast<const yaramod::SetExpression*>(iterable))
+        {
+            for (auto& elem_expr : set_expr->getElements())
+            {
+                if (auto str_expr = dynamic_cast<yaramod::StringExpression*>(elem_expr.get()))
+                    result.push_back(_rule_info->get_string_id(str_expr->getId()));
+                else if (auto str_expr = dynamic_cast<yaramod::StringWildcardExpression*>(elem_expr.get()))
+                {
+                    auto ids = _rule_info->get_string_wildcard_ids(str_expr->getId());
+                    result.insert(result.end(), ids.begin(), ids.end());
+                }
+            }
+        }
+        return result;
+    }
+
+    const PatternExtractor* _pattern_extractor;
+    const Optimizer* _optimizer;
+    Scheduler _scheduler;
+    const yaramod::Rule* _rule;
+    const RuleInfo* _rule_info;
+    bytecode::Ruleset _ruleset;
+
+    // Loop variables with index of the loop frame they belong to
+    std::vector<std::pair<std::string, std::uint64_t>> _loop_vars;
+    std::uint64_t _frames;
+};
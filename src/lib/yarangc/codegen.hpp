@@ -1,14 +1,24 @@
 #pragma once
 
+#include <algorithm>
 #include <iterator>
+#include <limits>
+#include <numeric>
+#include <optional>
 #include <unordered_map>
 #include <sstream>
+#include <utility>
 #include <vector>
 
 #include <yaramod/utils/observing_visitor.h>
 #include <yaramod/yaramod.h>
 
+#include <yarangc/optimizer.hpp>
 #include <yarangc/pattern_extractor.hpp>
+#include <yarangc/quantifier.hpp>
+#include <yarangc/rule_metadata.hpp>
+#include <yarangc/scheduler.hpp>
+#include <yarangc/thread_pool.hpp>
 
 //class Expression {};
 //
@@ -25,95 +35,214 @@
 class Codegen : public yaramod::ObservingVisitor
 {
 public:
-    Codegen(const PatternExtractor* pattern_extractor) : _pattern_extractor(pattern_extractor)
+    Codegen(const PatternExtractor* pattern_extractor, const Optimizer* optimizer = nullptr, ThreadPool* thread_pool = nullptr)
+        : _pattern_extractor(pattern_extractor), _optimizer(optimizer), _thread_pool(thread_pool), _scheduler(pattern_extractor, optimizer)
     {
     }
 
-    void generate(const yaramod::YaraFile* yara_file)
+    void generate(const yaramod::YaraFile* yara_file, std::size_t shards = 1)
     {
+        generate(yara_file->getRules(), shards);
+    }
+
+    void generate(const RuleList& all_rules, std::size_t shards = 1)
+    {
+        const auto& rule_info_table = _pattern_extractor->get_rule_info_table();
+        _scheduler.schedule(all_rules);
+
         _out << "#define PATTERN_COUNT " << _pattern_extractor->get_literal_patterns().size() + _pattern_extractor->get_regex_patterns().size() << "\n";
-        _out << "#define MUTEX_PATTERN_COUNT " << _pattern_extractor->get_mutex_patterns().size();
-        _result.push_back(_out.str());
+        _out << "#define MUTEX_PATTERN_COUNT " << _pattern_extractor->get_mutex_patterns().size() << "\n";
+        _out << "#define RULE_COUNT " << rule_info_table.size();
+        _header.push_back(_out.str());
         _out.str(std::string{});
         _out.clear();
 
-        _result.push_back("struct ScanContext\n"
+        _header.push_back("struct ScanContext\n"
             "{\n"
             "    Scanner* scanner;\n"
             "    const char* data;\n"
             "    std::size_t data_size;\n"
+            "    std::size_t file_size;\n"
             "    void* user_data;\n"
             "    Match matches[PATTERN_COUNT];\n"
             "    std::uint64_t mutex_matches[MUTEX_PATTERN_COUNT];\n"
+            "    bool rule_matches[RULE_COUNT];\n"
             "};"
         );
 
-        for (auto&& rule : yara_file->getRules())
-            generate(rule.get());
+        std::vector<const yaramod::Rule*> rules;
+        for (auto&& rule : all_rules)
+        {
+            if (!rule_info_table.contains(rule->getName()) || _scheduler.is_inlined(rule->getName()))
+                continue;
 
-        _out << "static auto rules = std::array<Rule, " << yara_file->getRules().size() << ">{\n";
-        for (auto&& rule : yara_file->getRules())
-            _out << "Rule{\"" << rule->getName() << "\", RuleVisibility::" << (rule->isPrivate() ? "Private" : "Public")
-                << ", &rule_" << rule->getName() << ", RuleMatch::NotEvaluated},\n";
-        _out << "};";
-        _result.push_back(_out.str());
-    }
+            _out << "bool " << get_function_name(rule.get()) << "(const ScanContext* ctx);\n";
+            rules.push_back(rule.get());
+        }
+        _header.push_back(_out.str());
+        _out.str(std::string{});
+        _out.clear();
 
-    const std::string& generate(const yaramod::Rule* rule)
-    {
-        _rule = rule;
-        _rule_info = &_pattern_extractor->get_rule_info_table().at(_rule->getName());
+        // Each chunk of rules gets its own instance of code generator since it keeps the state of currently generated rule
+        std::vector<std::string> functions(rules.size());
+        if (_thread_pool)
+        {
+            _thread_pool->parallel_for(rules.size(), [&](std::size_t begin, std::size_t end) {
+                Codegen codegen(_pattern_extractor, _optimizer, _scheduler);
+                for (auto i = begin; i < end; ++i)
+                    functions[i] = codegen.generate_rule(rules[i]);
+            });
+        }
+        else
+        {
+            for (std::size_t i = 0; i < rules.size(); ++i)
+                functions[i] = generate_rule(rules[i]);
+        }
 
-        _out << "static bool rule_" << rule->getName() << "(const ScanContext* ctx)\n"
-            << "{\n"
-            << "return ";
+        distribute_into_shards(std::move(functions), std::max(shards, static_cast<std::size_t>(1)));
 
-        observe(rule->getCondition());
+        // Metadata is only kept for the reported rules since only those can be seen by the consumers of the ruleset.
+        // Profiling builds keep it for all the rules so the statistics can name all their patterns.
+        std::ostringstream rule_table;
+        rule_table << "static constexpr auto rules = std::array<Rule, " << rule_info_table.size() << ">{\n";
+        for (auto&& rule : all_rules)
+        {
+            auto itr = rule_info_table.find(rule->getName());
+            if (itr == rule_info_table.end())
+                continue;
+
+            auto reported = _optimizer ? _optimizer->is_rule_reported(rule.get()) : !rule->isPrivate();
+            rule_table << "Rule{\"" << rule->getName() << "\", RuleVisibility::" << (reported ? "Public" : "Private");
+            if (reported || _profiling)
+                rule_table << ", " << generate_rule_metadata(itr->second.id, get_rule_metadata(rule.get(), itr->second));
+            rule_table << "},\n";
+        }
+        rule_table << "};";
+        _out << rule_table.str();
+        _result.push_back(_out.str());
+        _out.str(std::string{});
+        _out.clear();
 
-        _out << ";\n}";
+        // Results of these rules from the previous versions of the ruleset are no longer valid
+        _out << "static constexpr auto retracted_rules = std::array<const char*, " << _retracted_rules.size() << ">{\n";
+        for (const auto& rule : _retracted_rules)
+            _out << "\"" << rule << "\",\n";
+        _out << "};";
+        _result.push_back(_out.str());
+        _out.str(std::string{});
+        _out.clear();
 
+        // Chunks of data scanned in parallel need to overlap by the longest match of the database
+        _out << "static constexpr std::uint64_t literal_max_width = " << _literal_max_width << "ul;\n";
+        _out << "static constexpr std::uint64_t regex_max_width = " << _regex_max_width << "ul;\n";
+        // Only this many bytes from the start of files need to be read for the scan
+        _out << "static constexpr std::uint64_t prefix_size = " << _prefix_size << "ul;\n";
+        _out << "static constexpr bool profiling = " << (_profiling ? "true" : "false") << ";";
         _result.push_back(_out.str());
         _out.str(std::string{});
         _out.clear();
 
+        // Global rules gate all other rules. Those which don't need any pattern matches are checked
+        // before the scan so the scan can be skipped altogether when one of them doesn't hold.
+        if (_scheduler.get_namespaces().size() <= 1)
+        {
+            generate_schedule("evaluate_prescan_global_rules", _scheduler.get_prescan_global_rules());
+            generate_schedule("evaluate_rules", _scheduler.get_schedule());
+        }
+        else
+        {
+            generate_namespaced_prescan_schedule(_scheduler.get_namespaces());
+            generate_namespaced_schedule(_scheduler.get_namespaces());
+        }
+    }
+
+    void set_retracted_rules(std::vector<std::string> rules)
+    {
+        _retracted_rules = std::move(rules);
+    }
+
+    // Longest matches of the literal and regex databases, regexes without any limit are kept out of the regex database
+    void set_max_widths(std::uint64_t literal_max_width, std::uint64_t regex_max_width)
+    {
+        _literal_max_width = literal_max_width;
+        _regex_max_width = regex_max_width;
+    }
+
+    // Bytes from the start of the data which the rules can observe, all of them by default
+    void set_prefix_size(std::uint64_t prefix_size)
+    {
+        _prefix_size = prefix_size;
+    }
+
+    // Rules are evaluated through profile_rule of the runtime which counts their evaluations, hits and cycles
+    void set_profiling(bool profiling)
+    {
+        _profiling = profiling;
+    }
+
+    const std::string& generate(const yaramod::Rule* rule)
+    {
+        _result.push_back(generate_rule(rule));
         return _result.back();
     }
 
-    std::string get_result()
+    // Contents of rules.hpp which is shared by all translation units
+    std::string get_header() const
     {
-        _out.str(std::string{});
-        _out.clear();
+        return join(_header);
+    }
 
-        for (std::size_t i = 0; i < _result.size(); ++i)
-        {
-            _out << _result[i];
-            if (i < _result.size() - 1)
-                _out << "\n\n";
-        }
+    // Contents of rules_<N>.cpp files with rule functions
+    std::vector<std::string> get_shards() const
+    {
+        std::vector<std::string> result;
+        for (const auto& shard : _shards)
+            result.push_back(join(shard));
+        return result;
+    }
 
-        return _out.str();
+    // Contents of rules.def which is included into the runtime
+    std::string get_result() const
+    {
+        return join(_result);
     }
 
     virtual yaramod::VisitResult visit(yaramod::AndExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
-        _out << "\n&& ";
-        expr->getRightOperand()->accept(this);
+        // Operands which always hold don't need to be evaluated
+        if (get_folded_bool(expr->getLeftOperand()).value_or(false))
+            emit(expr->getRightOperand());
+        else if (get_folded_bool(expr->getRightOperand()).value_or(false))
+            emit(expr->getLeftOperand());
+        else
+        {
+            emit(expr->getLeftOperand());
+            _out << "\n&& ";
+            emit(expr->getRightOperand());
+        }
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::OrExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
-        _out << "\n|| ";
-        expr->getRightOperand()->accept(this);
+        // Operands which never hold don't need to be evaluated
+        if (!get_folded_bool(expr->getLeftOperand()).value_or(true))
+            emit(expr->getRightOperand());
+        else if (!get_folded_bool(expr->getRightOperand()).value_or(true))
+            emit(expr->getLeftOperand());
+        else
+        {
+            emit(expr->getLeftOperand());
+            _out << "\n|| ";
+            emit(expr->getRightOperand());
+        }
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::NotExpression* expr) override
     {
         _out << "!";
-        expr->getOperand()->accept(this);
+        emit(expr->getOperand());
         return {};
     }
 
@@ -125,14 +254,7 @@ public:
         else if (auto set_expr = dynamic_cast<yaramod::SetExpression*>(expr->getIterable().get()))
             ids = get_string_ids_from_set(set_expr);
 
-        std::uint64_t count = 0;
-        auto* var_expr = expr->getVariable().get();
-        if (dynamic_cast<yaramod::AnyExpression*>(var_expr))
-            count = 1;
-        else if (dynamic_cast<yaramod::AllExpression*>(var_expr))
-            count = ids.size();
-        else if (auto int_expr = dynamic_cast<yaramod::IntLiteralExpression*>(var_expr))
-            count = std::max(static_cast<std::uint64_t>(1), std::min(ids.size(), int_expr->getValue()));
+        auto count = get_required_count(expr->getVariable().get(), ids.size());
 
         _out << "of(ctx, " << count << "ul, ";
         for (std::size_t i = 0; i < ids.size(); ++i)
@@ -153,20 +275,13 @@ public:
         else if (auto set_expr = dynamic_cast<yaramod::SetExpression*>(expr->getIterable().get()))
             ids = get_string_ids_from_set(set_expr);
 
-        std::uint64_t count = 0;
-        auto* var_expr = expr->getVariable().get();
-        if (dynamic_cast<yaramod::AnyExpression*>(var_expr))
-            count = 1;
-        else if (dynamic_cast<yaramod::AllExpression*>(var_expr))
-            count = ids.size();
-        else if (auto int_expr = dynamic_cast<yaramod::IntLiteralExpression*>(var_expr))
-            count = std::max(static_cast<std::uint64_t>(1), std::min(ids.size(), int_expr->getValue()));
+        auto count = get_required_count(expr->getVariable().get(), ids.size());
 
         _out << "loop(ctx, " << count << "ul, ";
         if (!_loop_vars.empty())
             _out << "std::move(vars), ";
         _out << "[](auto ctx, auto&& vars, auto id) {\nreturn ";
-        expr->getBody()->accept(this);
+        emit(expr->getBody());
         _out << ";\n}, ";
         for (std::size_t i = 0; i < ids.size(); ++i)
         {
@@ -188,21 +303,15 @@ public:
         else if ((range_expr = dynamic_cast<yaramod::RangeExpression*>(expr->getIterable().get())) != nullptr)
             ;
 
-        std::uint64_t count = 0, total_count = set_expr ? set_expr->getElements().size() : static_cast<std::uint64_t>(-1ULL);
-        auto* var_expr = expr->getVariable().get();
-        if (dynamic_cast<yaramod::AnyExpression*>(var_expr))
-            count = 1;
-        else if (dynamic_cast<yaramod::AllExpression*>(var_expr))
-            count = total_count;
-        else if (auto int_expr = dynamic_cast<yaramod::IntLiteralExpression*>(var_expr))
-            count = std::max(static_cast<std::uint64_t>(1), std::min(total_count, int_expr->getValue()));
+        auto total_count = set_expr ? set_expr->getElements().size() : static_cast<std::uint64_t>(-1ULL);
+        auto count = get_required_count(expr->getVariable().get(), total_count);
 
         _out << (set_expr ? "loop_ints" : "loop_range") << "(ctx, " << count << "ul, ";
         if (!_loop_vars.empty())
             _out << "std::move(vars), ";
         _out << "[](auto ctx, auto&& vars, auto id) {\nreturn ";
         _loop_vars.push_back(expr->getId());
-        expr->getBody()->accept(this);
+        emit(expr->getBody());
         _out << ";\n}, ";
         _loop_vars.pop_back();
 
@@ -211,7 +320,7 @@ public:
             const auto& elems = set_expr->getElements();
             for (std::size_t i = 0; i < set_expr->getElements().size(); ++i)
             {
-                elems[i]->accept(this);
+                emit(elems[i]);
                 if (i < elems.size() - 1)
                     _out << ", ";
             }
@@ -253,97 +362,97 @@ public:
 
     virtual yaramod::VisitResult visit(yaramod::PlusExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " + ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::MinusExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " - ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::MultiplyExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " * ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::ModuloExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " % ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::BitwiseAndExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " & ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::BitwiseXorExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " ^ ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::EqExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " == ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::NeqExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
-        _out << " == ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getLeftOperand());
+        _out << " != ";
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::LtExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " < ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::LeExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " <= ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::GtExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " > ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::GeExpression* expr) override
     {
-        expr->getLeftOperand()->accept(this);
+        emit(expr->getLeftOperand());
         _out << " >= ";
-        expr->getRightOperand()->accept(this);
+        emit(expr->getRightOperand());
         return {};
     }
 
@@ -356,7 +465,7 @@ public:
         else
             _out << _rule_info->get_string_id(expr->getId()) << "ul";
         _out << ", ";
-        expr->getAtExpression()->accept(this);
+        emit(expr->getAtExpression());
         _out << ")";
         return {};
     }
@@ -370,7 +479,7 @@ public:
         else
             _out << _rule_info->get_string_id(expr->getId()) << "ul";
         _out << ", ";
-        expr->getRangeExpression()->accept(this);
+        emit(expr->getRangeExpression());
         _out << ")";
         return {};
     }
@@ -423,7 +532,12 @@ public:
         if (auto var_itr = std::find(_loop_vars.begin(), _loop_vars.end(), name); var_itr != _loop_vars.end())
             _out << "std::get<" << (var_itr - _loop_vars.begin()) << ">(vars)";
         else if (auto rule_itr = _pattern_extractor->get_rule_info_table().find(expr->getSymbol()->getName()); rule_itr != _pattern_extractor->get_rule_info_table().end())
-            _out << "evaluate_rule(ctx, " << rule_itr->second.id << ")";
+        {
+            if (_scheduler.is_inlined(name))
+                inline_rule(rule_itr->second.rule);
+            else
+                _out << "ctx->rule_matches[" << rule_itr->second.id << "]";
+        }
         return {};
     }
 
@@ -442,16 +556,16 @@ public:
     virtual yaramod::VisitResult visit(yaramod::ParenthesesExpression* expr) override
     {
         _out << "(";
-        expr->getEnclosedExpression()->accept(this);
+        emit(expr->getEnclosedExpression());
         _out << ")";
         return {};
     }
 
     virtual yaramod::VisitResult visit(yaramod::RangeExpression* expr) override
     {
-        expr->getLow()->accept(this);
+        emit(expr->getLow());
         _out << ", ";
-        expr->getHigh()->accept(this);
+        emit(expr->getHigh());
         return {};
     }
 
@@ -466,7 +580,7 @@ public:
         }
 
         _out << "read_data<" << endianess << ", std::" << function_name << "_t>(ctx, ";
-        expr->getArgument()->accept(this);
+        emit(expr->getArgument());
         _out << ")";
         return {};
     }
@@ -512,6 +626,241 @@ public:
     //}
 
 private:
+    Codegen(const PatternExtractor* pattern_extractor, const Optimizer* optimizer, const Scheduler& scheduler)
+        : _pattern_extractor(pattern_extractor), _optimizer(optimizer), _thread_pool(nullptr), _scheduler(scheduler)
+    {
+    }
+
+    void emit(const yaramod::Expression::Ptr& expr)
+    {
+        if (auto value = get_folded_bool(expr))
+            _out << (*value ? "true" : "false");
+        else
+            expr->accept(this);
+    }
+
+    // Emits arrays with metadata of the rule into the output and returns the remaining initializers of its Rule
+    std::string generate_rule_metadata(std::uint64_t id, const RuleMetadata& metadata)
+    {
+        auto prefix = "rule_" + std::to_string(id) + "_";
+        auto emit_array = [&](const std::string& type, const std::string& name, const std::vector<std::string>& values) {
+            if (values.empty())
+                return std::string{"nullptr"};
+
+            _out << "static constexpr " << type << " " << prefix << name << "[] = {";
+            for (std::size_t i = 0; i < values.size(); ++i)
+                _out << (i > 0 ? ", " : "") << values[i];
+            _out << "};\n";
+            return prefix + name;
+        };
+
+        std::vector<std::string> tags, metas, strings, patterns;
+        for (const auto& tag : metadata.tags)
+            tags.push_back(to_cpp_string_literal(tag));
+        for (const auto& [key, value] : metadata.metas)
+            metas.push_back("RuleMeta{" + to_cpp_string_literal(key) + ", " + to_cpp_string_literal(value) + "}");
+        for (const auto& [string_id, pattern_id] : metadata.strings)
+        {
+            strings.push_back(to_cpp_string_literal(string_id));
+            patterns.push_back(std::to_string(pattern_id));
+        }
+
+        std::ostringstream result;
+        result << to_cpp_string_literal(metadata.ns)
+            << ", " << emit_array("const char*", "tags", tags) << ", " << tags.size()
+            << ", " << emit_array("RuleMeta", "metas", metas) << ", " << metas.size()
+            << ", " << emit_array("const char*", "strings", strings)
+            << ", " << emit_array("std::uint32_t", "patterns", patterns) << ", " << strings.size();
+        return result.str();
+    }
+
+    std::string generate_rule(const yaramod::Rule* rule)
+    {
+        _rule = rule;
+        _rule_info = &_pattern_extractor->get_rule_info_table().at(_rule->getName());
+
+        _out << "bool " << get_function_name(rule) << "(const ScanContext* ctx)\n"
+            << "{\n"
+            << "return ";
+
+        emit(rule->getCondition());
+
+        _out << ";\n}";
+
+        auto result = _out.str();
+        _out.str(std::string{});
+        _out.clear();
+        return result;
+    }
+
+    // Functions are assigned greedily from the largest one to the shard with the least code so far so all translation
+    // units take roughly the same time to compile. Declaration order is kept within each shard.
+    void distribute_into_shards(std::vector<std::string> functions, std::size_t shards)
+    {
+        std::vector<std::size_t> order(functions.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](auto lhs, auto rhs) {
+            return functions[lhs].length() > functions[rhs].length();
+        });
+
+        std::vector<std::size_t> shard_sizes(shards, 0);
+        std::vector<std::vector<std::size_t>> assignment(shards);
+        for (auto index : order)
+        {
+            auto shard = std::min_element(shard_sizes.begin(), shard_sizes.end()) - shard_sizes.begin();
+            shard_sizes[shard] += functions[index].length();
+            assignment[shard].push_back(index);
+        }
+
+        _shards.assign(shards, {"#include \"ruleset.yar.hpp\""});
+        for (std::size_t shard = 0; shard < shards; ++shard)
+        {
+            std::sort(assignment[shard].begin(), assignment[shard].end());
+            for (auto index : assignment[shard])
+                _shards[shard].push_back(std::move(functions[index]));
+        }
+    }
+
+    static std::string join(const std::vector<std::string>& parts)
+    {
+        std::string result;
+        for (std::size_t i = 0; i < parts.size(); ++i)
+        {
+            result += parts[i];
+            if (i < parts.size() - 1)
+                result += "\n\n";
+        }
+        return result;
+    }
+
+    void generate_schedule(const char* name, const std::vector<ScheduledRule>& schedule)
+    {
+        _out << "static bool " << name << "(ScanContext* ctx)\n"
+            << "{\n";
+        for (const auto& scheduled : schedule)
+        {
+            if (scheduled.rule->isGlobal())
+                _out << "if (!(ctx->rule_matches[" << scheduled.id << "] = " << get_rule_call(scheduled) << "))\n"
+                    << "    return false;\n";
+            else
+                _out << "ctx->rule_matches[" << scheduled.id << "] = " << get_rule_call(scheduled) << ";\n";
+        }
+        _out << "return true;\n}";
+        _result.push_back(_out.str());
+        _out.str(std::string{});
+        _out.clear();
+    }
+
+    // Scan can only be skipped when global rules of every namespace rule it out
+    void generate_namespaced_prescan_schedule(const std::vector<ScheduledNamespace>& namespaces)
+    {
+        _out << "static bool evaluate_prescan_global_rules(ScanContext* ctx)\n"
+            << "{\n"
+            << "bool holds = false;\n";
+        for (const auto& ns : namespaces)
+        {
+            if (ns.prescan_global_rules.empty())
+            {
+                _out << "holds = true;\n";
+                continue;
+            }
+
+            _out << "holds = (";
+            for (std::size_t i = 0; i < ns.prescan_global_rules.size(); ++i)
+            {
+                const auto& scheduled = ns.prescan_global_rules[i];
+                _out << (i > 0 ? " && " : "") << "(ctx->rule_matches[" << scheduled.id << "] = " << get_rule_call(scheduled) << ")";
+            }
+            _out << ") || holds;\n";
+        }
+        _out << "return holds;\n}";
+        _result.push_back(_out.str());
+        _out.str(std::string{});
+        _out.clear();
+    }
+
+    // Global rule which doesn't hold only discards results of its own namespace and the evaluation continues
+    // with the next one
+    void generate_namespaced_schedule(const std::vector<ScheduledNamespace>& namespaces)
+    {
+        _out << "static bool evaluate_rules(ScanContext* ctx)\n"
+            << "{\n";
+        for (std::size_t index = 0; index < namespaces.size(); ++index)
+        {
+            const auto& ns = namespaces[index];
+            auto skip_namespace = "{\n"
+                "    std::memset(ctx->rule_matches + " + std::to_string(ns.begin_id) + ", 0, " + std::to_string(ns.end_id - ns.begin_id) + ");\n"
+                "    goto namespace_" + std::to_string(index) + "_end;\n"
+                "}\n";
+            bool gated = !ns.prescan_global_rules.empty();
+
+            if (gated)
+            {
+                _out << "if (";
+                for (std::size_t i = 0; i < ns.prescan_global_rules.size(); ++i)
+                    _out << (i > 0 ? " || " : "") << "!ctx->rule_matches[" << ns.prescan_global_rules[i].id << "]";
+                _out << ")\n" << skip_namespace;
+            }
+
+            for (const auto& scheduled : ns.schedule)
+            {
+                if (scheduled.rule->isGlobal())
+                {
+                    _out << "if (!(ctx->rule_matches[" << scheduled.id << "] = " << get_rule_call(scheduled) << "))\n" << skip_namespace;
+                    gated = true;
+                }
+                else
+                    _out << "ctx->rule_matches[" << scheduled.id << "] = " << get_rule_call(scheduled) << ";\n";
+            }
+
+            if (gated)
+                _out << "namespace_" << index << "_end:;\n";
+        }
+        _out << "return true;\n}";
+        _result.push_back(_out.str());
+        _out.str(std::string{});
+        _out.clear();
+    }
+
+    std::string get_rule_call(const ScheduledRule& scheduled) const
+    {
+        if (_profiling)
+            return "profile_rule(ctx, " + std::to_string(scheduled.id) + ", &" + get_function_name(scheduled.rule) + ")";
+        return get_function_name(scheduled.rule) + "(ctx)";
+    }
+
+    // Plain rule names are valid identifiers already. Names qualified by namespace are prefixed with unique ID
+    // of the rule, plain rule names can never start with digit so the two can't collide.
+    std::string get_function_name(const yaramod::Rule* rule) const
+    {
+        const auto& name = rule->getName();
+        if (get_rule_namespace(name).empty())
+            return "rule_" + name;
+        return "rule_" + std::to_string(_pattern_extractor->get_rule_info_table().at(name).id) + "_" + to_identifier(name);
+    }
+
+    void inline_rule(const yaramod::Rule* rule)
+    {
+        auto outer_rule = _rule;
+        auto outer_rule_info = _rule_info;
+        auto outer_loop_vars = std::exchange(_loop_vars, {});
+
+        _rule = rule;
+        _rule_info = &_pattern_extractor->get_rule_info_table().at(rule->getName());
+        _out << "(";
+        emit(rule->getCondition());
+        _out << ")";
+
+        _rule = outer_rule;
+        _rule_info = outer_rule_info;
+        _loop_vars = std::move(outer_loop_vars);
+    }
+
+    std::optional<bool> get_folded_bool(const yaramod::Expression::Ptr& expr) const
+    {
+        return _optimizer ? _optimizer->get_folded_bool(expr.get()) : std::nullopt;
+    }
+
     std::vector<std::uint64_t> get_string_ids() const
     {
         auto strings = _rule->getStrings();
@@ -541,10 +890,20 @@ private:
     }
 
     const PatternExtractor* _pattern_extractor;
+    const Optimizer* _optimizer;
+    ThreadPool* _thread_pool;
+    Scheduler _scheduler;
     const yaramod::Rule* _rule;
     const RuleInfo* _rule_info;
     std::ostringstream _out;
+    std::vector<std::string> _header;
+    std::vector<std::vector<std::string>> _shards;
     std::vector<std::string> _result;
+    std::vector<std::string> _retracted_rules;
+    std::uint64_t _literal_max_width = 0;
+    std::uint64_t _regex_max_width = 0;
+    std::uint64_t _prefix_size = std::numeric_limits<std::uint64_t>::max();
+    bool _profiling = false;
 
     std::vector<std::string> _loop_vars;
 };
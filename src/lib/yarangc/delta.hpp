@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <yaramod/yaramod.h>
+
+#include <yarangc/optimizer.hpp>
+
+struct RulesetDelta
+{
+    // Rules which were added, modified or depend on added or modified rules so their results can differ
+    std::unordered_set<std::string> changed;
+    // Rules which are present only in the base ruleset
+    std::vector<std::string> deleted;
+};
+
+// Compares rules between already deployed base ruleset and the new one. Results of a rule can only change if its
+// own text changed or if anything it references changed. Change of any global rule affects all the rules of its namespace.
+inline RulesetDelta compute_delta(const RuleList& base, const RuleList& current)
+{
+    RulesetDelta result;
+
+    std::unordered_map<std::string, std::string> base_texts;
+    for (const auto& rule : base)
+        base_texts.emplace(rule->getName(), rule->getText());
+
+    std::unordered_set<std::string> current_names;
+    for (const auto& rule : current)
+        current_names.insert(rule->getName());
+
+    std::unordered_set<std::string> globals_changed;
+    for (const auto& rule : base)
+    {
+        if (!current_names.contains(rule->getName()))
+        {
+            result.deleted.push_back(rule->getName());
+            if (rule->isGlobal())
+                globals_changed.insert(get_rule_namespace(rule->getName()));
+        }
+    }
+
+    ConstantTable constants;
+    ReferenceCollector collector(&constants, &current_names);
+
+    // Rules can only reference rules declared before them so single pass in declaration order is enough
+    for (const auto& rule : current)
+    {
+        auto itr = base_texts.find(rule->getName());
+        bool changed = itr == base_texts.end() || itr->second != rule->getText();
+        if (changed && rule->isGlobal())
+            globals_changed.insert(get_rule_namespace(rule->getName()));
+
+        for (const auto& [dependency, sites] : collector.collect(rule.get()).rules)
+            changed = changed || result.changed.contains(dependency);
+
+        if (changed)
+            result.changed.insert(rule->getName());
+    }
+
+    for (const auto& rule : current)
+    {
+        if (globals_changed.contains(get_rule_namespace(rule->getName())))
+            result.changed.insert(rule->getName());
+    }
+
+    return result;
+}
+
+inline RulesetDelta compute_delta(const yaramod::YaraFile* base, const yaramod::YaraFile* current)
+{
+    return compute_delta(base->getRules(), current->getRules());
+}
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_set>
+
+#include <yarangc/externals.hpp>
+
+namespace {
+
+bool is_identifier_start(char ch)
+{
+    return std::isalpha(static_cast<unsigned char>(ch)) || ch == '_';
+}
+
+bool is_identifier_char(char ch)
+{
+    return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_';
+}
+
+std::size_t skip_until(const std::string& source, std::size_t pos, const std::string& terminator)
+{
+    auto end = source.find(terminator, pos);
+    return end == std::string::npos ? source.length() : end + terminator.length();
+}
+
+std::size_t skip_quoted(const std::string& source, std::size_t pos, char quote)
+{
+    for (++pos; pos < source.length(); ++pos)
+    {
+        if (source[pos] == '\\')
+            ++pos;
+        else if (source[pos] == quote)
+            return pos + 1;
+    }
+    return source.length();
+}
+
+// Names which already mean something in conditions can't be bound
+const std::unordered_set<std::string> ReservedNames = {
+    "all", "and", "any", "ascii", "at", "base64", "base64wide", "condition", "contains", "defined", "endswith", "entrypoint",
+    "false", "filesize", "for", "fullword", "global", "icontains", "iendswith", "iequals", "import", "in", "include",
+    "int16", "int16be", "int32", "int32be", "int8", "int8be", "istartswith", "matches", "meta", "none", "nocase", "not",
+    "of", "or", "private", "rule", "startswith", "strings", "them", "true", "uint16", "uint16be", "uint32", "uint32be",
+    "uint8", "uint8be", "wide", "xor"
+};
+
+std::size_t skip_spaces(const std::string& source, std::size_t pos)
+{
+    while (pos < source.length() && std::isspace(static_cast<unsigned char>(source[pos])))
+        ++pos;
+    return pos;
+}
+
+std::size_t skip_identifier(const std::string& source, std::size_t pos)
+{
+    while (pos < source.length() && is_identifier_char(source[pos]))
+        ++pos;
+    return pos;
+}
+
+// Variables of loop 'for QUANTIFIER VAR[, VAR]... in' starting right after 'for', none for loops over strings
+std::vector<std::string> get_loop_variables(const std::string& source, std::size_t pos)
+{
+    pos = skip_spaces(source, pos);
+    pos = skip_identifier(source, pos);
+    if (pos < source.length() && source[pos] == '%')
+        ++pos;
+
+    std::vector<std::string> result;
+    while (true)
+    {
+        pos = skip_spaces(source, pos);
+        if (pos >= source.length() || !is_identifier_start(source[pos]))
+            return {};
+
+        auto end = skip_identifier(source, pos);
+        auto identifier = source.substr(pos, end - pos);
+        if (identifier == "in")
+            return result;
+        result.push_back(std::move(identifier));
+
+        pos = skip_spaces(source, end);
+        if (pos < source.length() && source[pos] == ',')
+            ++pos;
+    }
+}
+
+// Decimal or hexadecimal with 0x prefix like YARA's own -d, optionally negative
+std::optional<ExternalValue> parse_integer(const std::string& value)
+{
+    bool negative = !value.empty() && value[0] == '-';
+    auto digits = value.substr(negative ? 1 : 0);
+    int base = 10;
+    if (digits.length() > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X'))
+    {
+        digits = digits.substr(2);
+        base = 16;
+    }
+
+    auto is_digit = [&](char ch) {
+        return base == 16 ? std::isxdigit(static_cast<unsigned char>(ch)) : std::isdigit(static_cast<unsigned char>(ch));
+    };
+    if (digits.empty() || !std::all_of(digits.begin(), digits.end(), is_digit))
+        return std::nullopt;
+
+    try
+    {
+        auto number = std::stoull(digits, nullptr, base);
+        if (!negative || number == 0)
+            return ExternalValue{static_cast<std::uint64_t>(number)};
+        if (number <= static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()) + 1)
+            return ExternalValue{static_cast<std::int64_t>(0 - number)};
+    }
+    catch (const std::out_of_range&)
+    {
+    }
+    throw std::runtime_error("External variable value '" + value + "' is out of range");
+}
+
+const ExternalBinding* find_binding(const ExternalBindings& bindings, const std::string& name)
+{
+    auto itr = std::find_if(bindings.begin(), bindings.end(), [&](const auto& binding) {
+        return binding.name == name;
+    });
+    return itr != bindings.end() ? &*itr : nullptr;
+}
+
+}
+
+ExternalBinding parse_external_binding(const std::string& definition)
+{
+    auto pos = definition.find('=');
+    if (pos == std::string::npos || pos == 0)
+        throw std::runtime_error("External variable definition '" + definition + "' is not in form NAME=VALUE");
+
+    auto name = definition.substr(0, pos);
+    if (!is_identifier_start(name[0]) || !std::all_of(name.begin(), name.end(), is_identifier_char))
+        throw std::runtime_error("External variable name '" + name + "' is not a valid identifier");
+    if (ReservedNames.count(name))
+        throw std::runtime_error("External variable name '" + name + "' is a reserved word");
+
+    auto value = definition.substr(pos + 1);
+    if (value == "true" || value == "false")
+        return {std::move(name), value == "true"};
+
+    if (value.length() >= 2 && value.front() == '"' && value.back() == '"')
+        return {std::move(name), value.substr(1, value.length() - 2)};
+
+    if (auto number = parse_integer(value))
+        return {std::move(name), std::move(*number)};
+
+    return {std::move(name), std::move(value)};
+}
+
+std::string external_value_to_literal(const ExternalValue& value)
+{
+    if (auto bool_value = std::get_if<bool>(&value))
+        return *bool_value ? "true" : "false";
+    else if (auto int_value = std::get_if<std::uint64_t>(&value))
+        return std::to_string(*int_value);
+    else if (auto int_value = std::get_if<std::int64_t>(&value))
+        return std::to_string(*int_value);
+
+    std::string result = "\"";
+    for (auto ch : std::get<std::string>(value))
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            result += '\\';
+            result += ch;
+        }
+        else if (std::isprint(static_cast<unsigned char>(ch)))
+            result += ch;
+        else
+        {
+            char escaped[5];
+            std::snprintf(escaped, sizeof(escaped), "\\x%02X", static_cast<unsigned char>(ch));
+            result += escaped;
+        }
+    }
+    result += "\"";
+    return result;
+}
+
+std::string bind_externals(const std::string& source, const ExternalBindings& bindings)
+{
+    // Only identifiers inside of conditions are replaced so rule names, meta keys, string modifiers
+    // and contents of string literals, regular expressions and comments stay intact. YARA uses '\' for
+    // division so '/' always opens either comment or regular expression.
+    std::string result;
+    result.reserve(source.length());
+
+    std::size_t depth = 0;
+    bool in_condition = false;
+    // Loop variables shadow the externals in the whole condition which binds them
+    std::unordered_set<std::string> loop_variables;
+    for (std::size_t pos = 0; pos < source.length();)
+    {
+        auto ch = source[pos];
+        auto next = pos + 1 < source.length() ? source[pos + 1] : '\0';
+        std::size_t end = pos + 1;
+
+        if (ch == '/' && next == '/')
+            end = skip_until(source, pos, "\n");
+        else if (ch == '/' && next == '*')
+            end = skip_until(source, pos + 2, "*/");
+        else if (ch == '"' || ch == '/')
+        {
+            end = skip_quoted(source, pos, ch);
+            while (ch == '/' && end < source.length() && is_identifier_char(source[end]))
+                ++end;
+        }
+        else if (std::isdigit(static_cast<unsigned char>(ch)))
+        {
+            while (end < source.length() && is_identifier_char(source[end]))
+                ++end;
+        }
+        else if (ch == '{')
+            ++depth;
+        else if (ch == '}')
+        {
+            depth = depth > 0 ? depth - 1 : 0;
+            if (depth == 0)
+            {
+                in_condition = false;
+                loop_variables.clear();
+            }
+        }
+        else if (is_identifier_start(ch))
+        {
+            while (end < source.length() && is_identifier_char(source[end]))
+                ++end;
+
+            auto identifier = source.substr(pos, end - pos);
+            auto prev = pos > 0 ? source[pos - 1] : '\0';
+            auto after = source.find_first_not_of(" \t\r\n", end);
+            auto following = after != std::string::npos ? source[after] : '\0';
+
+            if (identifier == "condition" && depth == 1 && following == ':')
+                in_condition = true;
+            else if (in_condition && identifier == "for")
+            {
+                for (auto& variable : get_loop_variables(source, end))
+                    loop_variables.insert(std::move(variable));
+            }
+            else if (in_condition && !loop_variables.count(identifier) && std::string_view{"$#@!."}.find(prev) == std::string_view::npos && following != '.' && following != '(')
+            {
+                if (auto binding = find_binding(bindings, identifier))
+                {
+                    result += external_value_to_literal(binding->value);
+                    pos = end;
+                    continue;
+                }
+            }
+        }
+
+        result.append(source, pos, end - pos);
+        pos = end;
+    }
+
+    return result;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Negative integers are the only ones kept as signed
+using ExternalValue = std::variant<bool, std::uint64_t, std::int64_t, std::string>;
+
+struct ExternalBinding
+{
+    std::string name;
+    ExternalValue value;
+};
+
+using ExternalBindings = std::vector<ExternalBinding>;
+
+ExternalBinding parse_external_binding(const std::string& definition);
+std::string external_value_to_literal(const ExternalValue& value);
+std::string bind_externals(const std::string& source, const ExternalBindings& bindings);
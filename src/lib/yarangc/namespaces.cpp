@@ -0,0 +1,50 @@
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+#include <yarangc/namespaces.hpp>
+
+namespace {
+
+bool is_identifier_char(char ch)
+{
+    return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_';
+}
+
+bool is_identifier(const std::string& str)
+{
+    return !str.empty() && !std::isdigit(static_cast<unsigned char>(str[0])) && std::all_of(str.begin(), str.end(), is_identifier_char);
+}
+
+}
+
+RuleFile parse_rule_file(const std::string& spec)
+{
+    // Only identifiers are accepted as namespaces so paths containing colon can still be passed as they are
+    auto separator = spec.find(':');
+    if (separator == std::string::npos || !is_identifier(spec.substr(0, separator)))
+        return {{}, spec};
+
+    if (separator + 1 == spec.length())
+        throw std::runtime_error("Rule file of namespace " + spec.substr(0, separator) + " is missing its path");
+
+    return {spec.substr(0, separator), spec.substr(separator + 1)};
+}
+
+std::string qualify_rule_name(const std::string& ns, const std::string& rule)
+{
+    return ns.empty() ? rule : ns + ":" + rule;
+}
+
+std::string get_rule_namespace(const std::string& rule)
+{
+    auto separator = rule.rfind(':');
+    return separator == std::string::npos ? std::string{} : rule.substr(0, separator);
+}
+
+std::string to_identifier(const std::string& name)
+{
+    auto result = name;
+    std::replace_if(result.begin(), result.end(), [](char ch) { return !is_identifier_char(ch); }, '_');
+    return result;
+}
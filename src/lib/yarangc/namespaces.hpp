@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+// Rule file given on the command line as [NAMESPACE:]PATH
+struct RuleFile
+{
+    std::string ns;
+    std::string path;
+};
+
+RuleFile parse_rule_file(const std::string& spec);
+
+// Rules of each namespace are reported as NAMESPACE:RULE, rules without namespace keep their plain names
+std::string qualify_rule_name(const std::string& ns, const std::string& rule);
+std::string get_rule_namespace(const std::string& rule);
+
+// Turns possibly qualified rule name into something which can be used as a part of C++ identifier
+std::string to_identifier(const std::string& name);
@@ -0,0 +1,596 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include <yaramod/types/expressions.h>
+#include <yaramod/utils/observing_visitor.h>
+#include <yaramod/yaramod.h>
+
+#include <yarangc/namespaces.hpp>
+
+// Rules of all the compiled rule files in the order of declaration
+using RuleList = std::vector<std::shared_ptr<yaramod::Rule>>;
+
+using ConstantValue = std::variant<bool, std::uint64_t, std::string>;
+using ConstantTable = std::unordered_map<const yaramod::Expression*, ConstantValue>;
+
+class ConstantFolder : public yaramod::ObservingVisitor
+{
+public:
+    ConstantFolder(ConstantTable* constants) : _constants(constants)
+    {
+    }
+
+    void fold(const yaramod::Rule* rule)
+    {
+        observe(rule->getCondition());
+        _rule_conditions.emplace(rule->getName(), rule->getCondition().get());
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::AndExpression* expr) override
+    {
+        expr->getLeftOperand()->accept(this);
+        expr->getRightOperand()->accept(this);
+        auto lhs = get<bool>(expr->getLeftOperand()), rhs = get<bool>(expr->getRightOperand());
+        if ((lhs && !*lhs) || (rhs && !*rhs))
+            set(expr, false);
+        else if (lhs && rhs)
+            set(expr, true);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::OrExpression* expr) override
+    {
+        expr->getLeftOperand()->accept(this);
+        expr->getRightOperand()->accept(this);
+        auto lhs = get<bool>(expr->getLeftOperand()), rhs = get<bool>(expr->getRightOperand());
+        if ((lhs && *lhs) || (rhs && *rhs))
+            set(expr, true);
+        else if (lhs && rhs)
+            set(expr, false);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::NotExpression* expr) override
+    {
+        expr->getOperand()->accept(this);
+        if (auto value = get<bool>(expr->getOperand()))
+            set(expr, !*value);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ParenthesesExpression* expr) override
+    {
+        expr->getEnclosedExpression()->accept(this);
+        if (auto itr = _constants->find(expr->getEnclosedExpression().get()); itr != _constants->end())
+            set(expr, itr->second);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::PlusExpression* expr) override
+    {
+        fold_binary(expr, std::plus<std::uint64_t>{});
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::MinusExpression* expr) override
+    {
+        fold_binary(expr, std::minus<std::uint64_t>{});
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::MultiplyExpression* expr) override
+    {
+        fold_binary(expr, std::multiplies<std::uint64_t>{});
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ModuloExpression* expr) override
+    {
+        expr->getLeftOperand()->accept(this);
+        expr->getRightOperand()->accept(this);
+        auto lhs = get<std::uint64_t>(expr->getLeftOperand()), rhs = get<std::uint64_t>(expr->getRightOperand());
+        if (lhs && rhs && *rhs != 0)
+            set(expr, *lhs % *rhs);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::BitwiseAndExpression* expr) override
+    {
+        fold_binary(expr, std::bit_and<std::uint64_t>{});
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::BitwiseXorExpression* expr) override
+    {
+        fold_binary(expr, std::bit_xor<std::uint64_t>{});
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::EqExpression* expr) override
+    {
+        fold_equality(expr, true);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::NeqExpression* expr) override
+    {
+        fold_equality(expr, false);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ContainsExpression* expr) override
+    {
+        expr->getLeftOperand()->accept(this);
+        expr->getRightOperand()->accept(this);
+        auto lhs = get<std::string>(expr->getLeftOperand()), rhs = get<std::string>(expr->getRightOperand());
+        if (lhs && rhs)
+            set(expr, lhs->find(*rhs) != std::string::npos);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::LtExpression* expr) override
+    {
+        fold_binary(expr, std::less<std::uint64_t>{});
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::LeExpression* expr) override
+    {
+        fold_binary(expr, std::less_equal<std::uint64_t>{});
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::GtExpression* expr) override
+    {
+        fold_binary(expr, std::greater<std::uint64_t>{});
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::GeExpression* expr) override
+    {
+        fold_binary(expr, std::greater_equal<std::uint64_t>{});
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ForStringExpression* expr) override
+    {
+        ObservingVisitor::visit(expr);
+        fold_loop(expr);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ForArrayExpression* expr) override
+    {
+        _loop_vars.push_back(expr->getId());
+        ObservingVisitor::visit(expr);
+        _loop_vars.pop_back();
+        fold_loop(expr);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::IdExpression* expr) override
+    {
+        const auto& name = expr->getSymbol()->getName();
+        if (std::find(_loop_vars.begin(), _loop_vars.end(), name) != _loop_vars.end())
+            return {};
+
+        if (auto rule_itr = _rule_conditions.find(name); rule_itr != _rule_conditions.end())
+        {
+            if (auto itr = _constants->find(rule_itr->second); itr != _constants->end())
+                set(expr, itr->second);
+        }
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::IntLiteralExpression* expr) override
+    {
+        set(expr, static_cast<std::uint64_t>(expr->getValue()));
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::BoolLiteralExpression* expr) override
+    {
+        set(expr, expr->getValue());
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringLiteralExpression* expr) override
+    {
+        set(expr, std::string{expr->getValue()});
+        return {};
+    }
+
+private:
+    template <typename T>
+    std::optional<T> get(const yaramod::Expression::Ptr& expr) const
+    {
+        auto itr = _constants->find(expr.get());
+        if (itr == _constants->end() || !std::holds_alternative<T>(itr->second))
+            return std::nullopt;
+        return std::get<T>(itr->second);
+    }
+
+    void set(const yaramod::Expression* expr, ConstantValue value)
+    {
+        _constants->insert_or_assign(expr, std::move(value));
+    }
+
+    template <typename Op>
+    void fold_binary(yaramod::BinaryOpExpression* expr, const Op& op)
+    {
+        expr->getLeftOperand()->accept(this);
+        expr->getRightOperand()->accept(this);
+        auto lhs = get<std::uint64_t>(expr->getLeftOperand()), rhs = get<std::uint64_t>(expr->getRightOperand());
+        if (lhs && rhs)
+            set(expr, op(*lhs, *rhs));
+    }
+
+    void fold_equality(yaramod::BinaryOpExpression* expr, bool equal)
+    {
+        expr->getLeftOperand()->accept(this);
+        expr->getRightOperand()->accept(this);
+        auto lhs = _constants->find(expr->getLeftOperand().get()), rhs = _constants->find(expr->getRightOperand().get());
+        if (lhs != _constants->end() && rhs != _constants->end() && lhs->second.index() == rhs->second.index())
+            set(expr, (lhs->second == rhs->second) == equal);
+    }
+
+    void fold_loop(yaramod::ForExpression* expr)
+    {
+        // Loops always require at least one hit so body which never holds means the whole loop never holds
+        if (auto body = get<bool>(expr->getBody()); body && !*body)
+            set(expr, false);
+    }
+
+    ConstantTable* _constants;
+    std::unordered_map<std::string, const yaramod::Expression*> _rule_conditions;
+    std::vector<std::string> _loop_vars;
+};
+
+struct RuleReferences
+{
+    std::unordered_set<std::string> strings;
+    // Referenced rule -> number of places in condition which reference it
+    std::unordered_map<std::string, std::size_t> rules;
+    // Referenced rules which are evaluated in a body of a loop
+    std::unordered_set<std::string> rules_in_loops;
+    std::unordered_set<std::string> mutexes;
+};
+
+class ReferenceCollector : public yaramod::ObservingVisitor
+{
+public:
+    ReferenceCollector(const ConstantTable* constants, const std::unordered_set<std::string>* rule_names) : _constants(constants), _rule_names(rule_names)
+    {
+    }
+
+    RuleReferences collect(const yaramod::Rule* rule)
+    {
+        _rule = rule;
+        _references = RuleReferences{};
+        if (!is_folded(rule->getCondition().get()))
+            observe(rule->getCondition());
+        return std::move(_references);
+    }
+
+    // Subexpressions which were folded into constants are never going to be evaluated so we don't descend into them
+    virtual yaramod::VisitResult visit(yaramod::AndExpression* expr) override
+    {
+        return is_folded(expr) ? yaramod::VisitResult{} : ObservingVisitor::visit(expr);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::OrExpression* expr) override
+    {
+        return is_folded(expr) ? yaramod::VisitResult{} : ObservingVisitor::visit(expr);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::NotExpression* expr) override
+    {
+        return is_folded(expr) ? yaramod::VisitResult{} : ObservingVisitor::visit(expr);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ParenthesesExpression* expr) override
+    {
+        return is_folded(expr) ? yaramod::VisitResult{} : ObservingVisitor::visit(expr);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ForStringExpression* expr) override
+    {
+        if (!is_folded(expr))
+            visit_loop(expr);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ForArrayExpression* expr) override
+    {
+        if (is_folded(expr))
+            return {};
+
+        _loop_vars.push_back(expr->getId());
+        visit_loop(expr);
+        _loop_vars.pop_back();
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringExpression* expr) override
+    {
+        add_string(expr->getId());
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringWildcardExpression* expr) override
+    {
+        auto key = expr->getId();
+        for (const auto& string : _rule->getStringsTrie()->getValuesWithPrefix(key.substr(0, key.length() - 1)))
+            _references.strings.insert(string->getIdentifier());
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringAtExpression* expr) override
+    {
+        add_string(expr->getId());
+        return ObservingVisitor::visit(expr);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringInRangeExpression* expr) override
+    {
+        add_string(expr->getId());
+        return ObservingVisitor::visit(expr);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringCountExpression* expr) override
+    {
+        add_string("$" + expr->getId().substr(1));
+        return ObservingVisitor::visit(expr);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringOffsetExpression* expr) override
+    {
+        add_string("$" + expr->getId().substr(1));
+        return ObservingVisitor::visit(expr);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringLengthExpression* expr) override
+    {
+        add_string("$" + expr->getId().substr(1));
+        return ObservingVisitor::visit(expr);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::ThemExpression*) override
+    {
+        for (const auto& string : _rule->getStrings())
+            _references.strings.insert(string->getIdentifier());
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::IdExpression* expr) override
+    {
+        const auto& name = expr->getSymbol()->getName();
+        if (is_folded(expr) || std::find(_loop_vars.begin(), _loop_vars.end(), name) != _loop_vars.end())
+            return {};
+
+        if (_rule_names->contains(name))
+        {
+            _references.rules[name]++;
+            if (_loop_depth > 0)
+                _references.rules_in_loops.insert(name);
+        }
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::FunctionCallExpression* expr) override
+    {
+        if (expr->getFunction()->getText() == "cuckoo.sync.mutex")
+            _references.mutexes.insert(expr->getArguments()[0]->as<yaramod::RegexpExpression>()->getRegexpString()->getPureText());
+        else
+        {
+            for (auto&& arg : expr->getArguments())
+                arg->accept(this);
+        }
+
+        return {};
+    }
+
+private:
+    bool is_folded(const yaramod::Expression* expr) const
+    {
+        return _constants->contains(expr);
+    }
+
+    // Quantifier and iterated set are evaluated once, the body once per iteration
+    void visit_loop(yaramod::ForExpression* expr)
+    {
+        expr->getVariable()->accept(this);
+        expr->getIterable()->accept(this);
+        _loop_depth++;
+        expr->getBody()->accept(this);
+        _loop_depth--;
+    }
+
+    void add_string(const std::string& id)
+    {
+        // Anonymous string references inside of loops point to the strings of the loop itself
+        if (id.length() > 1)
+            _references.strings.insert(id);
+    }
+
+    const ConstantTable* _constants;
+    const std::unordered_set<std::string>* _rule_names;
+    const yaramod::Rule* _rule;
+    RuleReferences _references;
+    std::vector<std::string> _loop_vars;
+    std::size_t _loop_depth = 0;
+};
+
+enum class RemovalReason
+{
+    Unreachable,
+    AlwaysFalse,
+    AlwaysTrue,
+    GatedByGlobal,
+    Unchanged
+};
+
+struct RemovedRule
+{
+    std::string name;
+    RemovalReason reason;
+};
+
+struct RemovedString
+{
+    std::string rule;
+    std::string id;
+};
+
+class Optimizer
+{
+public:
+    // Restricts public rules which are reported to the given ones. Other public rules are either removed or only kept
+    // as dependencies of the reported ones. Used for delta rulesets.
+    void set_reported_rules(std::unordered_set<std::string> rules)
+    {
+        _reported_rules = std::move(rules);
+    }
+
+    void optimize(const yaramod::YaraFile* yara_file)
+    {
+        optimize(yara_file->getRules());
+    }
+
+    void optimize(const RuleList& rules)
+    {
+        ConstantFolder folder(&_constants);
+        std::unordered_set<std::string> rule_names;
+        for (const auto& rule : rules)
+        {
+            folder.fold(rule.get());
+            rule_names.insert(rule->getName());
+        }
+
+        ReferenceCollector collector(&_constants, &rule_names);
+        for (const auto& rule : rules)
+            _references.emplace(rule->getName(), collector.collect(rule.get()));
+
+        // Global rule which never holds means that no other rule of its namespace can ever match
+        std::unordered_set<std::string> gated_namespaces;
+        for (const auto& rule : rules)
+        {
+            if (rule->isGlobal() && !get_folded_bool(rule->getCondition().get()).value_or(true))
+                gated_namespaces.insert(get_rule_namespace(rule->getName()));
+        }
+
+        // Public and global rules are the only ones which can be observed from the outside so everything
+        // which can't be reached from them through rule references is dead. Private global rules which
+        // always hold don't gate anything.
+        std::vector<std::string> worklist;
+        for (const auto& rule : rules)
+        {
+            auto condition = get_folded_bool(rule->getCondition().get());
+            if (gated_namespaces.contains(get_rule_namespace(rule->getName())) || (rule->isGlobal() && rule->isPrivate() && condition.value_or(false)))
+                continue;
+
+            if ((is_rule_reported(rule.get()) || rule->isGlobal()) && condition.value_or(true))
+            {
+                _alive_rules.insert(rule->getName());
+                worklist.push_back(rule->getName());
+            }
+        }
+
+        while (!worklist.empty())
+        {
+            auto name = std::move(worklist.back());
+            worklist.pop_back();
+            for (const auto& [dependency, sites] : _references.at(name).rules)
+            {
+                if (_alive_rules.insert(dependency).second)
+                    worklist.push_back(dependency);
+            }
+        }
+
+        for (const auto& rule : rules)
+        {
+            if (!is_rule_alive(rule->getName()))
+            {
+                auto globals_hold = !gated_namespaces.contains(get_rule_namespace(rule->getName()));
+                _removed_rules.push_back({rule->getName(), get_removal_reason(rule.get(), globals_hold)});
+                continue;
+            }
+
+            for (const auto& string : rule->getStrings())
+            {
+                if (!is_string_alive(rule->getName(), string->getIdentifier()))
+                    _removed_strings.push_back({rule->getName(), string->getIdentifier()});
+            }
+        }
+    }
+
+    bool is_rule_alive(const std::string& rule) const
+    {
+        return _alive_rules.contains(rule);
+    }
+
+    bool is_rule_reported(const yaramod::Rule* rule) const
+    {
+        return !rule->isPrivate() && (!_reported_rules || _reported_rules->contains(rule->getName()));
+    }
+
+    bool is_string_alive(const std::string& rule, const std::string& id) const
+    {
+        auto itr = _references.find(rule);
+        return itr != _references.end() && itr->second.strings.contains(id);
+    }
+
+    bool is_mutex_alive(const std::string& rule, const std::string& pattern) const
+    {
+        auto itr = _references.find(rule);
+        return itr != _references.end() && itr->second.mutexes.contains(pattern);
+    }
+
+    std::optional<bool> get_folded_bool(const yaramod::Expression* expr) const
+    {
+        auto itr = _constants.find(expr);
+        if (itr == _constants.end() || !std::holds_alternative<bool>(itr->second))
+            return std::nullopt;
+        return std::get<bool>(itr->second);
+    }
+
+    std::optional<std::uint64_t> get_folded_int(const yaramod::Expression* expr) const
+    {
+        auto itr = _constants.find(expr);
+        if (itr == _constants.end() || !std::holds_alternative<std::uint64_t>(itr->second))
+            return std::nullopt;
+        return std::get<std::uint64_t>(itr->second);
+    }
+
+    const RuleReferences& get_references(const std::string& rule) const { return _references.at(rule); }
+    const std::vector<RemovedRule>& get_removed_rules() const { return _removed_rules; }
+    const std::vector<RemovedString>& get_removed_strings() const { return _removed_strings; }
+
+private:
+    RemovalReason get_removal_reason(const yaramod::Rule* rule, bool globals_hold) const
+    {
+        auto condition = get_folded_bool(rule->getCondition().get());
+        if (rule->isGlobal() && condition)
+            return *condition ? RemovalReason::AlwaysTrue : RemovalReason::AlwaysFalse;
+        else if (!globals_hold)
+            return RemovalReason::GatedByGlobal;
+        else if (!rule->isPrivate() && !is_rule_reported(rule))
+            return RemovalReason::Unchanged;
+        return rule->isPrivate() ? RemovalReason::Unreachable : RemovalReason::AlwaysFalse;
+    }
+
+    std::optional<std::unordered_set<std::string>> _reported_rules;
+    ConstantTable _constants;
+    std::unordered_map<std::string, RuleReferences> _references;
+    std::unordered_set<std::string> _alive_rules;
+    std::vector<RemovedRule> _removed_rules;
+    std::vector<RemovedString> _removed_strings;
+};
@@ -5,7 +5,9 @@
 #include <yaramod/yaramod.h>
 
 #include <yarangc/conversion.hpp>
+#include <yarangc/optimizer.hpp>
 #include <yarangc/pattern.hpp>
+#include <yarangc/thread_pool.hpp>
 
 using StringInfoTable = std::unordered_map<std::string, std::uint64_t>;
 
@@ -49,71 +51,79 @@ struct RuleInfo
 
 using RuleInfoTable = std::unordered_map<std::string, RuleInfo>;
 
-class PatternExtractor : public yaramod::ObservingVisitor
+// Collects patterns of cuckoo.sync.mutex calls in the order in which they appear in the condition
+class MutexCollector : public yaramod::ObservingVisitor
 {
 public:
+    std::vector<std::string> collect(const yaramod::Rule* rule)
+    {
+        _mutexes.clear();
+        observe(rule->getCondition());
+        return std::move(_mutexes);
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::FunctionCallExpression* expr) override
+    {
+        if (expr->getFunction()->getText() == "cuckoo.sync.mutex")
+            _mutexes.push_back(expr->getArguments()[0]->as<yaramod::RegexpExpression>()->getRegexpString()->getPureText());
+        else
+        {
+            for (auto&& arg : expr->getArguments())
+                arg->accept(this);
+        }
+
+        return {};
+    }
+
+private:
+    std::vector<std::string> _mutexes;
+};
+
+class PatternExtractor
+{
+public:
+    PatternExtractor(const Optimizer* optimizer = nullptr, ThreadPool* thread_pool = nullptr) : _optimizer(optimizer), _thread_pool(thread_pool)
+    {
+    }
+
     void extract(const yaramod::YaraFile* yara_file)
     {
-        std::uint64_t rule_index = 0;
-        for (auto& rule : yara_file->getRules())
+        extract(yara_file->getRules());
+    }
+
+    // Patterns are deduplicated across all the given rules so the same string used in multiple rule files
+    // is matched only once
+    void extract(const RuleList& all_rules)
+    {
+        std::vector<const yaramod::Rule*> rules;
+        for (auto& rule : all_rules)
         {
-            auto [rule_info_itr, rule_inserted] = _rule_info_table.emplace(rule->getName(), RuleInfo{rule_index, rule.get(), {}, {}});
-            auto& rule_info = rule_info_itr->second;
-
-            std::uint64_t literal_index = 0, regex_index = 0;
-            for (const auto& string : rule->getStrings())
-            {
-                if (string->isPlain())
-                {
-                    auto pattern = string->getPureText();
-                    auto [itr, inserted] = _literal_cache.emplace(pattern, literal_index);
-                    if (inserted)
-                        _literal_patterns.emplace_back(std::make_unique<Pattern>(PatternType::Literal, std::move(pattern), rule->getName(), string->getIdentifier()));
-                    rule_info.literal_strings.emplace(string->getIdentifier(), inserted ? literal_index++ : itr->second);
-
-                }
-                else if (string->isRegexp())
-                {
-                    auto pattern = string->getPureText();
-                    auto [itr, inserted] = _regex_cache.emplace(pattern, regex_index);
-                    if (inserted)
-                        _regex_patterns.emplace_back(std::make_unique<Pattern>(PatternType::Regex, std::move(pattern), rule->getName(), string->getIdentifier()));
-                    rule_info.regex_strings.emplace(string->getIdentifier(), inserted ? regex_index++ : itr->second);
-                }
-                else if (string->isHex())
-                {
-                    auto pattern = hex_string_to_pattern(rule->getName(), *static_cast<const yaramod::HexString*>(string));
-                    if (pattern->is_literal())
-                    {
-                        auto [itr, inserted] = _literal_cache.emplace(pattern->get_pattern(), literal_index);
-                        if (inserted)
-                            _literal_patterns.emplace_back(std::move(pattern));
-                        rule_info.literal_strings.emplace(string->getIdentifier(), inserted ? literal_index++ : itr->second);
-                    }
-                    else if (pattern->is_regex())
-                    {
-                        auto [itr, inserted] = _regex_cache.emplace(pattern->get_pattern(), regex_index);
-                        if (inserted)
-                            _regex_patterns.emplace_back(std::move(pattern));
-                        rule_info.regex_strings.emplace(string->getIdentifier(), inserted ? regex_index++ : itr->second);
-                    }
-                }
-            }
-
-            _current_rule_info = &rule_info;
-            observe(rule->getCondition());
-
-            rule_index++;
+            if (!_optimizer || _optimizer->is_rule_alive(rule->getName()))
+                rules.push_back(rule.get());
         }
 
-        // Fix literal indices
-        auto total_regex_size = std::accumulate(_rule_info_table.begin(), _rule_info_table.end(), static_cast<std::size_t>(0), [](std::size_t sum, const auto& rule_info) {
-            return sum + rule_info.second.regex_strings.size();
-        });
+        // Conversion of strings into patterns is independent for each rule so it can run in parallel. IDs are
+        // then assigned sequentially in the order of declaration so they are the same regardless of the thread count.
+        std::vector<ExtractedRule> extracted(rules.size());
+        auto extract_range = [&](std::size_t begin, std::size_t end) {
+            MutexCollector mutex_collector;
+            for (auto i = begin; i < end; ++i)
+                extracted[i] = extract_rule(rules[i], mutex_collector);
+        };
+
+        if (_thread_pool)
+            _thread_pool->parallel_for(rules.size(), extract_range);
+        else
+            extract_range(0, rules.size());
+
+        for (std::size_t i = 0; i < rules.size(); ++i)
+            merge_rule(rules[i], std::move(extracted[i]));
+
+        // Fix literal indices, literal database is compiled with IDs following the regex database
         for (auto& [rule_name, rule_info] : _rule_info_table)
         {
             for (auto& [string_id, string_info] : rule_info.literal_strings)
-                string_info += total_regex_size;
+                string_info += _regex_patterns.size();
         }
     }
 
@@ -124,29 +134,73 @@ public:
     const std::vector<std::unique_ptr<Pattern>>& get_regex_patterns() const { return _regex_patterns; }
     const std::vector<std::unique_ptr<Pattern>>& get_mutex_patterns() const { return _mutexes; }
 
-    virtual yaramod::VisitResult visit(yaramod::FunctionCallExpression* expr) override
+private:
+    struct ExtractedRule
     {
-        if (expr->getFunction()->getText() == "cuckoo.sync.mutex")
+        std::vector<std::pair<std::string, std::unique_ptr<Pattern>>> strings;
+        std::vector<std::string> mutexes;
+    };
+
+    ExtractedRule extract_rule(const yaramod::Rule* rule, MutexCollector& mutex_collector) const
+    {
+        ExtractedRule result;
+        for (const auto& string : rule->getStrings())
         {
-            auto pattern = expr->getArguments()[0]->as<yaramod::RegexpExpression>()->getRegexpString()->getPureText();
-            auto mutex_idx = _mutexes.size();
-            auto [itr, inserted] = _mutex_cache.emplace(pattern, mutex_idx);
-            if (inserted)
-                _mutexes.emplace_back(std::make_unique<Pattern>(PatternType::Regex, pattern, _current_rule_info->rule->getName(), pattern));
-            _current_rule_info->mutexes.emplace(std::move(pattern), inserted ? mutex_idx : itr->second);
+            if (_optimizer && !_optimizer->is_string_alive(rule->getName(), string->getIdentifier()))
+                continue;
+
+            std::unique_ptr<Pattern> pattern;
+            if (string->isPlain())
+                pattern = std::make_unique<Pattern>(PatternType::Literal, string->getPureText(), rule->getName(), string->getIdentifier());
+            else if (string->isRegexp())
+                pattern = std::make_unique<Pattern>(PatternType::Regex, string->getPureText(), rule->getName(), string->getIdentifier());
+            else if (string->isHex())
+                pattern = hex_string_to_pattern(rule->getName(), *static_cast<const yaramod::HexString*>(string));
+
+            if (pattern)
+                result.strings.emplace_back(string->getIdentifier(), std::move(pattern));
         }
-        else
+
+        for (auto& mutex : mutex_collector.collect(rule))
         {
-            for (auto&& arg : expr->getArguments())
-                arg->accept(this);
+            if (!_optimizer || _optimizer->is_mutex_alive(rule->getName(), mutex))
+                result.mutexes.push_back(std::move(mutex));
         }
 
-        return {};
+        return result;
     }
 
-private:
+    void merge_rule(const yaramod::Rule* rule, ExtractedRule&& extracted)
+    {
+        auto [rule_info_itr, rule_inserted] = _rule_info_table.emplace(rule->getName(), RuleInfo{_rule_info_table.size(), rule, {}, {}});
+        auto& rule_info = rule_info_itr->second;
+
+        for (auto& [id, pattern] : extracted.strings)
+        {
+            if (pattern->is_literal())
+                rule_info.literal_strings.emplace(id, add_pattern(_literal_patterns, _literal_cache, std::move(pattern)));
+            else if (pattern->is_regex())
+                rule_info.regex_strings.emplace(id, add_pattern(_regex_patterns, _regex_cache, std::move(pattern)));
+        }
+
+        for (auto& mutex : extracted.mutexes)
+        {
+            auto mutex_id = add_pattern(_mutexes, _mutex_cache, std::make_unique<Pattern>(PatternType::Regex, mutex, rule->getName(), mutex));
+            rule_info.mutexes.emplace(std::move(mutex), mutex_id);
+        }
+    }
+
+    static std::uint64_t add_pattern(std::vector<std::unique_ptr<Pattern>>& patterns, std::unordered_map<std::string, std::uint64_t>& cache, std::unique_ptr<Pattern>&& pattern)
+    {
+        auto [itr, inserted] = cache.emplace(pattern->get_pattern(), patterns.size());
+        if (inserted)
+            patterns.push_back(std::move(pattern));
+        return itr->second;
+    }
+
+    const Optimizer* _optimizer;
+    ThreadPool* _thread_pool;
     RuleInfoTable _rule_info_table;
-    RuleInfo* _current_rule_info;
     std::vector<std::unique_ptr<Pattern>> _literal_patterns, _regex_patterns;
     std::vector<std::unique_ptr<Pattern>> _mutexes;
     std::unordered_map<std::string, std::uint64_t> _literal_cache, _regex_cache;
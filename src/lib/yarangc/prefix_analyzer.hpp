@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <yaramod/types/expressions.h>
+#include <yaramod/utils/observing_visitor.h>
+#include <yaramod/yaramod.h>
+
+#include <yarangc/optimizer.hpp>
+#include <yarangc/pattern_extractor.hpp>
+
+// Finds out how many bytes from the start of the data the rules can ever observe. Strings which are only looked for
+// at constant offsets or in constant ranges and integers read at constant offsets need nothing past them, so rulesets
+// which only look at headers of files don't need the rest of the files read at all. Anything else, like plain string
+// matches, counts or offsets of matches and reads at computed offsets, needs the whole data.
+class PrefixAnalyzer : public yaramod::ObservingVisitor
+{
+public:
+    static constexpr std::uint64_t WholeData = std::numeric_limits<std::uint64_t>::max();
+    // Bytes after a match which word boundaries and end anchors look at, same as the overlap of parallel scan chunks
+    static constexpr std::uint64_t MatchContext = 2;
+
+    // Widths are the longest matches of the patterns indexed by their IDs, WholeData for unbounded ones
+    PrefixAnalyzer(const PatternExtractor* pattern_extractor, const Optimizer* optimizer, std::vector<std::uint64_t> pattern_widths)
+        : _pattern_extractor(pattern_extractor), _optimizer(optimizer), _pattern_widths(std::move(pattern_widths)), _rule_info(nullptr), _prefix_size(0), _loop_string_width(WholeData)
+    {
+    }
+
+    std::uint64_t analyze(const yaramod::YaraFile* yara_file)
+    {
+        return analyze(yara_file->getRules());
+    }
+
+    std::uint64_t analyze(const RuleList& rules)
+    {
+        _prefix_size = 0;
+        const auto& rule_info_table = _pattern_extractor->get_rule_info_table();
+        for (const auto& rule : rules)
+        {
+            // Rules folded into constants are never evaluated
+            auto itr = rule_info_table.find(rule->getName());
+            if (itr == rule_info_table.end() || get_folded_bool(rule->getCondition().get()).has_value())
+                continue;
+
+            _rule_info = &itr->second;
+            observe(rule->getCondition());
+            if (_prefix_size == WholeData)
+                break;
+        }
+
+        return _prefix_size;
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringExpression*) override
+    {
+        require(WholeData);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringCountExpression*) override
+    {
+        require(WholeData);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringOffsetExpression*) override
+    {
+        require(WholeData);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringLengthExpression*) override
+    {
+        require(WholeData);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::OfExpression*) override
+    {
+        require(WholeData);
+        return {};
+    }
+
+    // Anonymous strings in the body stand for each string of the set in turn
+    virtual yaramod::VisitResult visit(yaramod::ForStringExpression* expr) override
+    {
+        std::vector<std::uint64_t> ids;
+        if (dynamic_cast<yaramod::ThemExpression*>(expr->getIterable().get()))
+        {
+            for (const auto* string : _rule_info->rule->getStrings())
+                ids.push_back(_rule_info->get_string_id(string->getIdentifier()));
+        }
+        else if (auto set_expr = dynamic_cast<yaramod::SetExpression*>(expr->getIterable().get()))
+        {
+            for (auto& elem_expr : set_expr->getElements())
+            {
+                if (auto str_expr = dynamic_cast<yaramod::StringExpression*>(elem_expr.get()))
+                    ids.push_back(_rule_info->get_string_id(str_expr->getId()));
+                else if (auto str_expr = dynamic_cast<yaramod::StringWildcardExpression*>(elem_expr.get()))
+                {
+                    auto wildcard_ids = _rule_info->get_string_wildcard_ids(str_expr->getId());
+                    ids.insert(ids.end(), wildcard_ids.begin(), wildcard_ids.end());
+                }
+            }
+        }
+
+        std::uint64_t width = 0;
+        for (auto id : ids)
+            width = std::max(width, get_pattern_width(id));
+
+        auto outer_width = std::exchange(_loop_string_width, width);
+        expr->getBody()->accept(this);
+        _loop_string_width = outer_width;
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringAtExpression* expr) override
+    {
+        auto at = get_folded_int(expr->getAtExpression().get());
+        require(at ? add(add(*at, get_string_width(expr->getId())), MatchContext) : WholeData);
+        expr->getAtExpression()->accept(this);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::StringInRangeExpression* expr) override
+    {
+        auto range_expr = dynamic_cast<yaramod::RangeExpression*>(expr->getRangeExpression().get());
+        auto high = range_expr ? get_folded_int(range_expr->getHigh().get()) : std::nullopt;
+        require(high ? add(add(*high, get_string_width(expr->getId())), MatchContext) : WholeData);
+        expr->getRangeExpression()->accept(this);
+        return {};
+    }
+
+    virtual yaramod::VisitResult visit(yaramod::IntFunctionExpression* expr) override
+    {
+        auto offset = get_folded_int(expr->getArgument().get());
+        require(offset ? add(*offset, get_int_size(expr->getFunction())) : WholeData);
+        expr->getArgument()->accept(this);
+        return {};
+    }
+
+private:
+    void require(std::uint64_t size)
+    {
+        _prefix_size = std::max(_prefix_size, size);
+    }
+
+    static std::uint64_t add(std::uint64_t lhs, std::uint64_t rhs)
+    {
+        return lhs > WholeData - rhs ? WholeData : lhs + rhs;
+    }
+
+    // Size in bytes of integer read by functions like uint16 or int32be
+    static std::uint64_t get_int_size(const std::string& function)
+    {
+        std::uint64_t bits = 0;
+        for (auto ch : function)
+        {
+            if (std::isdigit(static_cast<unsigned char>(ch)))
+                bits = bits * 10 + (ch - '0');
+        }
+        return bits / 8;
+    }
+
+    std::uint64_t get_pattern_width(std::uint64_t id) const
+    {
+        return id < _pattern_widths.size() ? _pattern_widths[id] : WholeData;
+    }
+
+    std::uint64_t get_string_width(const std::string& id) const
+    {
+        return id == "$" ? _loop_string_width : get_pattern_width(_rule_info->get_string_id(id));
+    }
+
+    std::optional<bool> get_folded_bool(const yaramod::Expression* expr) const
+    {
+        return _optimizer ? _optimizer->get_folded_bool(expr) : std::nullopt;
+    }
+
+    std::optional<std::uint64_t> get_folded_int(const yaramod::Expression* expr) const
+    {
+        if (auto int_expr = dynamic_cast<const yaramod::IntLiteralExpression*>(expr))
+            return static_cast<std::uint64_t>(int_expr->getValue());
+        return _optimizer ? _optimizer->get_folded_int(expr) : std::nullopt;
+    }
+
+    const PatternExtractor* _pattern_extractor;
+    const Optimizer* _optimizer;
+    std::vector<std::uint64_t> _pattern_widths;
+    const RuleInfo* _rule_info;
+    std::uint64_t _prefix_size;
+    // Longest match of the strings iterated by the innermost for-of loop
+    std::uint64_t _loop_string_width;
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+#include <yaramod/types/expressions.h>
+
+// Number of elements which need to satisfy 'any', 'all' or 'N' of loops and of expressions over total_count elements.
+// Both backends use it so they agree on the results. Other quantifiers like 'none', percentages or computed counts
+// are rejected instead of silently evaluated differently.
+inline std::uint64_t get_required_count(const yaramod::Expression* var_expr, std::uint64_t total_count)
+{
+    if (dynamic_cast<const yaramod::AnyExpression*>(var_expr))
+        return 1;
+    else if (dynamic_cast<const yaramod::AllExpression*>(var_expr))
+        return total_count;
+    else if (auto int_expr = dynamic_cast<const yaramod::IntLiteralExpression*>(var_expr))
+        return std::max(static_cast<std::uint64_t>(1), std::min(total_count, static_cast<std::uint64_t>(int_expr->getValue())));
+
+    throw std::runtime_error("Unsupported quantifier '" + var_expr->getText() + "'");
+}
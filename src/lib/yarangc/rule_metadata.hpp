@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <yaramod/types/expressions.h>
+
+#include <yarangc/namespaces.hpp>
+#include <yarangc/pattern_extractor.hpp>
+
+// Description of a reported rule which rulesets export so hits can be interpreted without a separate copy of the rules
+struct RuleMetadata
+{
+    std::string ns;
+    std::vector<std::string> tags;
+    std::vector<std::pair<std::string, std::string>> metas;
+    // Strings which are matched during the scan in the order of declaration together with IDs of their patterns
+    std::vector<std::pair<std::string, std::uint64_t>> strings;
+};
+
+inline RuleMetadata get_rule_metadata(const yaramod::Rule* rule, const RuleInfo& rule_info)
+{
+    RuleMetadata result;
+    result.ns = get_rule_namespace(rule->getName());
+    result.tags = rule->getTags();
+    for (const auto& meta : rule->getMetas())
+        result.metas.emplace_back(meta.getKey(), meta.getValue().getPureText());
+
+    // Strings removed by the optimizer have no patterns and never match
+    for (const auto* string : rule->getStrings())
+    {
+        const auto& id = string->getIdentifier();
+        if (auto itr = rule_info.literal_strings.find(id); itr != rule_info.literal_strings.end())
+            result.strings.emplace_back(id, itr->second);
+        else if (auto itr = rule_info.regex_strings.find(id); itr != rule_info.regex_strings.end())
+            result.strings.emplace_back(id, itr->second);
+    }
+
+    return result;
+}
+
+// Octal escapes are used since hexadecimal ones would swallow the hexadecimal digits which follow them
+inline std::string to_cpp_string_literal(const std::string& value)
+{
+    std::string result = "\"";
+    for (auto ch : value)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            result += '\\';
+            result += ch;
+        }
+        else if (std::isprint(static_cast<unsigned char>(ch)))
+            result += ch;
+        else
+        {
+            char escaped[5];
+            std::snprintf(escaped, sizeof(escaped), "\\%03o", static_cast<unsigned char>(ch));
+            result += escaped;
+        }
+    }
+    result += "\"";
+    return result;
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <yaramod/yaramod.h>
+
+#include <yarangc/optimizer.hpp>
+#include <yarangc/pattern_extractor.hpp>
+
+struct ScheduledRule
+{
+    const yaramod::Rule* rule;
+    std::uint64_t id;
+};
+
+// Rule files of different namespaces can't reference each other and each of them is gated only by its own global rules
+struct ScheduledNamespace
+{
+    std::string name;
+    // IDs of the rules of a namespace are always contiguous
+    std::uint64_t begin_id;
+    std::uint64_t end_id;
+    std::vector<ScheduledRule> prescan_global_rules;
+    std::vector<ScheduledRule> schedule;
+};
+
+class Scheduler
+{
+public:
+    Scheduler(const PatternExtractor* pattern_extractor, const Optimizer* optimizer = nullptr) : _pattern_extractor(pattern_extractor), _optimizer(optimizer)
+    {
+    }
+
+    void schedule(const yaramod::YaraFile* yara_file)
+    {
+        schedule(yara_file->getRules());
+    }
+
+    void schedule(const RuleList& all_rules)
+    {
+        const auto& rule_info_table = _pattern_extractor->get_rule_info_table();
+
+        std::vector<const yaramod::Rule*> rules;
+        std::unordered_map<std::string, std::size_t> declaration_index;
+        for (const auto& rule : all_rules)
+        {
+            if (!rule_info_table.contains(rule->getName()))
+                continue;
+
+            declaration_index.emplace(rule->getName(), rules.size());
+            rules.push_back(rule.get());
+        }
+
+        collect_references(rules);
+
+        // Private rules referenced from exactly one place in the whole ruleset are inlined into their consumer unless
+        // that place is in a loop body, where the inlined condition would be evaluated again on every iteration
+        std::unordered_map<std::string, std::size_t> reference_sites;
+        std::unordered_set<std::string> referenced_in_loops;
+        for (const auto* rule : rules)
+        {
+            const auto& references = _references.at(rule->getName());
+            for (const auto& [dependency, sites] : references.rules)
+                reference_sites[dependency] += sites;
+            referenced_in_loops.insert(references.rules_in_loops.begin(), references.rules_in_loops.end());
+        }
+
+        for (const auto* rule : rules)
+        {
+            const auto& name = rule->getName();
+            if (!is_reported(rule) && !rule->isGlobal() && reference_sites[name] == 1 && !referenced_in_loops.contains(name))
+                _inlined_rules.insert(name);
+        }
+
+        // Global rules which only look at the data itself are evaluated before the scan, the rest is ordered so that
+        // every rule comes after all the rules it depends on. Global rules with their dependencies come first so
+        // the evaluation can stop as soon as one of them doesn't hold.
+        std::vector<std::unordered_set<std::string>> dependencies(rules.size());
+        std::unordered_set<std::string> gated;
+        std::vector<std::string> worklist;
+        for (std::size_t i = 0; i < rules.size(); ++i)
+        {
+            const auto& name = rules[i]->getName();
+            if (rules[i]->isGlobal() && is_header_only(name))
+            {
+                _prescan_global_rules.push_back({rules[i], rule_info_table.at(name).id});
+                continue;
+            }
+
+            collect_dependencies(name, dependencies[i]);
+            if (rules[i]->isGlobal())
+            {
+                gated.insert(name);
+                worklist.push_back(name);
+            }
+        }
+
+        while (!worklist.empty())
+        {
+            auto name = std::move(worklist.back());
+            worklist.pop_back();
+            for (const auto& dependency : dependencies[declaration_index.at(name)])
+            {
+                if (gated.insert(dependency).second)
+                    worklist.push_back(dependency);
+            }
+        }
+
+        std::vector<std::size_t> in_degree(rules.size(), 0);
+        std::vector<std::vector<std::size_t>> consumers(rules.size());
+        std::set<std::pair<bool, std::size_t>> ready;
+        for (std::size_t i = 0; i < rules.size(); ++i)
+        {
+            if (!is_scheduled(rules[i]))
+                continue;
+
+            for (const auto& dependency : dependencies[i])
+            {
+                auto dependency_index = declaration_index.at(dependency);
+                if (is_scheduled(rules[dependency_index]))
+                {
+                    consumers[dependency_index].push_back(i);
+                    in_degree[i]++;
+                }
+            }
+
+            if (in_degree[i] == 0)
+                ready.emplace(!gated.contains(rules[i]->getName()), i);
+        }
+
+        while (!ready.empty())
+        {
+            auto i = ready.begin()->second;
+            ready.erase(ready.begin());
+            _schedule.push_back({rules[i], rule_info_table.at(rules[i]->getName()).id});
+
+            for (auto consumer : consumers[i])
+            {
+                if (--in_degree[consumer] == 0)
+                    ready.emplace(!gated.contains(rules[consumer]->getName()), consumer);
+            }
+        }
+
+        if (_schedule.size() + _prescan_global_rules.size() + _inlined_rules.size() != rules.size())
+            throw std::runtime_error("Scheduler: rule references contain a cycle");
+
+        split_into_namespaces(rules);
+    }
+
+    bool is_inlined(const std::string& rule) const
+    {
+        return _inlined_rules.contains(rule);
+    }
+
+    const std::vector<ScheduledRule>& get_prescan_global_rules() const { return _prescan_global_rules; }
+    const std::vector<ScheduledRule>& get_schedule() const { return _schedule; }
+    const std::vector<ScheduledNamespace>& get_namespaces() const { return _namespaces; }
+
+private:
+    void collect_references(const std::vector<const yaramod::Rule*>& rules)
+    {
+        if (_optimizer)
+        {
+            for (const auto* rule : rules)
+                _references.emplace(rule->getName(), _optimizer->get_references(rule->getName()));
+            return;
+        }
+
+        ConstantTable constants;
+        std::unordered_set<std::string> rule_names;
+        for (const auto* rule : rules)
+            rule_names.insert(rule->getName());
+
+        ReferenceCollector collector(&constants, &rule_names);
+        for (const auto* rule : rules)
+            _references.emplace(rule->getName(), collector.collect(rule));
+    }
+
+    // Dependencies of inlined rules become dependencies of the rule they are inlined into
+    void collect_dependencies(const std::string& rule, std::unordered_set<std::string>& result) const
+    {
+        for (const auto& [dependency, sites] : _references.at(rule).rules)
+        {
+            if (is_inlined(dependency))
+                collect_dependencies(dependency, result);
+            else
+                result.insert(dependency);
+        }
+    }
+
+    // Rules which don't reference any strings, mutexes or other rules only depend on the data itself
+    // and can be evaluated before any pattern matching takes place
+    bool is_header_only(const std::string& rule) const
+    {
+        const auto& references = _references.at(rule);
+        return references.strings.empty() && references.rules.empty() && references.mutexes.empty();
+    }
+
+    // Rules of each namespace keep their relative order so the order within a namespace stays topological
+    void split_into_namespaces(const std::vector<const yaramod::Rule*>& rules)
+    {
+        const auto& rule_info_table = _pattern_extractor->get_rule_info_table();
+
+        std::unordered_map<std::string, std::size_t> namespace_index;
+        for (const auto* rule : rules)
+        {
+            auto name = get_rule_namespace(rule->getName());
+            auto id = rule_info_table.at(rule->getName()).id;
+            auto [itr, inserted] = namespace_index.emplace(name, _namespaces.size());
+            if (inserted)
+                _namespaces.push_back({name, id, id + 1, {}, {}});
+            else if (itr->second != _namespaces.size() - 1)
+                throw std::runtime_error("Scheduler: rules of namespace " + name + " are not contiguous");
+            else
+                _namespaces.back().end_id = id + 1;
+        }
+
+        for (const auto& scheduled : _prescan_global_rules)
+            _namespaces[namespace_index.at(get_rule_namespace(scheduled.rule->getName()))].prescan_global_rules.push_back(scheduled);
+        for (const auto& scheduled : _schedule)
+            _namespaces[namespace_index.at(get_rule_namespace(scheduled.rule->getName()))].schedule.push_back(scheduled);
+
+        _schedule.clear();
+        for (const auto& ns : _namespaces)
+            _schedule.insert(_schedule.end(), ns.schedule.begin(), ns.schedule.end());
+    }
+
+    bool is_reported(const yaramod::Rule* rule) const
+    {
+        return _optimizer ? _optimizer->is_rule_reported(rule) : !rule->isPrivate();
+    }
+
+    bool is_scheduled(const yaramod::Rule* rule) const
+    {
+        return !is_inlined(rule->getName()) && !(rule->isGlobal() && is_header_only(rule->getName()));
+    }
+
+    const PatternExtractor* _pattern_extractor;
+    const Optimizer* _optimizer;
+    std::unordered_map<std::string, RuleReferences> _references;
+    std::unordered_set<std::string> _inlined_rules;
+    std::vector<ScheduledRule> _prescan_global_rules;
+    std::vector<ScheduledRule> _schedule;
+    std::vector<ScheduledNamespace> _namespaces;
+};
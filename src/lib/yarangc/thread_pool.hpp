@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    ThreadPool(std::size_t threads = std::thread::hardware_concurrency()) : _stop(false)
+    {
+        threads = std::max(threads, static_cast<std::size_t>(1));
+        for (std::size_t i = 0; i < threads; ++i)
+            _workers.emplace_back([this]() { work(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+
+        _cv.notify_all();
+        for (auto& worker : _workers)
+            worker.join();
+    }
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ThreadPool& operator=(ThreadPool&&) = delete;
+
+    std::size_t get_thread_count() const { return _workers.size(); }
+
+    template <typename Fn>
+    std::future<void> submit(Fn&& fn)
+    {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::forward<Fn>(fn));
+        auto result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.emplace([task]() { (*task)(); });
+        }
+
+        _cv.notify_one();
+        return result;
+    }
+
+    // Splits [0, count) into contiguous chunks, one per thread, and calls fn(begin, end) for each of them.
+    // Blocks until all chunks are done and rethrows the first exception thrown by any of them.
+    template <typename Fn>
+    void parallel_for(std::size_t count, const Fn& fn)
+    {
+        auto chunks = std::min(count, _workers.size());
+        std::vector<std::future<void>> results;
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            auto begin = count * chunk / chunks, end = count * (chunk + 1) / chunks;
+            results.push_back(submit([&fn, begin, end]() { fn(begin, end); }));
+        }
+
+        wait_all(results);
+    }
+
+    static void wait_all(std::vector<std::future<void>>& results)
+    {
+        for (auto& result : results)
+            result.wait();
+        for (auto& result : results)
+            result.get();
+    }
+
+private:
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+                if (_stop && _tasks.empty())
+                    return;
+
+                task = std::move(_tasks.front());
+                _tasks.pop();
+            }
+
+            task();
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop;
+};
@@ -1,10 +1,19 @@
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <sstream>
 #include <thread>
 #include <vector>
 #include <string>
 
+#include <yarang/latency_histogram.hpp>
+#include <yarang/result_store.hpp>
 #include <yarang/ruleset.hpp>
 
 void collect_files(std::vector<std::string>& result, const std::string& file_path)
@@ -33,12 +42,25 @@ std::vector<std::string> files_to_scan(const std::vector<std::string>& args)
 
 struct Options
 {
-    Options() : threads(1), ruleset(), input_files() {}
+    Options() : threads(1), timeout_ms(0), max_matches(0), stats_top(0), timings(false), trace_sample(1), ruleset(), input_files(), cuckoo_file(),
+        result_store(), compare_ruleset(), trace_file() {}
 
     int threads;
+    // Limits of scans of each file, zero for no limit
+    std::uint64_t timeout_ms;
+    std::uint32_t max_matches;
+    // Number of the most expensive rules and the noisiest patterns printed at the end, zero for none
+    std::size_t stats_top;
+    // Latency histograms of the stages of file scans printed at the end
+    bool timings;
+    // Every Nth file is written into the trace
+    std::size_t trace_sample;
     std::string ruleset;
     std::vector<std::string> input_files;
     std::string cuckoo_file;
+    std::string result_store;
+    std::string compare_ruleset;
+    std::string trace_file;
 };
 
 Options parse_options(std::vector<std::string>& args)
@@ -46,10 +68,10 @@ Options parse_options(std::vector<std::string>& args)
     Options result;
 
     std::size_t to_remove = 0;
-    for (auto itr = args.begin(), end = args.end(); itr != end; ++itr)
+    for (auto itr = args.begin(), end = args.end(); itr != end; ++itr, ++to_remove)
     {
         auto& opt = *itr;
-        if (opt[0] == '-')
+        if (opt[0] != '-')
             break;
 
         if (opt == "-t" || opt == "--threads")
@@ -57,7 +79,7 @@ Options parse_options(std::vector<std::string>& args)
             if (itr + 1 == end)
                 throw std::runtime_error("Option -t|--threads expects number of threads");
 
-            itr++;
+            itr++, to_remove++;
             result.threads = std::stoi(*itr);
         }
         else if (opt == "-c" || opt == "--cuckoo")
@@ -65,9 +87,69 @@ Options parse_options(std::vector<std::string>& args)
             if (itr + 1 == end)
                 throw std::runtime_error("Option -c|--cukoo expects path to the Cuckoo JSON");
 
-            itr++;
+            itr++, to_remove++;
             result.cuckoo_file = *itr;
         }
+        else if (opt == "-m" || opt == "--merge")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option -m|--merge expects path to the result store");
+
+            itr++, to_remove++;
+            result.result_store = *itr;
+        }
+        else if (opt == "--timeout")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option --timeout expects time budget of each file in milliseconds");
+
+            itr++, to_remove++;
+            result.timeout_ms = std::stoull(*itr);
+        }
+        else if (opt == "--max-matches")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option --max-matches expects number of matches of a single string");
+
+            itr++, to_remove++;
+            result.max_matches = static_cast<std::uint32_t>(std::stoul(*itr));
+        }
+        else if (opt == "--stats")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option --stats expects number of rules and patterns to list");
+
+            itr++, to_remove++;
+            result.stats_top = std::stoull(*itr);
+        }
+        else if (opt == "--timings")
+            result.timings = true;
+        else if (opt == "--trace")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option --trace expects path to the trace file");
+
+            itr++, to_remove++;
+            result.trace_file = *itr;
+        }
+        else if (opt == "--trace-sample")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option --trace-sample expects how many files are there per traced file");
+
+            itr++, to_remove++;
+            result.trace_sample = std::max<std::size_t>(std::stoull(*itr), 1);
+        }
+        else if (opt == "--compare")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option --compare expects path to the ruleset to compare with");
+
+            itr++, to_remove++;
+            result.compare_ruleset = *itr;
+        }
+        else
+            throw std::runtime_error("Unknown option " + opt);
     }
 
     args.erase(args.begin(), args.begin() + to_remove);
@@ -84,28 +166,344 @@ Options parse_options(std::vector<std::string>& args)
     return result;
 }
 
+struct FileContext
+{
+    const std::string* file;
+    ResultStore* results;
+};
+
 void print_hit(const char* rule, void* context)
 {
-    std::cout << (const char*)context << ": " << rule << std::endl;
+    auto ctx = static_cast<FileContext*>(context);
+    std::cout << *ctx->file << ": " << rule << std::endl;
 }
 
-int main(int argc, char* argv[])
+void store_hit(const char* rule, void* context)
 {
-    std::vector<std::string> args(argv + 1, argv + argc);
-    auto options = parse_options(args);
-
-    auto ruleset = Ruleset{options.ruleset};
+    auto ctx = static_cast<FileContext*>(context);
+    ctx->results->add(*ctx->file, rule);
+}
 
-    std::ifstream in_file(argv[2], std::ios::binary);
+std::vector<char> read_file(const std::string& path)
+{
+    std::ifstream in_file(path, std::ios::binary);
     in_file.seekg(0, std::ios::end);
     auto file_size = in_file.tellg();
     in_file.seekg(0, std::ios::beg);
 
     std::vector<char> data(file_size);
     in_file.read(data.data(), data.size());
+    return data;
+}
+
+struct ScanStats
+{
+    std::chrono::nanoseconds duration;
+    ResultStore results;
+};
+
+void print_stats(const std::string& ruleset, const ScanStats& stats, std::size_t total_size)
+{
+    auto seconds = std::chrono::duration<double>(stats.duration).count();
+    std::cout << ruleset << ": " << std::chrono::duration_cast<std::chrono::milliseconds>(stats.duration).count() << " ms, "
+        << (seconds > 0.0 ? total_size / seconds / (1024 * 1024) : 0.0) << " MiB/s, " << stats.results.get_results().size() << " hits" << std::endl;
+}
+
+void print_mismatches(const std::string& ruleset, const ScanStats& stats, const ScanStats& other_stats)
+{
+    std::vector<ResultStore::Result> mismatches;
+    std::set_difference(stats.results.get_results().begin(), stats.results.get_results().end(),
+        other_stats.results.get_results().begin(), other_stats.results.get_results().end(), std::back_inserter(mismatches));
+    for (const auto& [file, rule] : mismatches)
+        std::cout << "Mismatch " << file << ": " << rule << " (only " << ruleset << ")" << std::endl;
+}
+
+// Lists the rules which took the most cycles and the patterns which matched the most times
+void print_profile(const Ruleset::Stats& stats, std::size_t top)
+{
+    std::cout << "Scans: " << stats.scans << " (" << stats.sampled_scans << " sampled)\n";
+    for (std::size_t stage = 0; stage < Ruleset::StageCount; ++stage)
+        std::cout << "  " << Ruleset::get_stage_name(stage) << ": " << stats.stage_ns[stage] / 1000000 << " ms\n";
+
+    std::vector<std::size_t> rules(stats.rule_count);
+    std::iota(rules.begin(), rules.end(), 0);
+    auto rule_count = std::min(top, rules.size());
+    std::partial_sort(rules.begin(), rules.begin() + rule_count, rules.end(), [&](auto lhs, auto rhs) {
+        return stats.rules[lhs].cycles > stats.rules[rhs].cycles;
+    });
+
+    std::cout << "Most expensive rules (cycles, evaluations, hits):\n";
+    for (std::size_t i = 0; i < rule_count; ++i)
+    {
+        const auto& rule = stats.rules[rules[i]];
+        std::cout << "  " << stats.rule_names[rules[i]] << ": " << rule.cycles << " " << rule.evaluations << " " << rule.hits << "\n";
+    }
+
+    std::vector<std::size_t> patterns(stats.pattern_count);
+    std::iota(patterns.begin(), patterns.end(), 0);
+    auto pattern_count = std::min(top, patterns.size());
+    std::partial_sort(patterns.begin(), patterns.begin() + pattern_count, patterns.end(), [&](auto lhs, auto rhs) {
+        return stats.pattern_matches[lhs] > stats.pattern_matches[rhs];
+    });
+
+    std::cout << "Noisiest patterns (matches):\n";
+    for (std::size_t i = 0; i < pattern_count; ++i)
+        std::cout << "  " << stats.pattern_names[patterns[i]] << ": " << stats.pattern_matches[patterns[i]] << "\n";
+    std::cout << std::flush;
+}
+
+// Files are split into buckets by their size, each one 16 times larger than the previous one
+constexpr std::size_t SizeBucketCount = 6;
+
+std::size_t get_size_bucket(std::uint64_t size)
+{
+    std::size_t result = 0;
+    for (std::uint64_t limit = 4096; result + 1 < SizeBucketCount && size >= limit; limit *= 16)
+        result++;
+    return result;
+}
+
+const char* get_size_bucket_name(std::size_t bucket)
+{
+    static const char* bucket_names[SizeBucketCount] = {"< 4 KiB", "< 64 KiB", "< 1 MiB", "< 16 MiB", "< 256 MiB", ">= 256 MiB"};
+    return bucket_names[bucket];
+}
+
+// Latencies of file scans in nanoseconds, stages which didn't run for the file aren't recorded
+struct Timings
+{
+    Timings() : stages(), total(), size_buckets(SizeBucketCount) {}
+
+    LatencyHistogram stages[Ruleset::StageCount];
+    LatencyHistogram total;
+    std::vector<LatencyHistogram> size_buckets;
+};
 
-    auto scanner = ruleset.new_scanner(print_hit);
-    scanner.scan_data(data.data(), data.size(), !options.cuckoo_file.empty() ? options.cuckoo_file.c_str() : nullptr, argv[2]);
+void print_histogram(const std::string& name, const LatencyHistogram& histogram)
+{
+    auto ms = [](std::uint64_t ns) { return ns / 1000000.0; };
+    std::cout << "  " << std::left << std::setw(12) << name << std::right
+        << std::setw(10) << histogram.get_count()
+        << std::setw(12) << ms(histogram.get_percentile(0.5))
+        << std::setw(12) << ms(histogram.get_percentile(0.99))
+        << std::setw(12) << ms(histogram.get_percentile(0.999))
+        << std::setw(12) << ms(histogram.get_max())
+        << std::setw(14) << ms(histogram.get_total()) << "\n";
+}
+
+void print_timings(const Timings& timings)
+{
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Latencies in ms:\n";
+    std::cout << "  " << std::left << std::setw(12) << "stage" << std::right << std::setw(10) << "files" << std::setw(12) << "p50"
+        << std::setw(12) << "p99" << std::setw(12) << "p999" << std::setw(12) << "max" << std::setw(14) << "total" << "\n";
+    for (std::size_t stage = 0; stage < Ruleset::StageCount; ++stage)
+    {
+        if (timings.stages[stage].get_count())
+            print_histogram(Ruleset::get_stage_name(stage), timings.stages[stage]);
+    }
+    print_histogram("file", timings.total);
+
+    std::cout << "Latencies of files by size in ms:\n";
+    for (std::size_t bucket = 0; bucket < SizeBucketCount; ++bucket)
+    {
+        if (timings.size_buckets[bucket].get_count())
+            print_histogram(get_size_bucket_name(bucket), timings.size_buckets[bucket]);
+    }
+    std::cout << std::defaultfloat << std::flush;
+}
+
+std::string escape_json(const std::string& str)
+{
+    std::ostringstream result;
+    for (unsigned char ch : str)
+    {
+        if (ch == '"' || ch == '\\')
+            result << '\\' << ch;
+        else if (ch < 0x20)
+            result << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(ch) << std::dec << std::setfill(' ');
+        else
+            result << ch;
+    }
+    return result.str();
+}
+
+// Writes scans of files as events of Chrome trace format which chrome://tracing or Perfetto can show. Stages of
+// each file are laid one after another in the order they run, times of parallel scans are summed over their threads
+// so their stages can take longer than the whole file.
+class TraceWriter
+{
+public:
+    TraceWriter(const std::string& path) : _out(path, std::ios::trunc), _first(true)
+    {
+        if (!_out)
+            throw std::runtime_error("Unable to write trace file " + path);
+        _out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    }
+
+    ~TraceWriter()
+    {
+        _out << "\n]}\n";
+    }
+
+    void add_file(const std::string& path, std::uint64_t size, std::uint64_t start_ns, std::uint64_t duration_ns, const std::uint64_t (&stage_ns)[Ruleset::StageCount])
+    {
+        auto file = escape_json(path);
+        _add_event(file, "file", start_ns, duration_ns, file, size);
+        for (std::size_t stage = 0; stage < Ruleset::StageCount; ++stage)
+        {
+            if (stage_ns[stage] == 0)
+                continue;
+
+            _add_event(Ruleset::get_stage_name(stage), "stage", start_ns, stage_ns[stage], file, size);
+            start_ns += stage_ns[stage];
+        }
+    }
+
+private:
+    void _add_event(const std::string& name, const char* category, std::uint64_t start_ns, std::uint64_t duration_ns, const std::string& file, std::uint64_t size)
+    {
+        // Times are in microseconds
+        _out << (_first ? "" : ",\n") << "{\"name\":\"" << name << "\",\"cat\":\"" << category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+            << ",\"ts\":" << start_ns / 1000.0 << ",\"dur\":" << duration_ns / 1000.0
+            << ",\"args\":{\"file\":\"" << file << "\",\"size\":" << size << "}}";
+        _first = false;
+    }
+
+    std::ofstream _out;
+    bool _first;
+};
+
+// Scans the same files with two builds of the same rules, typically native and bytecode one, so their speed and
+// results can be compared. Both rulesets scan each file right after each other so it is read only once.
+int compare_rulesets(const Options& options)
+{
+    auto ruleset = Ruleset{options.ruleset};
+    auto other_ruleset = Ruleset{options.compare_ruleset};
+    auto scanner = ruleset.new_scanner(store_hit);
+    auto other_scanner = other_ruleset.new_scanner(store_hit);
+    const char* cuckoo_file = !options.cuckoo_file.empty() ? options.cuckoo_file.c_str() : nullptr;
+
+    ScanStats stats{}, other_stats{};
+    std::size_t total_size = 0;
+    auto timed_scan = [&](const auto& scanner, ScanStats& stats, const std::string& input_file, std::vector<char>& data) {
+        FileContext ctx{&input_file, &stats.results};
+        auto start = std::chrono::steady_clock::now();
+        scanner.scan_data(data.data(), data.size(), cuckoo_file, &ctx);
+        stats.duration += std::chrono::steady_clock::now() - start;
+    };
+
+    for (const auto& input_file : options.input_files)
+    {
+        auto data = read_file(input_file);
+        total_size += data.size();
+        timed_scan(scanner, stats, input_file, data);
+        timed_scan(other_scanner, other_stats, input_file, data);
+    }
+
+    print_stats(options.ruleset, stats, total_size);
+    print_stats(options.compare_ruleset, other_stats, total_size);
+    if (other_stats.duration.count() > 0)
+        std::cout << "Speedup of " << options.compare_ruleset << ": " << static_cast<double>(stats.duration.count()) / other_stats.duration.count() << "x" << std::endl;
+
+    print_mismatches(options.ruleset, stats, other_stats);
+    print_mismatches(options.compare_ruleset, other_stats, stats);
+    return stats.results.get_results() == other_stats.results.get_results() ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    auto options = parse_options(args);
+    if (!options.compare_ruleset.empty())
+        return compare_rulesets(options);
+
+    auto ruleset = Ruleset{options.ruleset};
+
+    // Hits are either printed right away or collected and merged into the result store at the end
+    ResultStore results;
+    auto scanner = ruleset.new_scanner(options.result_store.empty() ? print_hit : store_hit);
+    if (options.timeout_ms || options.max_matches)
+        scanner.set_limits({options.timeout_ms * 1000, options.max_matches});
+
+    Timings timings;
+    std::unique_ptr<TraceWriter> trace;
+    if (!options.trace_file.empty())
+        trace = std::make_unique<TraceWriter>(options.trace_file);
+    if (options.timings || trace)
+        scanner.trace_stages(true);
+    auto trace_start = std::chrono::steady_clock::now();
+    std::size_t file_index = 0;
+
+    // Files whose scan hit a limit have no results, their previous results in the store are kept
+    std::vector<std::string> scanned_files;
+    for (const auto& input_file : options.input_files)
+    {
+        FileContext ctx{&input_file, &results};
+        // Only the prefix of the file the rules can observe is read. Large files are split between the threads,
+        // small ones are scanned on this thread only.
+        auto start = std::chrono::steady_clock::now();
+        scanner.scan_file(input_file, std::max(options.threads, 1), !options.cuckoo_file.empty() ? options.cuckoo_file.c_str() : nullptr, &ctx);
+        if (options.timings || trace)
+        {
+            auto duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            std::error_code error;
+            auto size = std::filesystem::file_size(input_file, error);
+            if (error)
+                size = 0;
+
+            std::uint64_t stage_ns[Ruleset::StageCount];
+            scanner.get_stage_times(stage_ns);
+            for (std::size_t stage = 0; stage < Ruleset::StageCount; ++stage)
+            {
+                if (stage_ns[stage])
+                    timings.stages[stage].record(stage_ns[stage]);
+            }
+            timings.total.record(duration_ns);
+            timings.size_buckets[get_size_bucket(size)].record(duration_ns);
+
+            if (trace && file_index++ % options.trace_sample == 0)
+            {
+                auto start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - trace_start).count();
+                trace->add_file(input_file, size, start_ns, duration_ns, stage_ns);
+            }
+        }
+
+        switch (scanner.get_scan_status())
+        {
+            case Ruleset::ScanStatus::Complete:
+                scanned_files.push_back(input_file);
+                break;
+            case Ruleset::ScanStatus::Timeout:
+                std::cerr << input_file << ": scan stopped, time budget exceeded" << std::endl;
+                break;
+            case Ruleset::ScanStatus::TooManyMatches:
+                std::cerr << input_file << ": scan stopped, too many matches of a single string" << std::endl;
+                break;
+        }
+    }
+
+    // Trace is complete once the writer is gone
+    trace.reset();
+    if (options.timings)
+        print_timings(timings);
+
+    if (options.stats_top)
+    {
+        Ruleset::Stats stats;
+        if (scanner.get_stats(&stats))
+            print_profile(stats, options.stats_top);
+        else
+            std::cerr << "Ruleset " << options.ruleset << " wasn't built with statistics (yarangc.sh -S)" << std::endl;
+    }
+
+    if (!options.result_store.empty())
+    {
+        ResultStore store;
+        store.load(options.result_store);
+        store.merge(ruleset.get_reported_rules(), ruleset.get_retracted_rules(), scanned_files, results);
+        store.save(options.result_store);
+    }
 
     return 0;
 }
@@ -1,39 +1,368 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <string_view>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include <yaramod/yaramod.h>
 
 #include <hspp/database.hpp>
+#include <hspp/platform.hpp>
+#include <yarang/bytecode.hpp>
+#include <yarangc/bytecode_generator.hpp>
 #include <yarangc/codegen.hpp>
+#include <yarangc/delta.hpp>
+#include <yarangc/externals.hpp>
+#include <yarangc/namespaces.hpp>
+#include <yarangc/optimizer.hpp>
 #include <yarangc/pattern_extractor.hpp>
+#include <yarangc/prefix_analyzer.hpp>
+#include <yarangc/thread_pool.hpp>
+
+enum class Backend
+{
+    Native,
+    Bytecode
+};
+
+struct Options
+{
+    Options() : rule_files(), output(), externals(), shards(1), threads(std::thread::hardware_concurrency()), cache_dir(), base_rule_files(), backend(Backend::Native), targets{hspp::Target::Host}, vectored(false), stats(false) {}
+
+    std::vector<RuleFile> rule_files;
+    std::string output;
+    ExternalBindings externals;
+    std::size_t shards;
+    std::size_t threads;
+    std::string cache_dir;
+    std::vector<RuleFile> base_rule_files;
+    Backend backend;
+    std::vector<hspp::Target> targets;
+    bool vectored;
+    // Native rulesets count evaluations and cycles of rules and matches of patterns
+    bool stats;
+};
+
+Options parse_options(std::vector<std::string>& args)
+{
+    Options result;
+
+    std::size_t to_remove = 0;
+    for (auto itr = args.begin(), end = args.end(); itr != end; ++itr, ++to_remove)
+    {
+        auto& opt = *itr;
+        if (opt[0] != '-')
+            break;
+
+        if (opt == "-d" || opt == "--define")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option -d|--define expects external variable in form NAME=VALUE");
+
+            itr++, to_remove++;
+            result.externals.push_back(parse_external_binding(*itr));
+        }
+        else if (opt == "-o" || opt == "--output")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option -o|--output expects output path prefix");
+
+            itr++, to_remove++;
+            result.output = *itr;
+        }
+        else if (opt == "--shards")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option --shards expects number of translation units");
+
+            itr++, to_remove++;
+            result.shards = std::stoull(*itr);
+            if (result.shards == 0)
+                throw std::runtime_error("Option --shards expects positive number");
+        }
+        else if (opt == "-t" || opt == "--threads")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option -t|--threads expects number of threads");
+
+            itr++, to_remove++;
+            result.threads = std::stoull(*itr);
+        }
+        else if (opt == "--cache")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option --cache expects path to the directory with cached databases");
+
+            itr++, to_remove++;
+            result.cache_dir = *itr;
+        }
+        else if (opt == "-b" || opt == "--base")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option -b|--base expects path to the previously deployed rules file");
+
+            itr++, to_remove++;
+            result.base_rule_files.push_back(parse_rule_file(*itr));
+        }
+        else if (opt == "--targets")
+        {
+            if (itr + 1 == end)
+                throw std::runtime_error("Option --targets expects comma-separated list of host, baseline, avx2, avx512");
+
+            itr++, to_remove++;
+            result.targets.clear();
+            std::stringstream targets{*itr};
+            for (std::string target; std::getline(targets, target, ',');)
+                result.targets.push_back(hspp::parse_target(target));
+            if (result.targets.empty())
+                throw std::runtime_error("Option --targets expects at least one target");
+        }
+        else if (opt == "--vectored")
+            result.vectored = true;
+        else if (opt == "--stats")
+            result.stats = true;
+        else if (opt == "--backend")
+        {
+            if (itr + 1 == end || (*(itr + 1) != "native" && *(itr + 1) != "bytecode"))
+                throw std::runtime_error("Option --backend expects native or bytecode");
+
+            itr++, to_remove++;
+            result.backend = *itr == "bytecode" ? Backend::Bytecode : Backend::Native;
+        }
+        else
+            throw std::runtime_error("Unknown option " + opt);
+    }
+
+    if (result.stats && result.backend == Backend::Bytecode)
+        throw std::runtime_error("Option --stats is only supported by the native backend");
+
+    args.erase(args.begin(), args.begin() + to_remove);
+    if (args.empty())
+        throw std::runtime_error("At least one rules file needs to be provided to yarangc");
+
+    for (const auto& arg : args)
+        result.rule_files.push_back(parse_rule_file(arg));
+    if (result.output.empty())
+        result.output = result.rule_files[0].path;
+    return result;
+}
+
+// Runs given stage of compilation and reports how long it took
+template <typename Fn>
+void run_stage(const std::string& stage, Fn&& fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    // Stages can run concurrently
+    static std::mutex output_mutex;
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cout << "Stage " << stage << " took " << duration.count() << " ms\n";
+}
+
+const char* describe_removal(RemovalReason reason)
+{
+    switch (reason)
+    {
+        case RemovalReason::Unreachable:
+            return "unreachable from public rules";
+        case RemovalReason::AlwaysFalse:
+            return "condition is always false";
+        case RemovalReason::AlwaysTrue:
+            return "global condition is always true";
+        case RemovalReason::GatedByGlobal:
+            return "global rule is always false";
+        case RemovalReason::Unchanged:
+            return "unchanged since the base ruleset";
+    }
+    return "";
+}
+
+// Databases of a ruleset compiled for single CPU target
+struct TargetDatabases
+{
+    // Vectored databases scan data in several regions as one, mutexes always come in a single buffer. Unbounded regexes
+    // are never scanned in chunks so their database is always vectored to take data larger than HyperScan's single block.
+    TargetDatabases(hspp::Target target, bool vectored)
+        : target(target)
+        , regex{get_data_flags(vectored), target}
+        , literal{get_data_flags(vectored), target}
+        , unbounded{get_data_flags(true), target}
+        , mutex{hspp::Database::Flags::Multiline | hspp::Database::Flags::SingleMatch, target}
+    {
+    }
+
+    static std::uint32_t get_data_flags(bool vectored)
+    {
+        return hspp::Database::Flags::ReportStart | (vectored ? hspp::Database::Flags::Vectored : hspp::Database::Flags::None);
+    }
+
+    // Host databases keep their original names so rulesets built without targets look the same as before
+    std::string get_path(const std::string& output, const char* kind) const
+    {
+        auto suffix = target == hspp::Target::Host ? std::string{} : std::string{"."} + hspp::get_target_name(target);
+        return output + "." + kind + suffix + ".db";
+    }
+
+    hspp::Target target;
+    hspp::Database regex;
+    hspp::Database literal;
+    hspp::Database unbounded;
+    hspp::Database mutex;
+};
+
+// Regexes whose matches can be longer than this are scanned together with the unbounded ones so parallel scans don't
+// need chunks overlapping by more than this
+constexpr unsigned int MaxChunkedWidth = 1024 * 1024;
+
+// Regexes of a native ruleset split by whether their matches have a reasonable upper bound on their length. Both
+// keep IDs from the list of all regexes.
+struct RegexSplit
+{
+    std::vector<const Pattern*> bounded;
+    std::vector<unsigned int> bounded_ids;
+    std::vector<const Pattern*> unbounded;
+    std::vector<unsigned int> unbounded_ids;
+    std::uint64_t max_width = 0;
+    // Longest matches of all the regexes, hspp::Database::UnboundedWidth for those without any limit
+    std::vector<unsigned int> widths;
+};
+
+RegexSplit split_regexes(const std::vector<std::unique_ptr<Pattern>>& regexes, const hspp::Database& db, ThreadPool& thread_pool)
+{
+    RegexSplit result;
+    auto& widths = result.widths;
+    widths.resize(regexes.size(), 0);
+    thread_pool.parallel_for(regexes.size(), [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; ++i)
+            widths[i] = db.get_regex_width(regexes[i]->get_pattern());
+    });
+
+    for (std::size_t i = 0; i < regexes.size(); ++i)
+    {
+        if (widths[i] > MaxChunkedWidth)
+        {
+            result.unbounded.push_back(regexes[i].get());
+            result.unbounded_ids.push_back(static_cast<unsigned int>(i));
+        }
+        else
+        {
+            result.bounded.push_back(regexes[i].get());
+            result.bounded_ids.push_back(static_cast<unsigned int>(i));
+            result.max_width = std::max<std::uint64_t>(result.max_width, widths[i]);
+        }
+    }
+    return result;
+}
+
+std::unique_ptr<yaramod::YaraFile> parse_ruleset(yaramod::Yaramod& ymod, const std::string& path, const Options& options)
+{
+    if (options.externals.empty())
+        return ymod.parseFile(path);
+
+    std::ifstream in_file(path, std::ios::binary);
+    std::stringstream source;
+    source << in_file.rdbuf();
+
+    std::stringstream bound_source{bind_externals(source.str(), options.externals)};
+    return ymod.parseStream(bound_source);
+}
+
+// Parses all the rule files into one list of rules qualified by their namespaces. Rule files can only reference
+// rules from the same file so each namespace can be given by a single rule file only.
+RuleList parse_rule_files(yaramod::Yaramod& ymod, const std::vector<RuleFile>& rule_files, const Options& options, std::vector<std::unique_ptr<yaramod::YaraFile>>& parsed)
+{
+    RuleList result;
+    std::unordered_set<std::string> namespaces;
+    for (const auto& rule_file : rule_files)
+    {
+        if (!namespaces.insert(rule_file.ns).second)
+            throw std::runtime_error("Namespace '" + rule_file.ns + "' is used by more than one rules file");
+
+        auto yara_file = parse_ruleset(ymod, rule_file.path, options);
+        if (!yara_file)
+            throw std::runtime_error("Unable to parse rules file " + rule_file.path);
+
+        for (const auto& rule : yara_file->getRules())
+        {
+            if (!rule_file.ns.empty())
+                rule->setName(qualify_rule_name(rule_file.ns, rule->getName()));
+            result.push_back(rule);
+        }
+        parsed.push_back(std::move(yara_file));
+    }
+
+    return result;
+}
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    Options options;
+    try
+    {
+        options = parse_options(args);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << error.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [-d NAME=VALUE]... [-o OUTPUT_PREFIX] [-t THREADS] [--shards N] [--cache DIR] [--backend native|bytecode] [--targets TARGET,...] [--vectored] [--stats] [-b [NAMESPACE:]BASE_RULES_FILE]... [NAMESPACE:]RULES_FILE..." << std::endl;
         return 2;
+    }
 
     yaramod::Yaramod ymod;
+    ThreadPool thread_pool(options.threads);
 
     try
     {
-        auto ruleset_file_path = std::string{argv[1]};
-        auto ruleset = ymod.parseFile(ruleset_file_path);
-        if (!ruleset)
-            return 1;
+        std::vector<std::unique_ptr<yaramod::YaraFile>> rule_files;
+        RuleList ruleset;
+        run_stage("parsing", [&]() { ruleset = parse_rule_files(ymod, options.rule_files, options, rule_files); });
+
+        Optimizer optimizer;
+
+        // Delta ruleset only reports rules whose results could have changed since the base ruleset. Everything else
+        // is kept only if some of the reported rules depend on it.
+        RulesetDelta delta;
+        if (!options.base_rule_files.empty())
+        {
+            std::vector<std::unique_ptr<yaramod::YaraFile>> base_rule_files;
+            RuleList base_ruleset;
+            run_stage("base parsing", [&]() { base_ruleset = parse_rule_files(ymod, options.base_rule_files, options, base_rule_files); });
+
+            delta = compute_delta(base_ruleset, ruleset);
+            optimizer.set_reported_rules(delta.changed);
+        }
+
+        run_stage("optimization", [&]() { optimizer.optimize(ruleset); });
+        for (const auto& removed : optimizer.get_removed_rules())
+            std::cout << "Removed rule " << removed.name << " (" << describe_removal(removed.reason) << ")\n";
+        for (const auto& removed : optimizer.get_removed_strings())
+            std::cout << "Removed string " << removed.rule << ":" << removed.id << " (unreferenced)\n";
 
-        PatternExtractor extractor;
-        extractor.extract(ruleset.get());
+        PatternExtractor extractor(&optimizer, &thread_pool);
+        run_stage("pattern extraction", [&]() { extractor.extract(ruleset); });
 
         const auto& regexes = extractor.get_regex_patterns();
         const auto& literals = extractor.get_literal_patterns();
         const auto& mutexes = extractor.get_mutex_patterns();
 
-        std::ofstream patterns(std::filesystem::path{ruleset_file_path}.parent_path() / "patterns.txt");
+        auto output_dir = std::filesystem::path{options.output}.parent_path();
+
+        std::ofstream patterns(output_dir / "patterns.txt");
         for (std::size_t i = 0; i < regexes.size(); ++i)
             patterns << i << " " << regexes[i]->get_rule() << ":" << regexes[i]->get_id() << " R " << regexes[i]->get_pattern() << "\n";
         for (std::size_t i = 0; i < literals.size(); ++i)
@@ -42,34 +371,141 @@ int main(int argc, char* argv[])
             patterns << i << " " << mutexes[i]->get_rule() << ":" << mutexes[i]->get_id() << " R " << mutexes[i]->get_pattern() << "\n";
         patterns.close();
 
-        hspp::Database db_regex{hspp::Database::Flags::ReportStart};
-        hspp::Database db_literal{hspp::Database::Flags::ReportStart};
-        hspp::Database db_mutex{hspp::Database::Flags::Multiline | hspp::Database::Flags::SingleMatch};
+        std::optional<hspp::DatabaseCache> cache;
+        if (!options.cache_dir.empty())
+            cache.emplace(options.cache_dir);
+        const auto* cache_ptr = cache ? &*cache : nullptr;
+
+        // Bytecode rulesets carry single set of databases so only the first target is used for them
+        std::deque<TargetDatabases> databases;
+        for (auto target : options.targets)
+        {
+            databases.emplace_back(target, options.vectored);
+            if (options.backend == Backend::Bytecode)
+                break;
+        }
+
+        // Interpreter scans the whole data at once so bytecode rulesets keep all the regexes in one database
+        RegexSplit regex_split;
+        if (options.backend == Backend::Native)
+            run_stage("regex widths", [&]() { regex_split = split_regexes(regexes, databases.front().regex, thread_pool); });
+        else
+        {
+            for (std::size_t i = 0; i < regexes.size(); ++i)
+            {
+                regex_split.bounded.push_back(regexes[i].get());
+                regex_split.bounded_ids.push_back(static_cast<unsigned int>(i));
+            }
+        }
+
+        std::uint64_t literal_max_width = 0;
+        for (const auto& literal : literals)
+            literal_max_width = std::max<std::uint64_t>(literal_max_width, literal->get_pattern().length());
+
+        // Databases are independent of each other and of the code generation so they are all compiled at once.
+        // Futures of std::async block in destructor so databases are never destroyed while still being compiled.
+        std::vector<std::future<void>> compilations;
+        for (auto& dbs : databases)
+        {
+            auto target = std::string{" ("} + hspp::get_target_name(dbs.target) + ")";
+            if (!regex_split.bounded.empty())
+              compilations.push_back(std::async(std::launch::async, [&, target, db = &dbs.regex]() { run_stage("regex database" + target, [&]() { db->compile_regexes(regex_split.bounded, regex_split.bounded_ids, cache_ptr); }); }));
+            if (!regex_split.unbounded.empty())
+              compilations.push_back(std::async(std::launch::async, [&, target, db = &dbs.unbounded]() { run_stage("unbounded regex database" + target, [&]() { db->compile_regexes(regex_split.unbounded, regex_split.unbounded_ids, cache_ptr); }); }));
+            if (!literals.empty())
+              compilations.push_back(std::async(std::launch::async, [&, target, db = &dbs.literal]() { run_stage("literal database" + target, [&]() { db->compile_literals(literals, regexes.size(), cache_ptr); }); }));
+            if (!mutexes.empty())
+              compilations.push_back(std::async(std::launch::async, [&, target, db = &dbs.mutex]() { run_stage("mutex database" + target, [&]() { db->compile_regexes(mutexes, 0, cache_ptr); }); }));
+        }
 
-        if (!regexes.empty())
-          db_regex.compile_regexes(regexes);
-        if (!literals.empty())
-          db_literal.compile_literals(literals, regexes.size());
-        if (!mutexes.empty())
-          db_mutex.compile_regexes(mutexes);
+        // Previous results of changed rules which are no longer reported (they can't match anymore) are retracted too
+        auto retracted_rules = std::move(delta.deleted);
+        for (const auto& rule : ruleset)
+        {
+            if (delta.changed.contains(rule->getName()) && !rule->isPrivate() && !optimizer.is_rule_alive(rule->getName()))
+                retracted_rules.push_back(rule->getName());
+        }
 
-        Codegen codegen(&extractor);
-        codegen.generate(ruleset.get());
+        if (options.backend == Backend::Bytecode)
+        {
+            // Bytecode ruleset is a single file with HyperScan databases embedded which is appended to the interpreter library
+            BytecodeGenerator generator(&extractor, &optimizer);
+            generator.set_retracted_rules(std::move(retracted_rules));
+            run_stage("bytecode generation", [&]() { generator.generate(ruleset); });
 
-        std::ofstream rules(std::filesystem::path{ruleset_file_path}.parent_path() / "rules.def");
+            run_stage("waiting for databases", [&]() { ThreadPool::wait_all(compilations); });
+
+            auto& compiled = generator.get_ruleset();
+            if (!regexes.empty())
+                compiled.regex_db = databases.front().regex.serialize();
+            if (!literals.empty())
+                compiled.literal_db = databases.front().literal.serialize();
+            if (!mutexes.empty())
+                compiled.mutex_db = databases.front().mutex.serialize();
+
+            auto data = bytecode::serialize(compiled);
+            std::ofstream bytecode_file(options.output + ".ybc", std::ios::binary);
+            bytecode_file.write(data.data(), data.size());
+            return 0;
+        }
+
+        Codegen codegen(&extractor, &optimizer, &thread_pool);
+        codegen.set_retracted_rules(std::move(retracted_rules));
+        codegen.set_max_widths(literal_max_width, regex_split.max_width);
+
+        // Widths are indexed by pattern IDs, literals follow the regexes
+        std::vector<std::uint64_t> pattern_widths;
+        for (auto width : regex_split.widths)
+            pattern_widths.push_back(width == hspp::Database::UnboundedWidth ? PrefixAnalyzer::WholeData : width);
+        for (const auto& literal : literals)
+            pattern_widths.push_back(literal->get_pattern().length());
+
+        auto prefix_size = PrefixAnalyzer::WholeData;
+        run_stage("prefix analysis", [&]() { prefix_size = PrefixAnalyzer(&extractor, &optimizer, std::move(pattern_widths)).analyze(ruleset); });
+        if (prefix_size != PrefixAnalyzer::WholeData)
+            std::cout << "Rules observe only the first " << prefix_size << " bytes of data\n";
+        codegen.set_prefix_size(prefix_size);
+        codegen.set_profiling(options.stats);
+        run_stage("code generation", [&]() { codegen.generate(ruleset, options.shards); });
+
+        run_stage("waiting for databases", [&]() { ThreadPool::wait_all(compilations); });
+
+        std::ofstream rules_header(output_dir / "rules.hpp");
+        rules_header << "#pragma once\n\n" << codegen.get_header() << std::endl;
+        rules_header.close();
+
+        auto shards = codegen.get_shards();
+        for (std::size_t i = 0; i < shards.size(); ++i)
+        {
+            std::ofstream rules_shard(output_dir / ("rules_" + std::to_string(i) + ".cpp"));
+            rules_shard << shards[i] << std::endl;
+        }
+
+        std::ofstream rules(output_dir / "rules.def");
         rules << codegen.get_result() << std::endl;
         rules.close();
 
-        if (!regexes.empty())
-          db_regex.save(ruleset_file_path + ".regex.db");
-        if (!literals.empty())
-          db_literal.save(ruleset_file_path + ".literal.db");
-        if (!mutexes.empty())
-          db_mutex.save(ruleset_file_path + ".mutex.db");
+        for (const auto& dbs : databases)
+        {
+            if (!regex_split.bounded.empty())
+              dbs.regex.save(dbs.get_path(options.output, "regex"));
+            if (!regex_split.unbounded.empty())
+              dbs.unbounded.save(dbs.get_path(options.output, "unbounded"));
+            if (!literals.empty())
+              dbs.literal.save(dbs.get_path(options.output, "literal"));
+            if (!mutexes.empty())
+              dbs.mutex.save(dbs.get_path(options.output, "mutex"));
+        }
     }
     catch (const yaramod::YaramodError& error)
     {
         std::cerr << error.getErrorMessage() << std::endl;
+        return 1;
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
     }
 
     return 0;
@@ -0,0 +1,229 @@
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <yarang/interpreter.hpp>
+#include <yarangc/bytecode_generator.hpp>
+#include <yarangc/codegen.hpp>
+#include <yarangc/optimizer.hpp>
+#include <yarangc/pattern_extractor.hpp>
+
+using namespace ::testing;
+using namespace yaramod;
+
+class BytecodeTest : public Test
+{
+public:
+    BytecodeTest() : optimizer(), pattern_extractor(&optimizer), generator(&pattern_extractor, &optimizer) {}
+
+    void input(const std::string& rules)
+    {
+        ss << rules;
+        yara_file = yaramod.parseStream(ss);
+
+        optimizer.optimize(yara_file.get());
+        pattern_extractor.extract(yara_file.get());
+        generator.generate(yara_file.get());
+    }
+
+    const bytecode::Rule& rule(const std::string& name)
+    {
+        return generator.get_ruleset().rules[pattern_extractor.get_rule_info_table().at(name).id];
+    }
+
+    std::uint64_t pattern(const std::string& rule, const std::string& string_id)
+    {
+        return pattern_extractor.get_rule_info_table().at(rule).get_string_id(string_id);
+    }
+
+    // Evaluates all the rules the same way the runtime does after the scan
+    std::vector<std::string> evaluate(const std::string& data, const std::vector<std::pair<std::uint64_t, std::uint64_t>>& matches)
+    {
+        const auto& ruleset = generator.get_ruleset();
+        bytecode::EvalContext ctx(&ruleset);
+        ctx.reset(data.data(), data.size());
+        for (const auto& [id, offset] : matches)
+        {
+            ctx.matches[id].count++;
+            ctx.matches[id].offsets.push_back(offset);
+            ctx.matches[id].lengths.push_back(1);
+        }
+
+        bytecode::Interpreter interpreter(&ruleset);
+        std::vector<std::string> result;
+        if (!interpreter.evaluate_prescan_global_rules(ctx))
+            return result;
+
+        interpreter.evaluate_rules(ctx);
+        for (std::size_t id = 0; id < ruleset.rules.size(); ++id)
+        {
+            if ((ruleset.rules[id].flags & bytecode::RuleFlags::Reported) && ctx.rule_matches[id])
+                result.push_back(ruleset.rules[id].name);
+        }
+        return result;
+    }
+
+    Optimizer optimizer;
+    PatternExtractor pattern_extractor;
+    BytecodeGenerator generator;
+    Yaramod yaramod;
+    std::stringstream ss;
+    std::unique_ptr<YaraFile> yara_file;
+};
+
+TEST_F(BytecodeTest,
+StringsAndOperators) {
+    input(R"(
+rule abc {
+strings:
+    $a = "abc"
+    $b = "def"
+condition:
+    $a and ($b or filesize > 10)
+}
+)");
+
+    EXPECT_EQ(evaluate("short", {{pattern("abc", "$a"), 0}}), std::vector<std::string>{});
+    EXPECT_EQ(evaluate("long enough data", {{pattern("abc", "$a"), 0}}), std::vector<std::string>{"abc"});
+    EXPECT_EQ(evaluate("short", {{pattern("abc", "$a"), 0}, {pattern("abc", "$b"), 3}}), std::vector<std::string>{"abc"});
+}
+
+TEST_F(BytecodeTest,
+OffsetsAndLoops) {
+    input(R"(
+rule abc {
+strings:
+    $a = "abc"
+    $b = "def"
+condition:
+    for all of ($a, $b) : (@ < 10) and @a[1] == 2 and #b == 1
+}
+
+rule def {
+condition:
+    for any i in (0 .. filesize) : (uint16be(i) == 0x4142)
+}
+)");
+
+    EXPECT_EQ(evaluate("xxxxxxxxxxxx", {{pattern("abc", "$a"), 2}, {pattern("abc", "$b"), 5}}), std::vector<std::string>{"abc"});
+    EXPECT_EQ(evaluate("xxxxxxxxxxxx", {{pattern("abc", "$a"), 2}, {pattern("abc", "$b"), 11}}), std::vector<std::string>{});
+    EXPECT_EQ(evaluate("xxxABxx", {}), std::vector<std::string>{"def"});
+}
+
+TEST_F(BytecodeTest,
+PrivateRulesAreInlinedOrHidden) {
+    input(R"(
+private rule inlined {
+strings:
+    $a = "abc"
+condition:
+    $a
+}
+
+private rule shared {
+condition:
+    filesize > 2
+}
+
+rule abc {
+condition:
+    inlined and shared
+}
+
+rule def {
+condition:
+    shared
+}
+)");
+
+    EXPECT_EQ(rule("inlined").entry, bytecode::NoEntry);
+    EXPECT_NE(rule("shared").entry, bytecode::NoEntry);
+    EXPECT_EQ(rule("shared").flags & bytecode::RuleFlags::Reported, 0u);
+    EXPECT_EQ(rule("abc").flags & bytecode::RuleFlags::Reported, bytecode::RuleFlags::Reported);
+
+    EXPECT_EQ(evaluate("data", {{pattern("inlined", "$a"), 0}}), (std::vector<std::string>{"abc", "def"}));
+    EXPECT_EQ(evaluate("data", {}), std::vector<std::string>{"def"});
+}
+
+TEST_F(BytecodeTest,
+GlobalRulesGateTheRest) {
+    input(R"(
+global rule header {
+condition:
+    uint16(0) == 0x5a4d
+}
+
+rule abc {
+strings:
+    $a = "abc"
+condition:
+    $a
+}
+)");
+
+    EXPECT_EQ(rule("header").flags & bytecode::RuleFlags::Global, bytecode::RuleFlags::Global);
+    EXPECT_EQ(evaluate("MZabc", {{pattern("abc", "$a"), 2}}), (std::vector<std::string>{"header", "abc"}));
+    EXPECT_EQ(evaluate("ZMabc", {{pattern("abc", "$a"), 2}}), std::vector<std::string>{});
+}
+
+TEST_F(BytecodeTest,
+SerializationRoundtrip) {
+    input(R"(
+rule abc {
+strings:
+    $a = "abc"
+condition:
+    $a and filesize < 0x100000000000000
+}
+)");
+    generator.set_retracted_rules({"removed"});
+
+    auto data = bytecode::serialize(generator.get_ruleset());
+    auto loaded = bytecode::deserialize(data.data(), data.size());
+    EXPECT_EQ(loaded.code, generator.get_ruleset().code);
+    EXPECT_EQ(loaded.rules.size(), generator.get_ruleset().rules.size());
+    EXPECT_EQ(loaded.retracted_rules, std::vector<std::string>{"removed"});
+    EXPECT_EQ(loaded.pattern_count, 1u);
+}
+
+TEST_F(BytecodeTest,
+ReportedRulesCarryMetadata) {
+    input(R"(
+rule abc : first second {
+meta:
+    author = "someone"
+strings:
+    $a = "abc"
+condition:
+    $a
+}
+)");
+
+    EXPECT_EQ(rule("abc").tags, (std::vector<std::string>{"first", "second"}));
+    EXPECT_EQ(rule("abc").metas, (std::vector<std::pair<std::string, std::string>>{{"author", "someone"}}));
+    ASSERT_EQ(rule("abc").strings.size(), 1u);
+    EXPECT_EQ(rule("abc").strings[0].first, "$a");
+    EXPECT_EQ(rule("abc").strings[0].second, pattern("abc", "$a"));
+}
+
+TEST_F(BytecodeTest,
+BackendsAgreeOnQuantifiers) {
+    ss << R"(
+rule abc {
+strings:
+    $a = "abc"
+    $b = "def"
+    $c = "ghi"
+condition:
+    2 of ($a, $b, $c) and #a of ($b, $c)
+}
+)";
+    yara_file = yaramod.parseStream(ss);
+    optimizer.optimize(yara_file.get());
+    pattern_extractor.extract(yara_file.get());
+
+    // Computed count isn't supported by either of them instead of being evaluated differently
+    Codegen codegen(&pattern_extractor, &optimizer);
+    EXPECT_THROW(codegen.generate(yara_file->getRules()[0].get()), std::runtime_error);
+    EXPECT_THROW(generator.generate(yara_file.get()), std::runtime_error);
+}
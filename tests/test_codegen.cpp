@@ -4,6 +4,7 @@
 
 #include <yarangc/codegen.hpp>
 #include <yarangc/pattern_extractor.hpp>
+#include <yarangc/thread_pool.hpp>
 
 using namespace ::testing;
 using namespace yaramod;
@@ -58,7 +59,7 @@ True) {
     input("true");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return true;\n"
         "}"
@@ -70,7 +71,7 @@ False) {
     input("false");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return false;\n"
         "}"
@@ -82,7 +83,7 @@ StringId) {
     input("$s01", R"($s01 = "abc")");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return match_string(ctx, 0ul);\n"
         "}"
@@ -94,7 +95,7 @@ StringCount) {
     input("#s01 > 0", R"($s01 = "abc")");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return match_count(ctx, 0ul) > 0ul;\n"
         "}"
@@ -106,7 +107,7 @@ StringOffset) {
     input("@s01 > 0", R"($s01 = "abc")");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return match_offset(ctx, 0ul) > 0ul;\n"
         "}"
@@ -118,7 +119,7 @@ StringOffsetIndex) {
     input("@s01[1] > 0", R"($s01 = "abc")");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return match_offset(ctx, 0ul, 1ul - 1ul) > 0ul;\n"
         "}"
@@ -130,7 +131,7 @@ StringLength) {
     input("!s01 > 0", R"($s01 = "abc")");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return match_length(ctx, 0ul) > 0ul;\n"
         "}"
@@ -142,7 +143,7 @@ StringLengthIndex) {
     input("!s01[1] > 0", R"($s01 = "abc")");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return match_length(ctx, 0ul, 1ul - 1ul) > 0ul;\n"
         "}"
@@ -154,7 +155,7 @@ StringAt) {
     input("$s01 at 0x100", R"($s01 = "abc")");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return match_at(ctx, 0ul, 256ul);\n"
         "}"
@@ -166,7 +167,7 @@ StringIn) {
     input("$s01 in (0x100 .. 0x200)", R"($s01 = "abc")");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return match_in(ctx, 0ul, 256ul, 512ul);\n"
         "}"
@@ -182,7 +183,7 @@ AnyOfThem) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return of(ctx, 1ul, 0ul, 1ul, 2ul);\n"
         "}"
@@ -198,7 +199,7 @@ TwoOfThem) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return of(ctx, 2ul, 0ul, 1ul, 2ul);\n"
         "}"
@@ -214,7 +215,7 @@ AllOfThem) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return of(ctx, 3ul, 0ul, 1ul, 2ul);\n"
         "}"
@@ -230,7 +231,7 @@ AnyOfSome) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return of(ctx, 1ul, 0ul, 1ul);\n"
         "}"
@@ -246,7 +247,7 @@ TwoOfSome) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return of(ctx, 2ul, 0ul, 1ul);\n"
         "}"
@@ -262,7 +263,7 @@ AllOfSome) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return of(ctx, 2ul, 0ul, 1ul);\n"
         "}"
@@ -278,7 +279,7 @@ AnyOfWildcard) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return of(ctx, 1ul, 0ul);\n"
         "}"
@@ -294,7 +295,7 @@ TwoOfWildcard) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return of(ctx, 1ul, 0ul);\n"
         "}"
@@ -310,7 +311,7 @@ AllOfWildcard) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return of(ctx, 1ul, 0ul);\n"
         "}"
@@ -326,7 +327,7 @@ ForLoopOverStrings) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return loop(ctx, 2ul, [](auto ctx, auto&& vars, auto id) {\n"
         "return match_at(ctx, id, 1280ul);\n"
@@ -342,7 +343,7 @@ ForLoopOverIntEnum) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return loop_ints(ctx, 2ul, [](auto ctx, auto&& vars, auto id) {\n"
         "return match_at(ctx, 0ul, 1280ul + std::get<0>(vars));\n"
@@ -358,7 +359,7 @@ ForLoopOverIntRange) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return loop_range(ctx, 2ul, [](auto ctx, auto&& vars, auto id) {\n"
         "return match_at(ctx, 0ul, std::get<0>(vars));\n"
@@ -374,7 +375,7 @@ ForLoopOverIntsNested) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return loop_range(ctx, 1ul, [](auto ctx, auto&& vars, auto id) {\n"
         "return loop_ints(ctx, 1ul, std::move(vars), [](auto ctx, auto&& vars, auto id) {\n"
@@ -393,7 +394,7 @@ ForLoopOverStringsNested) {
     );
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return loop_range(ctx, 1ul, [](auto ctx, auto&& vars, auto id) {\n"
         "return loop(ctx, 2ul, std::move(vars), [](auto ctx, auto&& vars, auto id) {\n"
@@ -409,7 +410,7 @@ ReadInt8) {
     input("int8(0x10) == 0x80");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Little, std::int8_t>(ctx, 16ul) == 128ul;\n"
         "}"
@@ -421,7 +422,7 @@ ReadUInt8) {
     input("uint8(0x10) == 0x80");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Little, std::uint8_t>(ctx, 16ul) == 128ul;\n"
         "}"
@@ -433,7 +434,7 @@ ReadInt16ul) {
     input("int16(0x10) == 0x160");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Little, std::int16_t>(ctx, 16ul) == 352ul;\n"
         "}"
@@ -445,7 +446,7 @@ ReadUInt16ul) {
     input("uint16(0x10) == 0x160");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Little, std::uint16_t>(ctx, 16ul) == 352ul;\n"
         "}"
@@ -457,7 +458,7 @@ ReadInt32) {
     input("int32(0x10) == 0x320");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Little, std::int32_t>(ctx, 16ul) == 800ul;\n"
         "}"
@@ -469,7 +470,7 @@ ReadUInt32) {
     input("uint32(0x10) == 0x320");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Little, std::uint32_t>(ctx, 16ul) == 800ul;\n"
         "}"
@@ -481,7 +482,7 @@ ReadInt8Be) {
     input("int8be(0x10) == 0x80");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Big, std::int8_t>(ctx, 16ul) == 128ul;\n"
         "}"
@@ -493,7 +494,7 @@ ReadUInt8Be) {
     input("uint8be(0x10) == 0x80");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Big, std::uint8_t>(ctx, 16ul) == 128ul;\n"
         "}"
@@ -505,7 +506,7 @@ ReadInt16Be) {
     input("int16be(0x10) == 0x160");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Big, std::int16_t>(ctx, 16ul) == 352ul;\n"
         "}"
@@ -517,7 +518,7 @@ ReadUInt16Be) {
     input("uint16be(0x10) == 0x160");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Big, std::uint16_t>(ctx, 16ul) == 352ul;\n"
         "}"
@@ -529,7 +530,7 @@ ReadInt32Be) {
     input("int32be(0x10) == 0x320");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Big, std::int32_t>(ctx, 16ul) == 800ul;\n"
         "}"
@@ -541,7 +542,7 @@ ReadUInt32Be) {
     input("uint32be(0x10) == 0x320");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return read_data<Endian::Big, std::uint32_t>(ctx, 16ul) == 800ul;\n"
         "}"
@@ -554,9 +555,149 @@ CuckooSyncMutex) {
     input("cuckoo.sync.mutex(/^abc$/)");
 
     EXPECT_EQ(result,
-        "static bool rule_abc(const ScanContext* ctx)\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
         "{\n"
         "return get_mutex_match(ctx, 0ul) > 0;\n"
         "}"
     );
 }
+
+TEST_F(CodegenTest,
+Shards) {
+    ss << R"(
+rule a {
+condition:
+    filesize > 10 and filesize < 1000
+}
+
+rule b {
+condition:
+    true
+}
+
+rule c {
+condition:
+    filesize == 5
+}
+)";
+    ruleset = yaramod.parseStream(ss);
+    pattern_extractor.extract(ruleset.get());
+    codegen.generate(ruleset.get(), 2);
+
+    EXPECT_EQ(codegen.get_shards(), (std::vector<std::string>{
+        "#include \"ruleset.yar.hpp\"\n"
+        "\n"
+        "bool rule_a(const ScanContext* ctx)\n"
+        "{\n"
+        "return filesize(ctx) > 10ul\n"
+        "&& filesize(ctx) < 1000ul;\n"
+        "}",
+        "#include \"ruleset.yar.hpp\"\n"
+        "\n"
+        "bool rule_b(const ScanContext* ctx)\n"
+        "{\n"
+        "return true;\n"
+        "}\n"
+        "\n"
+        "bool rule_c(const ScanContext* ctx)\n"
+        "{\n"
+        "return filesize(ctx) == 5ul;\n"
+        "}"
+    }));
+    EXPECT_NE(codegen.get_header().find(
+        "bool rule_a(const ScanContext* ctx);\n"
+        "bool rule_b(const ScanContext* ctx);\n"
+        "bool rule_c(const ScanContext* ctx);\n"
+    ), std::string::npos);
+}
+
+TEST_F(CodegenTest,
+ParallelGenerationIsDeterministic) {
+    for (int i = 0; i < 20; ++i)
+    {
+        ss << "rule r" << i << " {\n"
+            << "strings:\n"
+            << "    $a = \"shared\"\n"
+            << "    $b = \"unique" << i << "\"\n"
+            << "    $c = { 01 02 ?? 0" << i % 10 << " }\n"
+            << "condition:\n"
+            << "    $a and ($b or $c)\n"
+            << "}\n";
+    }
+    ruleset = yaramod.parseStream(ss);
+
+    ThreadPool thread_pool(4);
+    PatternExtractor parallel_extractor(nullptr, &thread_pool);
+    Codegen parallel_codegen(&parallel_extractor, nullptr, &thread_pool);
+
+    pattern_extractor.extract(ruleset.get());
+    codegen.generate(ruleset.get(), 3);
+    parallel_extractor.extract(ruleset.get());
+    parallel_codegen.generate(ruleset.get(), 3);
+
+    EXPECT_EQ(parallel_extractor.get_literal_patterns().size(), pattern_extractor.get_literal_patterns().size());
+    EXPECT_EQ(parallel_extractor.get_regex_patterns().size(), pattern_extractor.get_regex_patterns().size());
+    EXPECT_EQ(parallel_codegen.get_header(), codegen.get_header());
+    EXPECT_EQ(parallel_codegen.get_shards(), codegen.get_shards());
+    EXPECT_EQ(parallel_codegen.get_result(), codegen.get_result());
+}
+
+TEST_F(CodegenTest,
+MaxWidthsOfDatabases) {
+    ss << R"(
+rule abc {
+strings:
+    $a = "abc"
+condition:
+    $a
+}
+)";
+    ruleset = yaramod.parseStream(ss);
+
+    pattern_extractor.extract(ruleset.get());
+    codegen.set_max_widths(3, 1024);
+    codegen.generate(ruleset.get());
+
+    EXPECT_NE(codegen.get_result().find(
+        "static constexpr std::uint64_t literal_max_width = 3ul;\n"
+        "static constexpr std::uint64_t regex_max_width = 1024ul;"
+    ), std::string::npos);
+}
+
+TEST_F(CodegenTest,
+ProfilingEvaluatesRulesThroughRuntime) {
+    ss << R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+strings:
+    $a = "abc"
+condition:
+    $a and helper
+}
+
+rule def {
+strings:
+    $d = "def"
+condition:
+    $d or helper
+}
+)";
+    ruleset = yaramod.parseStream(ss);
+
+    pattern_extractor.extract(ruleset.get());
+    codegen.set_profiling(true);
+    codegen.generate(ruleset.get());
+
+    const auto& result = codegen.get_result();
+    EXPECT_NE(result.find("static constexpr bool profiling = true;"), std::string::npos);
+    EXPECT_NE(result.find("ctx->rule_matches[0] = profile_rule(ctx, 0, &rule_helper);\n"), std::string::npos);
+    EXPECT_NE(result.find("ctx->rule_matches[1] = profile_rule(ctx, 1, &rule_abc);\n"), std::string::npos);
+    // Private rules get their metadata too so all the patterns can be named
+    EXPECT_NE(result.find("Rule{\"helper\", RuleVisibility::Private, \"\""), std::string::npos);
+}
@@ -0,0 +1,49 @@
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <hspp/database_cache.hpp>
+
+using namespace ::testing;
+
+class DatabaseCacheTest : public Test
+{
+public:
+    DatabaseCacheTest() : directory(std::filesystem::temp_directory_path() / ("yarang_cache_test_" + std::to_string(::getpid()))) {}
+    ~DatabaseCacheTest() { std::filesystem::remove_all(directory); }
+
+    std::filesystem::path directory;
+};
+
+TEST(Fnv1aTest,
+KnownValues) {
+    EXPECT_EQ(hspp::Fnv1a{}.digest(), 0xcbf29ce484222325ull);
+    EXPECT_EQ(hspp::Fnv1a{}.update("a", 1).digest(), 0xaf63dc4c8601ec8cull);
+}
+
+TEST(Fnv1aTest,
+StringLengthIsPartOfHash) {
+    auto lhs = hspp::Fnv1a{}.update(std::string{"ab"}).update(std::string{"c"}).digest();
+    auto rhs = hspp::Fnv1a{}.update(std::string{"a"}).update(std::string{"bc"}).digest();
+    EXPECT_NE(lhs, rhs);
+}
+
+TEST_F(DatabaseCacheTest,
+MissingEntry) {
+    hspp::DatabaseCache cache(directory);
+    EXPECT_FALSE(cache.load(0x1234).has_value());
+}
+
+TEST_F(DatabaseCacheTest,
+StoreAndLoad) {
+    hspp::DatabaseCache cache(directory);
+    std::vector<char> data{'a', 'b', '\0', 'c'};
+
+    cache.store(0x1234, data);
+
+    EXPECT_EQ(cache.get_path(0x1234).filename(), "0000000000001234.db");
+    EXPECT_EQ(cache.load(0x1234), data);
+    EXPECT_FALSE(cache.load(0x1235).has_value());
+}
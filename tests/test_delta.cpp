@@ -0,0 +1,199 @@
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <yarangc/delta.hpp>
+#include <yarangc/optimizer.hpp>
+
+using namespace ::testing;
+using namespace yaramod;
+
+class DeltaTest : public Test
+{
+public:
+    void input(const std::string& base_rules, const std::string& rules)
+    {
+        std::stringstream base_ss{base_rules};
+        base_ruleset = yaramod.parseStream(base_ss);
+        std::stringstream ss{rules};
+        ruleset = yaramod.parseStream(ss);
+
+        delta = compute_delta(base_ruleset.get(), ruleset.get());
+        optimizer.set_reported_rules(delta.changed);
+        optimizer.optimize(ruleset.get());
+    }
+
+    Optimizer optimizer;
+    RulesetDelta delta;
+
+    Yaramod yaramod;
+    std::unique_ptr<YaraFile> base_ruleset;
+    std::unique_ptr<YaraFile> ruleset;
+};
+
+TEST_F(DeltaTest,
+OnlyChangedRulesAreReported) {
+    input(R"(
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+
+rule def {
+strings:
+    $s01 = "def"
+condition:
+    $s01
+}
+)", R"(
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+
+rule def {
+strings:
+    $s01 = "def2"
+condition:
+    $s01
+}
+
+rule ghi {
+strings:
+    $s01 = "ghi"
+condition:
+    $s01
+}
+)");
+
+    EXPECT_EQ(delta.changed, (std::unordered_set<std::string>{"def", "ghi"}));
+    EXPECT_TRUE(delta.deleted.empty());
+
+    EXPECT_FALSE(optimizer.is_rule_alive("abc"));
+    EXPECT_TRUE(optimizer.is_rule_alive("def"));
+    EXPECT_TRUE(optimizer.is_rule_alive("ghi"));
+
+    ASSERT_EQ(optimizer.get_removed_rules().size(), 1u);
+    EXPECT_EQ(optimizer.get_removed_rules()[0].name, "abc");
+    EXPECT_EQ(optimizer.get_removed_rules()[0].reason, RemovalReason::Unchanged);
+}
+
+TEST_F(DeltaTest,
+ChangeOfReferencedRulePropagates) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+condition:
+    helper
+}
+
+rule def {
+condition:
+    filesize > 100
+}
+
+rule removed {
+condition:
+    filesize > 200
+}
+)", R"(
+private rule helper {
+strings:
+    $h = "helper2"
+condition:
+    $h
+}
+
+rule abc {
+condition:
+    helper
+}
+
+rule def {
+condition:
+    filesize > 100
+}
+)");
+
+    EXPECT_EQ(delta.changed, (std::unordered_set<std::string>{"helper", "abc"}));
+    EXPECT_EQ(delta.deleted, (std::vector<std::string>{"removed"}));
+
+    EXPECT_TRUE(optimizer.is_rule_alive("helper"));
+    EXPECT_TRUE(optimizer.is_rule_alive("abc"));
+    EXPECT_FALSE(optimizer.is_rule_alive("def"));
+}
+
+TEST_F(DeltaTest,
+UnchangedDependencyIsKept) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+condition:
+    helper
+}
+)", R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+condition:
+    helper and filesize > 100
+}
+)");
+
+    EXPECT_EQ(delta.changed, (std::unordered_set<std::string>{"abc"}));
+    EXPECT_TRUE(optimizer.is_rule_alive("helper"));
+    EXPECT_TRUE(optimizer.is_string_alive("helper", "$h"));
+}
+
+TEST_F(DeltaTest,
+ChangedGlobalRuleChangesEverything) {
+    input(R"(
+global rule small {
+condition:
+    filesize < 1000
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+)", R"(
+global rule small {
+condition:
+    filesize < 2000
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+)");
+
+    EXPECT_EQ(delta.changed, (std::unordered_set<std::string>{"small", "abc"}));
+    EXPECT_TRUE(optimizer.is_rule_alive("abc"));
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include <yarangc/externals.hpp>
+
+using namespace ::testing;
+
+class ExternalsTest : public Test {};
+
+TEST_F(ExternalsTest,
+ParseBoolBinding) {
+    auto binding = parse_external_binding("is_pe=true");
+
+    EXPECT_EQ(binding.name, "is_pe");
+    EXPECT_EQ(binding.value, ExternalValue{true});
+}
+
+TEST_F(ExternalsTest,
+ParseIntBinding) {
+    EXPECT_EQ(parse_external_binding("threshold=10").value, ExternalValue{std::uint64_t{10}});
+    EXPECT_EQ(parse_external_binding("threshold=0x10").value, ExternalValue{std::uint64_t{16}});
+    EXPECT_EQ(parse_external_binding("threshold=010").value, ExternalValue{std::uint64_t{10}});
+    EXPECT_EQ(parse_external_binding("threshold=-1").value, ExternalValue{std::int64_t{-1}});
+    EXPECT_EQ(parse_external_binding("threshold=-0x10").value, ExternalValue{std::int64_t{-16}});
+    EXPECT_EQ(parse_external_binding("threshold=10abc").value, ExternalValue{std::string{"10abc"}});
+    EXPECT_THROW(parse_external_binding("threshold=99999999999999999999"), std::runtime_error);
+}
+
+TEST_F(ExternalsTest,
+ParseStringBinding) {
+    EXPECT_EQ(parse_external_binding("filetype=pe").value, ExternalValue{std::string{"pe"}});
+    EXPECT_EQ(parse_external_binding("filetype=\"10\"").value, ExternalValue{std::string{"10"}});
+    EXPECT_EQ(parse_external_binding("filetype=").value, ExternalValue{std::string{}});
+}
+
+TEST_F(ExternalsTest,
+ParseInvalidBinding) {
+    EXPECT_THROW(parse_external_binding("filetype"), std::runtime_error);
+    EXPECT_THROW(parse_external_binding("=pe"), std::runtime_error);
+    EXPECT_THROW(parse_external_binding("1abc=pe"), std::runtime_error);
+    EXPECT_THROW(parse_external_binding("them=1"), std::runtime_error);
+    EXPECT_THROW(parse_external_binding("all=1"), std::runtime_error);
+    EXPECT_THROW(parse_external_binding("filesize=10"), std::runtime_error);
+}
+
+TEST_F(ExternalsTest,
+StringLiteral) {
+    EXPECT_EQ(external_value_to_literal(std::string{"a\"b\\c\n"}), R"("a\"b\\c\x0A")");
+}
+
+TEST_F(ExternalsTest,
+BindOnlyInsideCondition) {
+    ExternalBindings bindings{{"filetype", std::string{"pe"}}, {"a", std::uint64_t{5}}};
+
+    auto result = bind_externals(R"(
+rule filetype {
+meta:
+    filetype = "filetype"
+strings:
+    $a = "filetype" // filetype
+    $b = /filetype{1,2}/ nocase
+    $c = { AB [1-2] CD }
+condition:
+    filetype == "pe" and $a at a and #a > a and pe.filetype and /* filetype */ filetype contains "filetype"
+}
+)", bindings);
+
+    EXPECT_EQ(result, R"(
+rule filetype {
+meta:
+    filetype = "filetype"
+strings:
+    $a = "filetype" // filetype
+    $b = /filetype{1,2}/ nocase
+    $c = { AB [1-2] CD }
+condition:
+    "pe" == "pe" and $a at 5 and #a > 5 and pe.filetype and /* filetype */ "pe" contains "filetype"
+}
+)");
+}
+
+TEST_F(ExternalsTest,
+LoopVariablesAreNotBound) {
+    ExternalBindings bindings{{"i", std::uint64_t{5}}, {"j", std::uint64_t{6}}, {"n", std::uint64_t{2}}};
+
+    auto result = bind_externals(R"(
+rule abc {
+condition:
+    for n i, j in (1 .. 3) : ( i + j > n ) and for all of them : ( $ )
+}
+rule def {
+condition:
+    i == j
+}
+)", bindings);
+
+    EXPECT_EQ(result, R"(
+rule abc {
+condition:
+    for 2 i, j in (1 .. 3) : ( i + j > 2 ) and for all of them : ( $ )
+}
+rule def {
+condition:
+    5 == 6
+}
+)");
+}
+
+TEST_F(ExternalsTest,
+BindNegativeInt) {
+    ExternalBindings bindings{{"x", std::int64_t{-1}}};
+    EXPECT_EQ(bind_externals("rule abc { condition: x == -1 }", bindings), "rule abc { condition: -1 == -1 }");
+}
@@ -0,0 +1,261 @@
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <yarang/bytecode.hpp>
+#include <yarang/interpreter.hpp>
+
+using namespace ::testing;
+using namespace bytecode;
+
+class InterpreterTest : public Test
+{
+public:
+    // Each rule is given by its own code with jump targets relative to its start, rules are laid out one after another
+    void input(std::initializer_list<std::vector<std::uint64_t>> rules, std::uint64_t pattern_count = 4)
+    {
+        ruleset.pattern_count = pattern_count;
+        for (const auto& code : rules)
+        {
+            auto entry = ruleset.code.size();
+            ruleset.rules.push_back({"rule_" + std::to_string(ruleset.rules.size()), RuleFlags::Reported, entry});
+            ruleset.code.insert(ruleset.code.end(), code.begin(), code.end());
+            relocate(entry);
+        }
+    }
+
+    void relocate(std::uint64_t entry)
+    {
+        for (auto pc = entry; pc < ruleset.code.size(); ++pc)
+        {
+            auto opcode = get_opcode(ruleset.code[pc]);
+            auto operand = get_operand(ruleset.code[pc]);
+            switch (opcode)
+            {
+                case Opcode::JumpIfFalse:
+                case Opcode::JumpIfTrue:
+                case Opcode::LoopRange:
+                case Opcode::LoopNext:
+                    ruleset.code[pc] = encode(opcode, entry + operand);
+                    break;
+                case Opcode::LoopSet:
+                    ruleset.code[pc++] = encode(opcode, entry + operand);
+                    break;
+                case Opcode::PushWide:
+                    pc++;
+                    break;
+                case Opcode::Of:
+                    pc += operand + 1;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    bool evaluate(std::uint64_t id, const std::string& data = {})
+    {
+        ctx_data = data;
+        EvalContext ctx(&ruleset);
+        ctx.reset(ctx_data.data(), ctx_data.size());
+        for (const auto& [pattern, offset] : matches)
+        {
+            ctx.matches[pattern].count++;
+            ctx.matches[pattern].offsets.push_back(offset);
+            ctx.matches[pattern].lengths.push_back(1);
+        }
+
+        Interpreter interpreter(&ruleset);
+        return interpreter.evaluate_rule(ctx, id);
+    }
+
+    void match(std::uint64_t pattern, std::uint64_t offset)
+    {
+        matches.emplace_back(pattern, offset);
+    }
+
+    Ruleset ruleset;
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> matches;
+    std::string ctx_data;
+};
+
+TEST_F(InterpreterTest,
+ArithmeticAndComparison) {
+    input({
+        {encode(Opcode::Push, 2), encode(Opcode::Push, 3), encode(Opcode::Add), encode(Opcode::Push, 4), encode(Opcode::Mul), encode(Opcode::Push, 20), encode(Opcode::Eq), encode(Opcode::Return)},
+        {encode(Opcode::Push, 7), encode(Opcode::Push, 0), encode(Opcode::Mod), encode(Opcode::PushWide), Undefined, encode(Opcode::Eq), encode(Opcode::Return)},
+        {encode(Opcode::Push, 1), encode(Opcode::Push, 2), encode(Opcode::Ge), encode(Opcode::Return)}
+    });
+
+    EXPECT_TRUE(evaluate(0));
+    EXPECT_TRUE(evaluate(1));
+    EXPECT_FALSE(evaluate(2));
+}
+
+TEST_F(InterpreterTest,
+ShortCircuitKeepsResult) {
+    // false and <invalid instruction>
+    input({
+        {encode(Opcode::Push, 0), encode(Opcode::JumpIfFalse, 3), 0xFF, encode(Opcode::Return)},
+        {encode(Opcode::Push, 1), encode(Opcode::JumpIfTrue, 3), 0xFF, encode(Opcode::Return)},
+        {encode(Opcode::Push, 1), encode(Opcode::JumpIfFalse, 4), encode(Opcode::Push, 0), encode(Opcode::Not), encode(Opcode::Return)}
+    });
+
+    EXPECT_FALSE(evaluate(0));
+    EXPECT_TRUE(evaluate(1));
+    EXPECT_TRUE(evaluate(2));
+}
+
+TEST_F(InterpreterTest,
+StringMatches) {
+    input({
+        {encode(Opcode::MatchString, 0), encode(Opcode::Return)},
+        {encode(Opcode::MatchCount, 1), encode(Opcode::Push, 2), encode(Opcode::Eq), encode(Opcode::Return)},
+        {encode(Opcode::Push, 20), encode(Opcode::MatchAt, 1), encode(Opcode::Return)},
+        {encode(Opcode::Push, 0), encode(Opcode::Push, 15), encode(Opcode::MatchIn, 1), encode(Opcode::Return)},
+        {encode(Opcode::Push, 1), encode(Opcode::MatchOffset, 1), encode(Opcode::Push, 20), encode(Opcode::Eq), encode(Opcode::Return)},
+        {encode(Opcode::Push, 2), encode(Opcode::MatchOffset, 1), encode(Opcode::PushWide), Undefined, encode(Opcode::Eq), encode(Opcode::Return)}
+    });
+    match(1, 10);
+    match(1, 20);
+
+    EXPECT_FALSE(evaluate(0));
+    EXPECT_TRUE(evaluate(1));
+    EXPECT_TRUE(evaluate(2));
+    EXPECT_TRUE(evaluate(3));
+    EXPECT_TRUE(evaluate(4));
+    EXPECT_TRUE(evaluate(5));
+}
+
+TEST_F(InterpreterTest,
+Of) {
+    input({
+        {encode(Opcode::Of, 3), 1, 0, 1, 2, encode(Opcode::Return)},
+        {encode(Opcode::Of, 3), 3, 0, 1, 2, encode(Opcode::Return)},
+        {encode(Opcode::Of, 3), 2, 0, 1, 2, encode(Opcode::Return)}
+    });
+    match(0, 0);
+    match(2, 0);
+
+    EXPECT_TRUE(evaluate(0));
+    EXPECT_FALSE(evaluate(1));
+    EXPECT_TRUE(evaluate(2));
+}
+
+TEST_F(InterpreterTest,
+LoopOverStrings) {
+    // for all of ($a, $b) : (@ < 10)
+    // for any of ($a, $b) : (@ > 10)
+    input({
+        {encode(Opcode::Push, 0), encode(Opcode::Push, 1), encode(Opcode::Push, 2), encode(Opcode::LoopSet, 10), 2,
+            encode(Opcode::Push, 0), encode(Opcode::MatchOffset, LoopStringId), encode(Opcode::Push, 10), encode(Opcode::Lt), encode(Opcode::LoopNext, 5), encode(Opcode::Return)},
+        {encode(Opcode::Push, 0), encode(Opcode::Push, 1), encode(Opcode::Push, 1), encode(Opcode::LoopSet, 10), 2,
+            encode(Opcode::Push, 0), encode(Opcode::MatchOffset, LoopStringId), encode(Opcode::Push, 10), encode(Opcode::Gt), encode(Opcode::LoopNext, 5), encode(Opcode::Return)}
+    });
+    match(0, 5);
+    match(1, 15);
+
+    EXPECT_FALSE(evaluate(0));
+    EXPECT_TRUE(evaluate(1));
+}
+
+TEST_F(InterpreterTest,
+LoopOverRange) {
+    // for any i in (0..filesize) : (uint8(i) == 0x42)
+    // for all i in (0..filesize) : (uint8(i) != 0)
+    input({
+        {encode(Opcode::Push, 0), encode(Opcode::Filesize), encode(Opcode::Push, 1), encode(Opcode::LoopRange, 9),
+            encode(Opcode::LoadVar, 0), encode(Opcode::ReadData, 1), encode(Opcode::Push, 0x42), encode(Opcode::Eq), encode(Opcode::LoopNext, 4), encode(Opcode::Return)},
+        {encode(Opcode::Push, 0), encode(Opcode::Filesize), encode(Opcode::PushWide), ~0ull, encode(Opcode::LoopRange, 10),
+            encode(Opcode::LoadVar, 0), encode(Opcode::ReadData, 1), encode(Opcode::Push, 0), encode(Opcode::Ne), encode(Opcode::LoopNext, 5), encode(Opcode::Return)}
+    });
+
+    EXPECT_TRUE(evaluate(0, "xyB"));
+    EXPECT_FALSE(evaluate(0, "xyz"));
+    EXPECT_FALSE(evaluate(0, ""));
+    EXPECT_TRUE(evaluate(1, "xyz"));
+    EXPECT_FALSE(evaluate(1, std::string{"x\0z", 3}));
+}
+
+TEST_F(InterpreterTest,
+ReadDataEndianness) {
+    input({
+        {encode(Opcode::Push, 0), encode(Opcode::ReadData, 2), encode(Opcode::Push, 0x4241), encode(Opcode::Eq), encode(Opcode::Return)},
+        {encode(Opcode::Push, 0), encode(Opcode::ReadData, 2 | 1 << 8), encode(Opcode::Push, 0x4142), encode(Opcode::Eq), encode(Opcode::Return)},
+        {encode(Opcode::Push, 1), encode(Opcode::ReadData, 4), encode(Opcode::PushWide), Undefined, encode(Opcode::Eq), encode(Opcode::Return)}
+    });
+
+    EXPECT_TRUE(evaluate(0, "AB"));
+    EXPECT_TRUE(evaluate(1, "AB"));
+    EXPECT_TRUE(evaluate(2, "ABCD"));
+}
+
+TEST_F(InterpreterTest,
+NamespacesAreGatedIndependently) {
+    // Namespace of rules 0..1 with global rule 0, namespace of rules 2..3 with global rule 2
+    input({
+        {encode(Opcode::Push, 0), encode(Opcode::Return)},
+        {encode(Opcode::Push, 1), encode(Opcode::Return)},
+        {encode(Opcode::MatchString, 0), encode(Opcode::Return)},
+        {encode(Opcode::LoadRule, 2), encode(Opcode::Return)}
+    });
+    ruleset.rules[0].flags |= RuleFlags::Global;
+    ruleset.rules[2].flags |= RuleFlags::Global;
+    ruleset.namespaces.push_back({0, 2, {0}, {1}});
+    ruleset.namespaces.push_back({2, 4, {}, {2, 3}});
+
+    EvalContext ctx(&ruleset);
+    ctx.reset(nullptr, 0);
+    ctx.matches[0].count = 1;
+
+    Interpreter interpreter(&ruleset);
+    EXPECT_TRUE(interpreter.evaluate_prescan_global_rules(ctx));
+    interpreter.evaluate_rules(ctx);
+    EXPECT_EQ(ctx.rule_matches, (std::vector<std::uint8_t>{0, 0, 1, 1}));
+
+    ctx.reset(nullptr, 0);
+    EXPECT_TRUE(interpreter.evaluate_prescan_global_rules(ctx));
+    interpreter.evaluate_rules(ctx);
+    EXPECT_EQ(ctx.rule_matches, (std::vector<std::uint8_t>{0, 0, 0, 0}));
+}
+
+TEST_F(InterpreterTest,
+SerializedRulesetIsFoundAtTheEnd) {
+    input({
+        {encode(Opcode::PushWide), 1ull << 60, encode(Opcode::Push, 1), encode(Opcode::Gt), encode(Opcode::Return)}
+    });
+    ruleset.retracted_rules = {"old_rule"};
+    ruleset.namespaces.push_back({0, 1, {}, {0}});
+    ruleset.rules[0].ns = "ns";
+    ruleset.rules[0].tags = {"tag"};
+    ruleset.rules[0].metas = {{"author", "someone"}};
+    ruleset.rules[0].strings = {{"$a", 3}};
+    ruleset.literal_db = {'d', 'b'};
+
+    auto payload = serialize(ruleset);
+    std::vector<char> library = {'E', 'L', 'F'};
+    library.insert(library.end(), payload.begin(), payload.end());
+
+    auto loaded = deserialize(library.data(), library.size());
+    EXPECT_EQ(loaded.pattern_count, ruleset.pattern_count);
+    ASSERT_EQ(loaded.rules.size(), 1u);
+    EXPECT_EQ(loaded.rules[0].name, "rule_0");
+    EXPECT_EQ(loaded.rules[0].flags, RuleFlags::Reported);
+    EXPECT_EQ(loaded.rules[0].ns, "ns");
+    EXPECT_EQ(loaded.rules[0].tags, std::vector<std::string>{"tag"});
+    EXPECT_EQ(loaded.rules[0].metas, (std::vector<std::pair<std::string, std::string>>{{"author", "someone"}}));
+    EXPECT_EQ(loaded.rules[0].strings, (std::vector<std::pair<std::string, std::uint64_t>>{{"$a", 3}}));
+    EXPECT_EQ(loaded.retracted_rules, ruleset.retracted_rules);
+    ASSERT_EQ(loaded.namespaces.size(), 1u);
+    EXPECT_EQ(loaded.namespaces[0].schedule, std::vector<std::uint64_t>{0});
+    EXPECT_EQ(loaded.code, ruleset.code);
+    EXPECT_EQ(loaded.literal_db, ruleset.literal_db);
+    EXPECT_TRUE(loaded.regex_db.empty());
+
+    ruleset = std::move(loaded);
+    EXPECT_TRUE(evaluate(0));
+
+    EXPECT_THROW(deserialize(library.data(), library.size() - 1), std::runtime_error);
+}
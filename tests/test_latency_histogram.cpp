@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <limits>
+
+#include <gtest/gtest.h>
+
+#include <yarang/latency_histogram.hpp>
+
+using namespace ::testing;
+
+class LatencyHistogramTest : public Test {};
+
+TEST_F(LatencyHistogramTest,
+EmptyHistogram) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.get_count(), 0u);
+    EXPECT_EQ(histogram.get_max(), 0u);
+    EXPECT_EQ(histogram.get_percentile(0.5), 0u);
+}
+
+TEST_F(LatencyHistogramTest,
+SmallValuesAreExact) {
+    LatencyHistogram histogram;
+    for (std::uint64_t value = 1; value <= 10; ++value)
+        histogram.record(value);
+
+    EXPECT_EQ(histogram.get_count(), 10u);
+    EXPECT_EQ(histogram.get_total(), 55u);
+    EXPECT_EQ(histogram.get_percentile(0.5), 5u);
+    EXPECT_EQ(histogram.get_percentile(0.9), 9u);
+    EXPECT_EQ(histogram.get_percentile(1.0), 10u);
+}
+
+TEST_F(LatencyHistogramTest,
+LargeValuesWithinPrecision) {
+    LatencyHistogram histogram;
+    for (std::uint64_t value = 1; value <= 1000; ++value)
+        histogram.record(value * 1000);
+
+    auto p50 = histogram.get_percentile(0.5);
+    auto p99 = histogram.get_percentile(0.99);
+    EXPECT_GE(p50, 500000u);
+    EXPECT_LE(p50, 500000u + 500000u / LatencyHistogram::SubBuckets);
+    EXPECT_GE(p99, 990000u);
+    EXPECT_LE(p99, 990000u + 990000u / LatencyHistogram::SubBuckets);
+    EXPECT_EQ(histogram.get_percentile(1.0), 1000000u);
+}
+
+TEST_F(LatencyHistogramTest,
+TailIsNotHiddenByMedian) {
+    LatencyHistogram histogram;
+    for (int i = 0; i < 998; ++i)
+        histogram.record(10);
+    histogram.record(50000);
+    histogram.record(70000);
+
+    EXPECT_EQ(histogram.get_percentile(0.5), 10u);
+    EXPECT_EQ(histogram.get_percentile(0.99), 10u);
+    EXPECT_GE(histogram.get_percentile(0.999), 50000u);
+    EXPECT_LT(histogram.get_percentile(0.999), 70000u);
+    EXPECT_EQ(histogram.get_max(), 70000u);
+}
+
+TEST_F(LatencyHistogramTest,
+MaximalValue) {
+    LatencyHistogram histogram;
+    histogram.record(std::numeric_limits<std::uint64_t>::max());
+    EXPECT_EQ(histogram.get_percentile(0.5), std::numeric_limits<std::uint64_t>::max());
+}
+
+TEST_F(LatencyHistogramTest,
+Merge) {
+    LatencyHistogram histogram, other;
+    histogram.record(10);
+    other.record(20);
+    other.record(30);
+    histogram.merge(other);
+
+    EXPECT_EQ(histogram.get_count(), 3u);
+    EXPECT_EQ(histogram.get_total(), 60u);
+    EXPECT_EQ(histogram.get_max(), 30u);
+    EXPECT_EQ(histogram.get_percentile(0.5), 20u);
+}
@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include <yarangc/namespaces.hpp>
+
+using namespace ::testing;
+
+class NamespacesTest : public Test {};
+
+TEST_F(NamespacesTest,
+ParseRuleFileWithoutNamespace) {
+    auto rule_file = parse_rule_file("rules/feed.yar");
+
+    EXPECT_EQ(rule_file.ns, "");
+    EXPECT_EQ(rule_file.path, "rules/feed.yar");
+}
+
+TEST_F(NamespacesTest,
+ParseRuleFileWithNamespace) {
+    auto rule_file = parse_rule_file("feed_1:rules/feed.yar");
+
+    EXPECT_EQ(rule_file.ns, "feed_1");
+    EXPECT_EQ(rule_file.path, "rules/feed.yar");
+}
+
+TEST_F(NamespacesTest,
+ParseRuleFileWithColonInPath) {
+    EXPECT_EQ(parse_rule_file("./a:b.yar").path, "./a:b.yar");
+    EXPECT_EQ(parse_rule_file("./a:b.yar").ns, "");
+    EXPECT_EQ(parse_rule_file("ns:a:b.yar").ns, "ns");
+    EXPECT_EQ(parse_rule_file("ns:a:b.yar").path, "a:b.yar");
+}
+
+TEST_F(NamespacesTest,
+ParseRuleFileWithoutPath) {
+    EXPECT_THROW(parse_rule_file("ns:"), std::runtime_error);
+}
+
+TEST_F(NamespacesTest,
+QualifiedNames) {
+    EXPECT_EQ(qualify_rule_name("", "abc"), "abc");
+    EXPECT_EQ(qualify_rule_name("ns", "abc"), "ns:abc");
+    EXPECT_EQ(get_rule_namespace("abc"), "");
+    EXPECT_EQ(get_rule_namespace("ns:abc"), "ns");
+}
+
+TEST_F(NamespacesTest,
+Identifiers) {
+    EXPECT_EQ(to_identifier("abc_1"), "abc_1");
+    EXPECT_EQ(to_identifier("ns:abc"), "ns_abc");
+}
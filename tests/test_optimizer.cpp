@@ -0,0 +1,358 @@
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <yarangc/codegen.hpp>
+#include <yarangc/externals.hpp>
+#include <yarangc/optimizer.hpp>
+#include <yarangc/pattern_extractor.hpp>
+
+using namespace ::testing;
+using namespace yaramod;
+
+class OptimizerTest : public Test
+{
+public:
+    OptimizerTest() : optimizer(), pattern_extractor(&optimizer), codegen(&pattern_extractor, &optimizer) {}
+
+    void input(const std::string& rules)
+    {
+        ss << rules;
+        ruleset = yaramod.parseStream(ss);
+
+        optimizer.optimize(ruleset.get());
+        pattern_extractor.extract(ruleset.get());
+    }
+
+    std::vector<std::string> removed_rules() const
+    {
+        std::vector<std::string> result;
+        for (const auto& removed : optimizer.get_removed_rules())
+            result.push_back(removed.name);
+        return result;
+    }
+
+    std::vector<std::string> removed_strings() const
+    {
+        std::vector<std::string> result;
+        for (const auto& removed : optimizer.get_removed_strings())
+            result.push_back(removed.rule + ":" + removed.id);
+        return result;
+    }
+
+    Optimizer optimizer;
+    PatternExtractor pattern_extractor;
+    Codegen codegen;
+
+    std::stringstream ss;
+    Yaramod yaramod;
+    std::unique_ptr<YaraFile> ruleset;
+};
+
+TEST_F(OptimizerTest,
+NothingToRemove) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01 and helper
+}
+)");
+
+    EXPECT_TRUE(removed_rules().empty());
+    EXPECT_TRUE(removed_strings().empty());
+    EXPECT_EQ(pattern_extractor.get_literal_patterns().size(), 2u);
+}
+
+TEST_F(OptimizerTest,
+UnreferencedPrivateRule) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+)");
+
+    EXPECT_EQ(removed_rules(), std::vector<std::string>{"helper"});
+    EXPECT_EQ(optimizer.get_removed_rules()[0].reason, RemovalReason::Unreachable);
+    EXPECT_FALSE(pattern_extractor.get_rule_info_table().contains("helper"));
+    EXPECT_EQ(pattern_extractor.get_literal_patterns().size(), 1u);
+}
+
+TEST_F(OptimizerTest,
+TransitivelyReachablePrivateRule) {
+    input(R"(
+private rule inner {
+strings:
+    $i = "inner"
+condition:
+    $i
+}
+
+private rule outer {
+condition:
+    inner
+}
+
+private rule unused {
+condition:
+    outer
+}
+
+rule abc {
+condition:
+    outer
+}
+)");
+
+    EXPECT_EQ(removed_rules(), std::vector<std::string>{"unused"});
+    EXPECT_EQ(pattern_extractor.get_rule_info_table().at("abc").id, 2u);
+}
+
+TEST_F(OptimizerTest,
+AlwaysFalsePublicRule) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    false and ($s01 or helper)
+}
+)");
+
+    EXPECT_EQ(removed_rules(), (std::vector<std::string>{"helper", "abc"}));
+    EXPECT_EQ(optimizer.get_removed_rules()[1].reason, RemovalReason::AlwaysFalse);
+    EXPECT_TRUE(pattern_extractor.get_literal_patterns().empty());
+}
+
+TEST_F(OptimizerTest,
+StringsInFoldedBranch) {
+    input(R"(
+rule abc {
+strings:
+    $s01 = "abc"
+    $s02 = "def"
+condition:
+    $s01 or (1 + 1 == 3 and $s02)
+}
+)");
+
+    EXPECT_TRUE(removed_rules().empty());
+    EXPECT_EQ(removed_strings(), std::vector<std::string>{"abc:$s02"});
+    EXPECT_EQ(pattern_extractor.get_literal_patterns().size(), 1u);
+
+    EXPECT_EQ(codegen.generate(ruleset->getRules()[0].get()),
+        "bool rule_abc(const ScanContext* ctx)\n"
+        "{\n"
+        "return match_string(ctx, 0ul);\n"
+        "}"
+    );
+}
+
+TEST_F(OptimizerTest,
+ConstantOperandOfAnd) {
+    input(R"(
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    (0x10 > 5) and $s01
+}
+)");
+
+    EXPECT_EQ(codegen.generate(ruleset->getRules()[0].get()),
+        "bool rule_abc(const ScanContext* ctx)\n"
+        "{\n"
+        "return match_string(ctx, 0ul);\n"
+        "}"
+    );
+}
+
+TEST_F(OptimizerTest,
+FoldedRuleReference) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    true or $h
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01 and helper
+}
+)");
+
+    EXPECT_EQ(removed_rules(), std::vector<std::string>{"helper"});
+    EXPECT_EQ(codegen.generate(ruleset->getRules()[1].get()),
+        "bool rule_abc(const ScanContext* ctx)\n"
+        "{\n"
+        "return match_string(ctx, 0ul);\n"
+        "}"
+    );
+}
+
+TEST_F(OptimizerTest,
+LoopWithBodyNeverHolding) {
+    input(R"(
+rule abc {
+strings:
+    $s01 = "abc"
+    $s02 = "def"
+condition:
+    $s01 or for any i in (1, 2, 3) : ( i > 5 and 1 == 0 and $s02 at i )
+}
+)");
+
+    EXPECT_EQ(removed_strings(), std::vector<std::string>{"abc:$s02"});
+}
+
+TEST_F(OptimizerTest,
+SpecializedOnExternal) {
+    input(bind_externals(R"(
+private rule is_pe {
+condition:
+    filetype == "pe"
+}
+
+rule pe_rule {
+strings:
+    $mz = "MZ"
+condition:
+    is_pe and $mz
+}
+
+rule elf_rule {
+strings:
+    $elf = "ELF"
+condition:
+    filetype == "elf" and $elf
+}
+
+rule any_rule {
+strings:
+    $a = "any"
+    $b = "pe only"
+condition:
+    $a or (filetype contains "p" and $b)
+}
+)", {{"filetype", std::string{"elf"}}}));
+
+    EXPECT_EQ(removed_rules(), (std::vector<std::string>{"is_pe", "pe_rule"}));
+    EXPECT_EQ(removed_strings(), std::vector<std::string>{"any_rule:$b"});
+}
+
+TEST_F(OptimizerTest,
+GlobalRuleNeverHolding) {
+    input(R"(
+global rule gate {
+condition:
+    1 == 2
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+)");
+
+    EXPECT_EQ(removed_rules(), (std::vector<std::string>{"gate", "abc"}));
+    EXPECT_EQ(optimizer.get_removed_rules()[0].reason, RemovalReason::AlwaysFalse);
+    EXPECT_EQ(optimizer.get_removed_rules()[1].reason, RemovalReason::GatedByGlobal);
+    EXPECT_TRUE(pattern_extractor.get_literal_patterns().empty());
+}
+
+TEST_F(OptimizerTest,
+PrivateGlobalRuleAlwaysHolding) {
+    input(R"(
+global private rule gate {
+condition:
+    true
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+)");
+
+    EXPECT_EQ(removed_rules(), std::vector<std::string>{"gate"});
+    EXPECT_EQ(optimizer.get_removed_rules()[0].reason, RemovalReason::AlwaysTrue);
+}
+
+TEST_F(OptimizerTest,
+GlobalRulesGate) {
+    input(R"(
+global private rule small {
+condition:
+    filesize < 1024
+}
+
+global private rule has_mz {
+strings:
+    $mz = "MZ"
+condition:
+    $mz at 0
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+)");
+
+    EXPECT_TRUE(removed_rules().empty());
+
+    codegen.generate(ruleset.get());
+    auto result = codegen.get_result();
+    EXPECT_NE(result.find(
+        "static bool evaluate_prescan_global_rules(ScanContext* ctx)\n"
+        "{\n"
+        "if (!(ctx->rule_matches[0] = rule_small(ctx)))\n"
+        "    return false;\n"
+        "return true;\n"
+        "}"
+    ), std::string::npos);
+    EXPECT_NE(result.find(
+        "static bool evaluate_rules(ScanContext* ctx)\n"
+        "{\n"
+        "if (!(ctx->rule_matches[1] = rule_has_mz(ctx)))\n"
+        "    return false;\n"
+        "ctx->rule_matches[2] = rule_abc(ctx);\n"
+        "return true;\n"
+        "}"
+    ), std::string::npos);
+}
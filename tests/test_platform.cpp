@@ -0,0 +1,26 @@
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+#include <hspp/platform.hpp>
+
+using namespace ::testing;
+
+TEST(PlatformTest,
+TargetNamesRoundtrip) {
+    for (auto target : hspp::AllTargets)
+        EXPECT_EQ(hspp::parse_target(hspp::get_target_name(target)), target);
+}
+
+TEST(PlatformTest,
+UnknownTarget) {
+    EXPECT_THROW(hspp::parse_target("sse2"), std::runtime_error);
+    EXPECT_THROW(hspp::parse_target(""), std::runtime_error);
+}
+
+TEST(PlatformTest,
+FixedTargetsDoNotDependOnHost) {
+    EXPECT_EQ(hspp::get_platform(hspp::Target::Baseline).cpu_features, 0u);
+    EXPECT_EQ(hspp::get_platform(hspp::Target::Avx2).cpu_features, HS_CPU_FEATURES_AVX2);
+    EXPECT_EQ(hspp::get_platform(hspp::Target::Avx512).cpu_features, HS_CPU_FEATURES_AVX2 | HS_CPU_FEATURES_AVX512);
+}
@@ -0,0 +1,117 @@
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <yarangc/optimizer.hpp>
+#include <yarangc/pattern_extractor.hpp>
+#include <yarangc/prefix_analyzer.hpp>
+
+using namespace ::testing;
+using namespace yaramod;
+
+class PrefixAnalyzerTest : public Test
+{
+public:
+    PrefixAnalyzerTest() : optimizer(), pattern_extractor(&optimizer) {}
+
+    std::uint64_t analyze(const std::string& rules)
+    {
+        ss << rules;
+        ruleset = yaramod.parseStream(ss);
+
+        optimizer.optimize(ruleset.get());
+        pattern_extractor.extract(ruleset.get());
+
+        // Regexes are treated as unbounded, literals are as wide as they are long
+        std::vector<std::uint64_t> pattern_widths(pattern_extractor.get_regex_patterns().size(), PrefixAnalyzer::WholeData);
+        for (const auto& literal : pattern_extractor.get_literal_patterns())
+            pattern_widths.push_back(literal->get_pattern().length());
+
+        return PrefixAnalyzer(&pattern_extractor, &optimizer, std::move(pattern_widths)).analyze(ruleset.get());
+    }
+
+    Optimizer optimizer;
+    PatternExtractor pattern_extractor;
+
+    std::stringstream ss;
+    Yaramod yaramod;
+    std::unique_ptr<YaraFile> ruleset;
+};
+
+TEST_F(PrefixAnalyzerTest,
+HeaderChecksNeedOnlyHeader) {
+    EXPECT_EQ(analyze(R"(
+rule mz {
+strings:
+    $mz = "MZ"
+condition:
+    uint16(0) == 0x5A4D and $mz at 0 and uint32be(4) == 0
+}
+)"), 8);
+}
+
+TEST_F(PrefixAnalyzerTest,
+RangeNeedsItsEndAndMatchWidth) {
+    EXPECT_EQ(analyze(R"(
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01 in (10..100)
+}
+)"), 100 + 3 + PrefixAnalyzer::MatchContext);
+}
+
+TEST_F(PrefixAnalyzerTest,
+ForOfTakesWidestString) {
+    EXPECT_EQ(analyze(R"(
+rule abc {
+strings:
+    $s01 = "ab"
+    $s02 = "abcd"
+condition:
+    for all of them : ($ at 16)
+}
+)"), 16 + 4 + PrefixAnalyzer::MatchContext);
+}
+
+TEST_F(PrefixAnalyzerTest,
+PlainMatchNeedsWholeData) {
+    EXPECT_EQ(analyze(R"(
+rule mz {
+strings:
+    $mz = "MZ"
+condition:
+    uint16(0) == 0x5A4D
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+)"), PrefixAnalyzer::WholeData);
+}
+
+TEST_F(PrefixAnalyzerTest,
+ComputedOffsetNeedsWholeData) {
+    EXPECT_EQ(analyze(R"(
+rule pe {
+condition:
+    uint32(uint32(0x3C)) == 0x00004550
+}
+)"), PrefixAnalyzer::WholeData);
+}
+
+TEST_F(PrefixAnalyzerTest,
+UnboundedRegexNeedsWholeData) {
+    EXPECT_EQ(analyze(R"(
+rule abc {
+strings:
+    $s01 = /ab+c/
+condition:
+    $s01 at 0
+}
+)"), PrefixAnalyzer::WholeData);
+}
@@ -0,0 +1,81 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <yarang/result_store.hpp>
+
+using namespace ::testing;
+
+class ResultStoreTest : public Test
+{
+public:
+    ResultStoreTest() : path(std::filesystem::temp_directory_path() / ("yarang_results_test_" + std::to_string(::getpid()))) {}
+    ~ResultStoreTest() { std::filesystem::remove(path); }
+
+    std::vector<ResultStore::Result> results(const ResultStore& store) const
+    {
+        return {store.get_results().begin(), store.get_results().end()};
+    }
+
+    std::filesystem::path path;
+};
+
+TEST_F(ResultStoreTest,
+MissingStoreIsEmpty) {
+    ResultStore store;
+    store.load(path);
+    EXPECT_TRUE(store.get_results().empty());
+}
+
+TEST_F(ResultStoreTest,
+SaveAndLoad) {
+    ResultStore store;
+    store.add("/data/b", "rule_1");
+    store.add("/data/a", "rule_2");
+    store.add("/data/a", "rule_1");
+    store.save(path);
+
+    std::ifstream in_file(path);
+    std::stringstream contents;
+    contents << in_file.rdbuf();
+    EXPECT_EQ(contents.str(), "/data/a\trule_1\n/data/a\trule_2\n/data/b\trule_1\n");
+
+    ResultStore loaded;
+    loaded.load(path);
+    EXPECT_EQ(results(loaded), results(store));
+}
+
+TEST_F(ResultStoreTest,
+MergeReplacesReportedRulesOfScannedFiles) {
+    ResultStore store;
+    store.add("/data/a", "changed");
+    store.add("/data/a", "unchanged");
+    store.add("/data/b", "changed");
+
+    ResultStore delta;
+    delta.add("/data/c", "changed");
+
+    store.merge({"changed", "added"}, {}, {"/data/a", "/data/c"}, delta);
+    EXPECT_EQ(results(store), (std::vector<ResultStore::Result>{
+        {"/data/a", "unchanged"},
+        {"/data/b", "changed"},
+        {"/data/c", "changed"}
+    }));
+}
+
+TEST_F(ResultStoreTest,
+MergeDropsRetractedRulesEverywhere) {
+    ResultStore store;
+    store.add("/data/a", "deleted");
+    store.add("/data/b", "deleted");
+    store.add("/data/b", "kept");
+
+    store.merge({}, {"deleted"}, {"/data/a"}, ResultStore{});
+    EXPECT_EQ(results(store), (std::vector<ResultStore::Result>{
+        {"/data/b", "kept"}
+    }));
+}
@@ -0,0 +1,271 @@
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <yarangc/codegen.hpp>
+#include <yarangc/optimizer.hpp>
+#include <yarangc/pattern_extractor.hpp>
+#include <yarangc/scheduler.hpp>
+
+using namespace ::testing;
+using namespace yaramod;
+
+class SchedulerTest : public Test
+{
+public:
+    SchedulerTest() : optimizer(), pattern_extractor(&optimizer), scheduler(&pattern_extractor, &optimizer), codegen(&pattern_extractor, &optimizer) {}
+
+    void input(const std::string& rules)
+    {
+        ss << rules;
+        ruleset = yaramod.parseStream(ss);
+
+        optimizer.optimize(ruleset.get());
+        pattern_extractor.extract(ruleset.get());
+        scheduler.schedule(ruleset.get());
+    }
+
+    std::vector<std::string> schedule() const
+    {
+        std::vector<std::string> result;
+        for (const auto& scheduled : scheduler.get_schedule())
+            result.push_back(scheduled.rule->getName());
+        return result;
+    }
+
+    Optimizer optimizer;
+    PatternExtractor pattern_extractor;
+    Scheduler scheduler;
+    Codegen codegen;
+
+    std::stringstream ss;
+    Yaramod yaramod;
+    std::unique_ptr<YaraFile> ruleset;
+};
+
+TEST_F(SchedulerTest,
+SharedHelperIsScheduledBeforeConsumers) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01 and helper
+}
+
+rule def {
+strings:
+    $s01 = "def"
+condition:
+    $s01 or helper
+}
+)");
+
+    EXPECT_FALSE(scheduler.is_inlined("helper"));
+    EXPECT_EQ(schedule(), (std::vector<std::string>{"helper", "abc", "def"}));
+}
+
+TEST_F(SchedulerTest,
+SingleConsumerHelperIsInlined) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01 and helper
+}
+)");
+
+    EXPECT_TRUE(scheduler.is_inlined("helper"));
+    EXPECT_EQ(schedule(), std::vector<std::string>{"abc"});
+
+    codegen.generate(ruleset.get());
+    EXPECT_EQ(codegen.get_shards(), std::vector<std::string>{
+        "#include \"ruleset.yar.hpp\"\n"
+        "\n"
+        "bool rule_abc(const ScanContext* ctx)\n"
+        "{\n"
+        "return match_string(ctx, 1ul)\n"
+        "&& (match_string(ctx, 0ul));\n"
+        "}"
+    });
+    EXPECT_EQ(codegen.get_header().find("rule_helper"), std::string::npos);
+    EXPECT_EQ(codegen.get_result().find("rule_helper"), std::string::npos);
+}
+
+TEST_F(SchedulerTest,
+HelperReferencedTwiceFromSameRule) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    ($s01 and helper) or (#s01 > 2 and not helper)
+}
+)");
+
+    EXPECT_FALSE(scheduler.is_inlined("helper"));
+    EXPECT_EQ(schedule(), (std::vector<std::string>{"helper", "abc"}));
+}
+
+TEST_F(SchedulerTest,
+HelperReferencedInLoopBodyIsNotInlined) {
+    input(R"(
+private rule helper {
+strings:
+    $h = "helper"
+condition:
+    $h
+}
+
+private rule outer_helper {
+strings:
+    $o = "outer"
+condition:
+    #o > 1
+}
+
+rule abc {
+condition:
+    outer_helper and for any i in (0..filesize) : (helper and uint8(i) == 0x90)
+}
+)");
+
+    EXPECT_FALSE(scheduler.is_inlined("helper"));
+    EXPECT_TRUE(scheduler.is_inlined("outer_helper"));
+    EXPECT_EQ(schedule(), (std::vector<std::string>{"helper", "abc"}));
+}
+
+TEST_F(SchedulerTest,
+GlobalRulesWithDependenciesComeFirst) {
+    input(R"(
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+
+private rule mz {
+strings:
+    $mz = "MZ"
+condition:
+    $mz at 0
+}
+
+global private rule is_pe {
+condition:
+    mz and filesize > 64
+}
+
+global private rule small {
+condition:
+    filesize < 1024
+}
+
+rule def {
+condition:
+    abc and is_pe
+}
+)");
+
+    ASSERT_EQ(scheduler.get_prescan_global_rules().size(), 1u);
+    EXPECT_EQ(scheduler.get_prescan_global_rules()[0].rule->getName(), "small");
+    EXPECT_TRUE(scheduler.is_inlined("mz"));
+    EXPECT_EQ(schedule(), (std::vector<std::string>{"is_pe", "abc", "def"}));
+}
+
+TEST_F(SchedulerTest,
+NamespacesAreGatedIndependently) {
+    std::stringstream first{R"(
+global rule small {
+condition:
+    filesize < 100
+}
+
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+)"};
+    std::stringstream second{R"(
+rule abc {
+strings:
+    $s01 = "abc"
+condition:
+    $s01
+}
+)"};
+    auto first_file = yaramod.parseStream(first);
+    auto second_file = yaramod.parseStream(second);
+
+    RuleList rules;
+    for (const auto& [ns, file] : {std::pair{"first", first_file.get()}, std::pair{"second", second_file.get()}})
+    {
+        for (const auto& rule : file->getRules())
+        {
+            rule->setName(qualify_rule_name(ns, rule->getName()));
+            rules.push_back(rule);
+        }
+    }
+
+    optimizer.optimize(rules);
+    pattern_extractor.extract(rules);
+    codegen.generate(rules);
+
+    // Both rules share the same pattern
+    EXPECT_EQ(pattern_extractor.get_literal_patterns().size(), 1u);
+
+    auto result = codegen.get_result();
+    EXPECT_NE(result.find(
+        "Rule{\"first:small\", RuleVisibility::Public, \"first\", nullptr, 0, nullptr, 0, nullptr, nullptr, 0},\n"
+        "Rule{\"first:abc\", RuleVisibility::Public, \"first\", nullptr, 0, nullptr, 0, rule_1_strings, rule_1_patterns, 1},\n"
+        "Rule{\"second:abc\", RuleVisibility::Public, \"second\", nullptr, 0, nullptr, 0, rule_2_strings, rule_2_patterns, 1},\n"
+    ), std::string::npos);
+    EXPECT_NE(result.find(
+        "static bool evaluate_prescan_global_rules(ScanContext* ctx)\n"
+        "{\n"
+        "bool holds = false;\n"
+        "holds = ((ctx->rule_matches[0] = rule_0_first_small(ctx))) || holds;\n"
+        "holds = true;\n"
+        "return holds;\n"
+        "}"
+    ), std::string::npos);
+    EXPECT_NE(result.find(
+        "static bool evaluate_rules(ScanContext* ctx)\n"
+        "{\n"
+        "if (!ctx->rule_matches[0])\n"
+        "{\n"
+        "    std::memset(ctx->rule_matches + 0, 0, 2);\n"
+        "    goto namespace_0_end;\n"
+        "}\n"
+        "ctx->rule_matches[1] = rule_1_first_abc(ctx);\n"
+        "namespace_0_end:;\n"
+        "ctx->rule_matches[2] = rule_2_second_abc(ctx);\n"
+        "return true;\n"
+        "}"
+    ), std::string::npos);
+}
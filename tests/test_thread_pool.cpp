@@ -0,0 +1,56 @@
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <yarangc/thread_pool.hpp>
+
+using namespace ::testing;
+
+TEST(ThreadPoolTest,
+ParallelForCoversWholeRange) {
+    ThreadPool thread_pool(4);
+
+    std::vector<int> visited(1000, 0);
+    thread_pool.parallel_for(visited.size(), [&](std::size_t begin, std::size_t end) {
+        for (auto i = begin; i < end; ++i)
+            visited[i]++;
+    });
+
+    EXPECT_EQ(visited, std::vector<int>(1000, 1));
+}
+
+TEST(ThreadPoolTest,
+ParallelForWithFewerItemsThanThreads) {
+    ThreadPool thread_pool(8);
+
+    std::atomic<std::size_t> calls = 0, items = 0;
+    thread_pool.parallel_for(3, [&](std::size_t begin, std::size_t end) {
+        calls++;
+        items += end - begin;
+    });
+
+    EXPECT_EQ(calls, 3u);
+    EXPECT_EQ(items, 3u);
+}
+
+TEST(ThreadPoolTest,
+ParallelForRethrowsException) {
+    ThreadPool thread_pool(2);
+
+    EXPECT_THROW(thread_pool.parallel_for(10, [](std::size_t begin, std::size_t) {
+        if (begin == 0)
+            throw std::runtime_error("failure");
+    }), std::runtime_error);
+}
+
+TEST(ThreadPoolTest,
+SubmitReturnsFuture) {
+    ThreadPool thread_pool(1);
+
+    int value = 0;
+    thread_pool.submit([&]() { value = 42; }).get();
+
+    EXPECT_EQ(value, 42);
+}